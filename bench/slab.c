@@ -0,0 +1,147 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "collision.h"
+#include "renderer.h"
+#include "slab.h"
+#include "stat.h"
+
+/*
+ * Objects every thread keeps alive while it cycles through them.
+ */
+#define BENCH_LIVE_COUNT	64
+
+ObscuraPerfCounters ObscuraCounters;
+
+struct __bench_thread {
+	pthread_t			 thread;
+	ObscuraAllocationCallbacks	*allocator;
+	uint32_t			 iterations;
+};
+
+static pthread_barrier_t barrier;
+
+static void *
+sysalloc(size_t size, size_t alignment)
+{
+	void *ptr = NULL;
+
+	if (posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, size)) {
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+static void
+sysfree(void *ptr)
+{
+	free(ptr);
+}
+
+static ObscuraAllocationCallbacks glibc = {
+	.allocation = &sysalloc,
+	.free       = &sysfree,
+};
+
+/*
+ * Replaces the oldest of the live collisions and rays with new ones, iterations times.
+ */
+static void *
+start_routine(void *arg)
+{
+	struct __bench_thread *thr = arg;
+	ObscuraAllocationCallbacks *allocator = thr->allocator;
+
+	ObscuraCollision *collisions[BENCH_LIVE_COUNT] = {};
+	ObscuraRendererRay *rays[BENCH_LIVE_COUNT] = {};
+	for (uint32_t i = 0; i < BENCH_LIVE_COUNT; i++) {
+		collisions[i] = ObscuraCreateCollision(allocator);
+		rays[i] = ObscuraCreateRendererRay(allocator);
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	for (uint32_t i = 0; i < thr->iterations; i++) {
+		uint32_t j = i % BENCH_LIVE_COUNT;
+
+		ObscuraDestroyCollision(&collisions[j], allocator);
+		ObscuraDestroyRendererRay(&rays[j], allocator);
+
+		collisions[j] = ObscuraCreateCollision(allocator);
+		rays[j] = ObscuraCreateRendererRay(allocator);
+		collisions[j]->distance = i;
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	for (uint32_t i = 0; i < BENCH_LIVE_COUNT; i++) {
+		ObscuraDestroyCollision(&collisions[i], allocator);
+		ObscuraDestroyRendererRay(&rays[i], allocator);
+	}
+
+	return NULL;
+}
+
+/*
+ * Nanoseconds per allocation and free, every iteration allocating and freeing a collision, a ray and the
+ * bounding volume of the ray.
+ */
+static double
+run(ObscuraAllocationCallbacks *allocator, uint32_t threads_count, uint32_t iterations)
+{
+	struct __bench_thread *threads = calloc(threads_count, sizeof(struct __bench_thread));
+
+	pthread_barrier_init(&barrier, NULL, threads_count + 1);
+
+	for (uint32_t i = 0; i < threads_count; i++) {
+		threads[i].allocator  = allocator;
+		threads[i].iterations = iterations;
+
+		if (pthread_create(&threads[i].thread, NULL, &start_routine, &threads[i])) {
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	struct timespec start = {}, end = {};
+
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_barrier_wait(&barrier);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	for (uint32_t i = 0; i < threads_count; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+
+	pthread_barrier_destroy(&barrier);
+	free(threads);
+
+	double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+	return ns / ((double) iterations * threads_count * 3);
+}
+
+int main(int argc, char **argv) {
+	uint32_t iterations = argc > 1 ? atoi(argv[1]) : 2000000;
+
+	ObscuraUseSlabs(&glibc);
+
+	printf("threads   glibc     slab\n");
+	for (uint32_t threads_count = 1; threads_count <= 16; threads_count *= 2) {
+		double system = run(&glibc, threads_count, iterations / threads_count);
+		double slab = run(&ObscuraSlabAllocationCallbacks, threads_count, iterations / threads_count);
+
+		printf("%-9u %5.1f ns  %5.1f ns\n", threads_count, system, slab);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stat.h"
+#include "thread.h"
+
+#define BENCH_PRODUCERS_COUNT	4
+#define BENCH_PRODUCER_TASKS	2500
+
+/*
+ * Fan-out tasks enqueue BENCH_FAN_WIDTH subtasks each, BENCH_FAN_DEPTH levels deep.
+ */
+#define BENCH_FAN_WIDTH		4
+#define BENCH_FAN_DEPTH		3
+#define BENCH_FAN_ROOTS		8
+
+#define BENCH_THROUGHPUT_TASKS	2000000
+
+ObscuraPerfCounters ObscuraCounters;
+
+static const char *modes[] = {
+	"single-producer",
+	"multi-producer",
+};
+
+static ObscuraWorkQueue *wq = NULL;
+static volatile uint64_t counter = 0;
+
+static void *
+memalloc(size_t size, size_t alignment)
+{
+	void *ptr = NULL;
+
+	if (posix_memalign(&ptr, alignment < sizeof(void *) ? sizeof(void *) : alignment, size)) {
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "out of memory");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+static void
+memfree(void *ptr)
+{
+	free(ptr);
+}
+
+static ObscuraAllocationCallbacks allocator = {
+	.allocation = &memalloc,
+	.free       = &memfree,
+};
+
+static void *
+increment(void *arg __attribute__((unused)))
+{
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+static void *
+fan(void *arg)
+{
+	uintptr_t depth = (uintptr_t) arg;
+
+	__atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+
+	if (depth > 0) {
+		for (uint32_t i = 0; i < BENCH_FAN_WIDTH; i++) {
+			ObscuraEnqueueTask(wq, &fan, (void *) (depth - 1));
+		}
+	}
+
+	return NULL;
+}
+
+static void *
+produce(void *arg __attribute__((unused)))
+{
+	for (uint32_t i = 0; i < BENCH_PRODUCER_TASKS; i++) {
+		ObscuraEnqueueTask(wq, &increment, NULL);
+	}
+
+	return NULL;
+}
+
+static double
+now(void)
+{
+	struct timespec t = {};
+	clock_gettime(CLOCK_MONOTONIC, &t);
+
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * Checks that every task enqueued runs exactly once, and that ObscuraWaitAll only returns once they all ran.
+ * In single-producer mode the calling thread enqueues everything; in multi-producer mode several threads
+ * enqueue at once, and tasks enqueue subtasks.
+ */
+static bool
+stress(ObscuraWorkQueueMode mode, uint32_t threads_capacity, uint32_t tasks_capacity, PFN_ObscuraWaitStrategy wait,
+	uint32_t rounds)
+{
+	wq = ObscuraCreateWorkQueue(threads_capacity, tasks_capacity, wait, mode, &allocator);
+
+	bool ok = true;
+	for (uint32_t r = 0; ok && r < rounds; r++) {
+		counter = 0;
+
+		if (mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+			pthread_t producers[BENCH_PRODUCERS_COUNT];
+			for (uint32_t i = 0; i < BENCH_PRODUCERS_COUNT; i++) {
+				if (pthread_create(&producers[i], NULL, &produce, NULL)) {
+					fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+			}
+			for (uint32_t i = 0; i < BENCH_PRODUCERS_COUNT; i++) {
+				pthread_join(producers[i], NULL);
+			}
+		} else {
+			for (uint32_t i = 0; i < BENCH_PRODUCERS_COUNT; i++) {
+				produce(NULL);
+			}
+		}
+
+		ObscuraWaitAll(wq);
+		ok = counter == BENCH_PRODUCERS_COUNT * BENCH_PRODUCER_TASKS;
+
+		if (ok && mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+			counter = 0;
+			for (uint32_t i = 0; i < BENCH_FAN_ROOTS; i++) {
+				ObscuraEnqueueTask(wq, &fan, (void *) BENCH_FAN_DEPTH);
+			}
+			ObscuraWaitAll(wq);
+
+			uint64_t tasks = 0, level = 1;
+			for (uint32_t d = 0; d <= BENCH_FAN_DEPTH; d++) {
+				tasks += level;
+				level *= BENCH_FAN_WIDTH;
+			}
+			ok = counter == BENCH_FAN_ROOTS * tasks;
+		}
+	}
+
+	ObscuraDestroyWorkQueue(&wq, &allocator);
+
+	return ok;
+}
+
+/*
+ * Millions of empty tasks run per second, enqueued by the calling thread one ring at a time.
+ */
+static double
+throughput(ObscuraWorkQueueMode mode, uint32_t threads_capacity, uint32_t tasks_capacity)
+{
+	wq = ObscuraCreateWorkQueue(threads_capacity, tasks_capacity, &ObscuraParkWait, mode, &allocator);
+
+	double t0 = now();
+	for (uint32_t i = 0; i < BENCH_THROUGHPUT_TASKS; i += tasks_capacity) {
+		for (uint32_t j = 0; j < tasks_capacity; j++) {
+			ObscuraEnqueueTask(wq, &increment, NULL);
+		}
+		ObscuraWaitAll(wq);
+	}
+	double t1 = now();
+
+	ObscuraDestroyWorkQueue(&wq, &allocator);
+
+	return BENCH_THROUGHPUT_TASKS / (t1 - t0) / 1e6;
+}
+
+int main(int argc, char **argv) {
+	bool run_stress = argc < 2 || strcmp(argv[1], "stress") == 0;
+	bool run_throughput = argc < 2 || strcmp(argv[1], "throughput") == 0;
+	uint32_t rounds = argc > 2 ? atoi(argv[2]) : 10;
+
+	if (!run_stress && !run_throughput) {
+		fprintf(stderr, "Usage: %s [stress [rounds]|throughput]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	bool ok = true;
+
+	if (run_stress) {
+		const uint32_t threads[] = { 1, 2, 4, 8 };
+		const uint32_t capacities[] = { 4, 64, 1024 };
+		const PFN_ObscuraWaitStrategy waits[] = { &ObscuraYieldWait, &ObscuraParkWait };
+		const char *wait_names[] = { "yield", "park" };
+
+		printf("stress            workers  slots  wait\n");
+		for (uint32_t m = 0; m < 2; m++) {
+			for (uint32_t t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+				for (uint32_t c = 0; c < sizeof(capacities) / sizeof(capacities[0]); c++) {
+					for (uint32_t w = 0; w < 2; w++) {
+						bool passed = stress(m, threads[t], capacities[c], waits[w], rounds);
+						printf("%-18s %7u %6u  %-5s  %s\n", modes[m], threads[t], capacities[c], wait_names[w],
+							passed ? "ok" : "FAILED");
+						fflush(stdout);
+						ok = ok && passed;
+					}
+				}
+			}
+		}
+	}
+
+	if (run_throughput) {
+		uint32_t workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+		printf("throughput, Mtasks/s   64 slots  4096 slots  (%u workers)\n", workers);
+		for (uint32_t m = 0; m < 2; m++) {
+			printf("%-22s %8.1f  %10.1f\n", modes[m], throughput(m, workers, 64), throughput(m, workers, 4096));
+		}
+	}
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
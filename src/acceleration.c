@@ -0,0 +1,423 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "acceleration.h"
+#include "stat.h"
+
+struct __refresh_task {
+	ObscuraPrimitive	*primitives;
+	ObscuraSphereSet	*spheres;
+	vec4			*positions;
+	uint32_t		 begin;
+	uint32_t		 end;
+};
+
+static void
+bounds(ObscuraPrimitive *primitive)
+{
+	ObscuraBoundingVolume *volume = primitive->volume;
+
+	vec4 extent = VEC4_ZERO;
+	switch (volume->type) {
+	case OBSCURA_BOUNDING_VOLUME_TYPE_AABB:
+		extent = volume->volume.aabb.half_extents;
+		break;
+	case OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE:
+		extent = _mm_set1_ps(volume->volume.sphere.radius);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+	extent[3] = 0;
+
+	primitive->lower = primitive->position - extent;
+	primitive->upper = primitive->position + extent;
+}
+
+static void *
+refresh(void *arg)
+{
+	struct __refresh_task *task = arg;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		ObscuraPrimitive *primitive = &task->primitives[i];
+		primitive->position = task->positions[primitive->geometry];
+
+		bounds(primitive);
+		if (primitive->volume->type == OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE) {
+			ObscuraStoreSphere(task->spheres, i, primitive->position, primitive->volume);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Tests the ray against the primitives left out of the index, which are bounded by boxes.
+ */
+static void
+collideboxes(ObscuraAccelerationStructure *accel, vec4 position, ObscuraBoundingVolume *ray, ObscuraVisible *visible)
+{
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+	for (uint32_t i = accel->indexed_count; i < accel->primitives_count; i++) {
+		ObscuraPrimitive *primitive = &accel->primitives[i];
+
+		ObscuraCollision collision = {};
+		ObscuraCollidesWith(ray, position, primitive->volume, primitive->position, &collision);
+		if (collision.hit) {
+			r->tmax = collision.distance;
+
+			visible->geometry  = primitive->geometry;
+			visible->collision = collision;
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT],
+		accel->primitives_count - accel->indexed_count);
+}
+
+static bool
+occludeboxes(ObscuraAccelerationStructure *accel, vec4 position, ObscuraBoundingVolume *ray)
+{
+	uint32_t i = accel->indexed_count;
+	bool hit = false;
+
+	while (!hit && i < accel->primitives_count) {
+		ObscuraPrimitive *primitive = &accel->primitives[i];
+
+		ObscuraCollision collision = {};
+		ObscuraCollidesWith(ray, position, primitive->volume, primitive->position, &collision);
+		hit = collision.hit;
+		i++;
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], i - accel->indexed_count);
+
+	return hit;
+}
+
+ObscuraAccelerationStructure *
+ObscuraCreateAccelerationStructure(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraAccelerationStructure *accel = allocator->allocation(sizeof(ObscuraAccelerationStructure), 8);
+	accel->spheres = ObscuraCreateSphereSet(allocator);
+
+	return accel;
+}
+
+void
+ObscuraDestroyAccelerationStructure(ObscuraAccelerationStructure **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraAccelerationStructure *accel = *ptr;
+
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		ObscuraDestroyBoundingVolumeHierarchy((ObscuraBoundingVolumeHierarchy **) &accel->structure, allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+		ObscuraDestroyUniformGrid((ObscuraUniformGrid **) &accel->structure, allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		ObscuraDestroyWideBoundingVolumeHierarchy((ObscuraWideBoundingVolumeHierarchy **) &accel->structure, allocator);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	ObscuraDestroySphereSet(&accel->spheres, allocator);
+	allocator->free(accel->primitives);
+	allocator->free(accel);
+
+	*ptr = NULL;
+}
+
+ObscuraAccelerationStructure *
+ObscuraBindAccelerationStructure(ObscuraAccelerationStructure *accel, ObscuraAccelerationStructureType type,
+	ObscuraAllocationCallbacks *allocator)
+{
+	accel->type = type;
+
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		accel->structure = ObscuraCreateBoundingVolumeHierarchy(allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+		accel->structure = ObscuraCreateUniformGrid(allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		accel->structure = ObscuraCreateWideBoundingVolumeHierarchy(allocator);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	return accel;
+}
+
+void
+ObscuraBuildAccelerationStructure(ObscuraAccelerationStructure *accel, ObscuraSnapshot *snapshot,
+	ObscuraAllocationCallbacks *allocator)
+{
+	if (accel->primitives_capacity < snapshot->geometries_count) {
+		allocator->free(accel->primitives);
+
+		accel->primitives_capacity = snapshot->geometries_count;
+		accel->primitives = allocator->allocation(sizeof(ObscuraPrimitive) * accel->primitives_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+	}
+
+	accel->primitives_count = snapshot->geometries_count;
+
+	/*
+	 * Every structure intersects its primitives through the sphere set, hence the geometries bounded by
+	 * spheres are indexed and the others are kept apart, after them.
+	 */
+	accel->indexed_count = 0;
+	for (uint32_t i = 0; i < accel->primitives_count; i++) {
+		if (snapshot->volumes[i]->type == OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE) {
+			accel->indexed_count++;
+		}
+	}
+
+	uint32_t indexed = 0, boxed = accel->indexed_count;
+	for (uint32_t i = 0; i < accel->primitives_count; i++) {
+		bool sphere = snapshot->volumes[i]->type == OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE;
+
+		ObscuraPrimitive *primitive = &accel->primitives[sphere ? indexed++ : boxed++];
+		primitive->position = snapshot->positions[i];
+		primitive->volume   = snapshot->volumes[i];
+		primitive->geometry = i;
+
+		bounds(primitive);
+	}
+
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+		ObscuraBuildBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->indexed_count, allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		ObscuraBuildLinearBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->indexed_count, NULL,
+			allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+		ObscuraBuildUniformGrid(accel->structure, accel->primitives, accel->indexed_count, allocator);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		ObscuraBuildWideBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->indexed_count, allocator);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	ObscuraResizeSphereSet(accel->spheres, accel->indexed_count, allocator);
+	for (uint32_t i = 0; i < accel->indexed_count; i++) {
+		ObscuraStoreSphere(accel->spheres, i, accel->primitives[i].position, accel->primitives[i].volume);
+	}
+}
+
+/*
+ * Refits the primitives to the current positions of the snapshot and rebuilds the structures meant to be
+ * rebuilt every frame. Static structures keep the hierarchy they were built with at load time.
+ */
+void
+ObscuraUpdateAccelerationStructure(ObscuraAccelerationStructure *accel, ObscuraSnapshot *snapshot,
+	ObscuraExecutionCallbacks *executor, ObscuraAllocationCallbacks *allocator)
+{
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		return;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	uint32_t tasks_count = executor->nprocs();
+	struct __refresh_task tasks[tasks_count];
+
+	for (uint32_t i = 0; i < tasks_count; i++) {
+		tasks[i].primitives = accel->primitives;
+		tasks[i].spheres    = accel->spheres;
+		tasks[i].positions  = snapshot->positions;
+		tasks[i].begin = (uint64_t) accel->primitives_count * i / tasks_count;
+		tasks[i].end   = (uint64_t) accel->primitives_count * (i + 1) / tasks_count;
+
+		executor->submit(&refresh, &tasks[i]);
+	}
+	executor->wait();
+
+	if (accel->type == OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH) {
+		ObscuraBuildLinearBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->indexed_count, executor,
+			allocator);
+	}
+}
+
+void
+ObscuraTraverseAccelerationStructure(ObscuraAccelerationStructure *accel, vec4 position, ObscuraBoundingVolume *ray,
+	ObscuraVisible *visible)
+{
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+		{
+			__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], accel->indexed_count);
+
+			uint32_t i = ObscuraCollidesWithSphereSet(ray, position, accel->spheres, 0, accel->indexed_count);
+			if (i != OBSCURA_SPHERE_SET_MISS) {
+				ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+				visible->geometry = accel->primitives[i].geometry;
+				ObscuraResolveCollision(ray, position, accel->primitives[i].position, r->tmax, &visible->collision);
+			}
+		}
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		ObscuraTraverseBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->spheres, position, ray,
+			visible);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+		ObscuraTraverseUniformGrid(accel->structure, accel->primitives, position, ray, visible);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		ObscuraTraverseWideBoundingVolumeHierarchy(accel->structure, accel->primitives, accel->spheres, position, ray,
+			visible);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	if (accel->indexed_count < accel->primitives_count) {
+		collideboxes(accel, position, ray, visible);
+	}
+}
+
+void
+ObscuraTraversePacketAccelerationStructure(ObscuraAccelerationStructure *accel, ObscuraRayPacket *packet,
+	ObscuraVisible *visible)
+{
+	uint32_t indices[OBSCURA_RAY_PACKET_WIDTH];
+	for (uint32_t lane = 0; lane < OBSCURA_RAY_PACKET_WIDTH; lane++) {
+		indices[lane] = OBSCURA_SPHERE_SET_MISS;
+	}
+
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		ObscuraTraversePacketBoundingVolumeHierarchy(accel->structure, accel->spheres, packet, indices);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		/*
+		 * No packet traversal of their own, every lane is traced alone. A list already tests 16 spheres
+		 * per instruction against a single ray, which beats sharing each sphere among 8 rays.
+		 */
+		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_FALLBACK], __builtin_popcount(packet->active));
+
+		for (uint32_t mask = packet->active; mask != 0; mask &= mask - 1) {
+			uint32_t lane = __builtin_ctz(mask);
+
+			ObscuraBoundingVolume ray = {
+				.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+			};
+			ObscuraBoundingVolumeRay *bounds = &ray.volume.ray;
+			ObscuraLoadRay(packet, lane, bounds);
+
+			ObscuraTraverseAccelerationStructure(accel, packet->position, &ray, &visible[lane]);
+			ObscuraStoreRay(packet, lane, bounds);
+		}
+		return;
+	default:
+		assert(false);
+		break;
+	}
+
+	for (uint32_t mask = packet->active; mask != 0; mask &= mask - 1) {
+		uint32_t lane = __builtin_ctz(mask);
+		if (indices[lane] == OBSCURA_SPHERE_SET_MISS) {
+			continue;
+		}
+
+		ObscuraBoundingVolume ray = {
+			.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+		};
+		ObscuraBoundingVolumeRay *bounds = &ray.volume.ray;
+		ObscuraLoadRay(packet, lane, bounds);
+
+		ObscuraPrimitive *primitive = &accel->primitives[indices[lane]];
+		visible[lane].geometry = primitive->geometry;
+		ObscuraResolveCollision(&ray, packet->position, primitive->position, bounds->tmax, &visible[lane].collision);
+	}
+
+	if (accel->indexed_count == accel->primitives_count) {
+		return;
+	}
+
+	for (uint32_t mask = packet->active; mask != 0; mask &= mask - 1) {
+		uint32_t lane = __builtin_ctz(mask);
+
+		ObscuraBoundingVolume ray = {
+			.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+		};
+		ObscuraBoundingVolumeRay *bounds = &ray.volume.ray;
+		ObscuraLoadRay(packet, lane, bounds);
+
+		collideboxes(accel, packet->position, &ray, &visible[lane]);
+		ObscuraStoreRay(packet, lane, bounds);
+	}
+}
+
+bool
+ObscuraOccludedAccelerationStructure(ObscuraAccelerationStructure *accel, vec4 position, ObscuraBoundingVolume *ray)
+{
+	bool occluded = false;
+
+	switch (accel->type) {
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST:
+		{
+			__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], accel->indexed_count);
+
+			occluded = ObscuraCollidesWithSphereSet(ray, position, accel->spheres, 0, accel->indexed_count) !=
+				OBSCURA_SPHERE_SET_MISS;
+		}
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH:
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH:
+		occluded = ObscuraOccludedBoundingVolumeHierarchy(accel->structure, accel->spheres, position, ray);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID:
+		occluded = ObscuraOccludedUniformGrid(accel->structure, accel->primitives, position, ray);
+		break;
+	case OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH:
+		occluded = ObscuraOccludedWideBoundingVolumeHierarchy(accel->structure, accel->spheres, position, ray);
+		break;
+	default:
+		assert(false);
+		break;
+	}
+
+	if (!occluded && accel->indexed_count < accel->primitives_count) {
+		occluded = occludeboxes(accel, position, ray);
+	}
+
+	return occluded;
+}
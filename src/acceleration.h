@@ -0,0 +1,69 @@
+#ifndef __OBSCURA_ACCELERATION_H__
+#define __OBSCURA_ACCELERATION_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bvh.h"
+#include "collision.h"
+#include "grid.h"
+#include "memory.h"
+#include "scene.h"
+#include "snapshot.h"
+#include "tensor.h"
+#include "thread.h"
+#include "visibility.h"
+#include "wbvh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ObscuraAccelerationStructureType {
+	OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST,
+	OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH,
+	OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH,
+	OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID,
+	OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH,
+} ObscuraAccelerationStructureType;
+
+/*
+ * Spatial index over the geometries of a scene snapshot. The primitives are gathered once per build, those
+ * bounded by spheres first: only these indexed_count primitives are indexed, and may be reordered by the
+ * underlying structure to keep its leaves contiguous; the sphere set mirrors them in the same order. The
+ * primitives bounded by boxes follow, and are tested one by one after every traversal. The list type has no
+ * index at all and tests every sphere.
+ */
+typedef struct ObscuraAccelerationStructure {
+	ObscuraAccelerationStructureType	 type;
+	void					*structure;
+
+	uint32_t		 primitives_capacity;
+	uint32_t		 primitives_count;
+	uint32_t		 indexed_count;
+	ObscuraPrimitive	*primitives;
+	ObscuraSphereSet	*spheres;
+} ObscuraAccelerationStructure;
+
+extern ObscuraAccelerationStructure *	ObscuraCreateAccelerationStructure	(ObscuraAllocationCallbacks *);
+extern void				ObscuraDestroyAccelerationStructure	(ObscuraAccelerationStructure **,
+	ObscuraAllocationCallbacks *);
+
+extern ObscuraAccelerationStructure *	ObscuraBindAccelerationStructure	(ObscuraAccelerationStructure *,
+	ObscuraAccelerationStructureType, ObscuraAllocationCallbacks *);
+
+extern void	ObscuraBuildAccelerationStructure	(ObscuraAccelerationStructure *, ObscuraSnapshot *,
+	ObscuraAllocationCallbacks *);
+extern void	ObscuraUpdateAccelerationStructure	(ObscuraAccelerationStructure *, ObscuraSnapshot *,
+	ObscuraExecutionCallbacks *, ObscuraAllocationCallbacks *);
+extern void	ObscuraTraverseAccelerationStructure	(ObscuraAccelerationStructure *, vec4, ObscuraBoundingVolume *,
+	ObscuraVisible *);
+extern void	ObscuraTraversePacketAccelerationStructure	(ObscuraAccelerationStructure *, ObscuraRayPacket *,
+	ObscuraVisible *);
+extern bool	ObscuraOccludedAccelerationStructure	(ObscuraAccelerationStructure *, vec4, ObscuraBoundingVolume *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Every allocation is preceded by its size, so that it can be copied when reallocated. Allocations are at
+ * least 16 byte aligned, which keeps the header aligned too.
+ */
+#define ARENA_HEADER_SIZE	16
+#define ARENA_MIN_ALIGNMENT	16
+
+#define ARENA_SIZE(ptr)	(*(size_t *) ((uint8_t *) (ptr) - ARENA_HEADER_SIZE))
+
+/*
+ * The allocation callbacks carry no context, they serve the arena last bound on the calling thread.
+ */
+static __thread ObscuraArena *bound = NULL;
+
+static void *
+allocation(size_t size, size_t alignment)
+{
+	assert(bound);
+
+	return ObscuraArenaAllocate(bound, size, alignment);
+}
+
+static void *
+reallocation(void *original, size_t size, size_t alignment)
+{
+	assert(bound);
+
+	return ObscuraArenaReallocate(bound, original, size, alignment);
+}
+
+static void
+release(void *ptr __attribute__((unused)))
+{
+}
+
+static inline uint8_t *
+align(uint8_t *ptr, size_t alignment)
+{
+	return (uint8_t *) (((uintptr_t) ptr + alignment - 1) & ~(uintptr_t) (alignment - 1));
+}
+
+static struct __arena_block *
+reserve(ObscuraArena *arena, size_t size)
+{
+	struct __arena_block *block = arena->allocator->allocation(size, PAGESIZE);
+	block->size = size;
+
+	arena->reserved_size += size;
+
+	return block;
+}
+
+ObscuraArena *
+ObscuraCreateArena(size_t block_size, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraArena *arena = allocator->allocation(sizeof(ObscuraArena), 8);
+	arena->callbacks = (ObscuraAllocationCallbacks) {
+		.allocation   = &allocation,
+		.reallocation = &reallocation,
+		.free         = &release,
+	};
+	arena->allocator = allocator;
+	arena->block_size = block_size;
+
+	return arena;
+}
+
+void
+ObscuraDestroyArena(ObscuraArena **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraResetArena(*ptr);
+
+	if (bound == *ptr) {
+		bound = NULL;
+	}
+
+	allocator->free(*ptr);
+
+	*ptr = NULL;
+}
+
+/*
+ * Makes the arena serve the allocation callbacks on the calling thread and returns them.
+ */
+ObscuraAllocationCallbacks *
+ObscuraBindArena(ObscuraArena *arena)
+{
+	bound = arena;
+
+	return &arena->callbacks;
+}
+
+/*
+ * Gives every block back to the parent allocator at once; whatever was allocated from the arena is gone.
+ */
+void
+ObscuraResetArena(ObscuraArena *arena)
+{
+	struct __arena_block *block = arena->blocks;
+	while (block != NULL) {
+		struct __arena_block *next = block->next;
+		arena->allocator->free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+	arena->cursor = NULL;
+	arena->limit  = NULL;
+	arena->last   = NULL;
+
+	arena->allocated_size = 0;
+	arena->reserved_size  = 0;
+}
+
+/*
+ * Memory comes out zeroed, as blocks are zeroed by the parent allocator and never handed out twice.
+ */
+void *
+ObscuraArenaAllocate(ObscuraArena *arena, size_t size, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	if (alignment < ARENA_MIN_ALIGNMENT) {
+		alignment = ARENA_MIN_ALIGNMENT;
+	}
+
+	uint8_t *ptr = NULL;
+	if (arena->cursor != NULL) {
+		ptr = align(arena->cursor + ARENA_HEADER_SIZE, alignment);
+	}
+
+	if (ptr == NULL || ptr + size > arena->limit) {
+		size_t needed = sizeof(struct __arena_block) + ARENA_HEADER_SIZE + alignment + size;
+
+		/*
+		 * Large allocations get a block of their own, leaving the current one to fill up.
+		 */
+		if (needed > arena->block_size / 2) {
+			struct __arena_block *block = reserve(arena, needed);
+			if (arena->blocks != NULL) {
+				block->next = arena->blocks->next;
+				arena->blocks->next = block;
+			} else {
+				arena->blocks = block;
+			}
+
+			ptr = align((uint8_t *) (block + 1) + ARENA_HEADER_SIZE, alignment);
+			ARENA_SIZE(ptr) = size;
+			arena->allocated_size += size;
+
+			return ptr;
+		}
+
+		struct __arena_block *block = reserve(arena, arena->block_size);
+		block->next = arena->blocks;
+		arena->blocks = block;
+
+		arena->cursor = (uint8_t *) (block + 1);
+		arena->limit  = (uint8_t *) block + block->size;
+
+		ptr = align(arena->cursor + ARENA_HEADER_SIZE, alignment);
+	}
+
+	ARENA_SIZE(ptr) = size;
+	arena->cursor = ptr + size;
+	arena->last = ptr;
+	arena->allocated_size += size;
+
+	return ptr;
+}
+
+void *
+ObscuraArenaReallocate(ObscuraArena *arena, void *original, size_t size, size_t alignment)
+{
+	if (original == NULL) {
+		return ObscuraArenaAllocate(arena, size, alignment);
+	}
+
+	size_t original_size = ARENA_SIZE(original);
+	if (size <= original_size) {
+		return original;
+	}
+
+	/*
+	 * The most recent allocation grows in place when its block has room; the memory past the cursor has
+	 * never been handed out and is still zeroed.
+	 */
+	bool aligned = ((uintptr_t) original & (alignment - 1)) == 0;
+	if (original == arena->last && aligned && (uint8_t *) original + size <= arena->limit) {
+		ARENA_SIZE(original) = size;
+		arena->cursor = (uint8_t *) original + size;
+		arena->allocated_size += size - original_size;
+
+		return original;
+	}
+
+	void *ptr = ObscuraArenaAllocate(arena, size, alignment);
+	memcpy(ptr, original, original_size);
+
+	return ptr;
+}
@@ -0,0 +1,53 @@
+#ifndef __OBSCURA_ARENA_H__
+#define __OBSCURA_ARENA_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OBSCURA_ARENA_BLOCK_SIZE	(64 << 10)
+
+struct __arena_block {
+	struct __arena_block	*next;
+	size_t			 size;
+};
+
+/*
+ * Region allocator: memory is carved out of large blocks obtained from a parent allocator by bumping a
+ * cursor, and is only given back all at once, by resetting or destroying the arena. Freeing through the
+ * arena does nothing; reallocating grows the most recent allocation in place and copies any other.
+ * Allocations too large for a block get a block of their own. An arena is not thread safe.
+ */
+typedef struct ObscuraArena {
+	ObscuraAllocationCallbacks	 callbacks;
+	ObscuraAllocationCallbacks	*allocator;
+
+	size_t			 block_size;
+	struct __arena_block	*blocks;
+	uint8_t			*cursor;
+	uint8_t			*limit;
+	void			*last;
+
+	size_t	allocated_size;
+	size_t	reserved_size;
+} ObscuraArena;
+
+extern ObscuraArena *	ObscuraCreateArena	(size_t, ObscuraAllocationCallbacks *);
+extern void		ObscuraDestroyArena	(ObscuraArena **, ObscuraAllocationCallbacks *);
+
+extern ObscuraAllocationCallbacks *	ObscuraBindArena	(ObscuraArena *);
+extern void				ObscuraResetArena	(ObscuraArena *);
+
+extern void *	ObscuraArenaAllocate	(ObscuraArena *, size_t, size_t);
+extern void *	ObscuraArenaReallocate	(ObscuraArena *, void *, size_t, size_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,1001 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "bvh.h"
+#include "stat.h"
+
+#define HIERARCHY_BINS_COUNT		16
+#define HIERARCHY_LEAF_CAPACITY		8
+#define HIERARCHY_TRAVERSAL_COST	1.0f
+#define HIERARCHY_INTERSECTION_COST	1.0f
+
+#define LINEAR_RADIX_BITS		8
+#define LINEAR_RADIX_BUCKETS		(1 << LINEAR_RADIX_BITS)
+#define LINEAR_TASK_THRESHOLD		4096
+
+/*
+ * Every level of a linear hierarchy resolves at least one more bit of the 30-bit Morton code or of the
+ * 32-bit index used to break ties between equal codes.
+ */
+#define LINEAR_DEPTH_CAPACITY		64
+
+struct __hierarchy_bin {
+	vec4		lower;
+	vec4		upper;
+	uint32_t	count;
+};
+
+struct __hierarchy_entry {
+	uint32_t	index;
+	float		distance;
+};
+
+struct __packet_entry {
+	uint32_t	index;
+	uint32_t	mask;
+	float		distance;
+};
+
+/*
+ * Reciprocal directions of the lanes of a packet, computed once per traversal.
+ */
+struct __packet_ray {
+	ObscuraRayPacket	*packet;
+
+	float	x[OBSCURA_RAY_PACKET_WIDTH];
+	float	y[OBSCURA_RAY_PACKET_WIDTH];
+	float	z[OBSCURA_RAY_PACKET_WIDTH];
+};
+
+struct __linear_build {
+	ObscuraBoundingVolumeHierarchy	*bvh;
+	ObscuraPrimitive		*primitives;
+	uint32_t			 count;
+
+	vec4	origin;
+	vec4	scale;
+
+	uint32_t	 shift;
+	uint32_t	*keys_in;
+	uint32_t	*values_in;
+	uint32_t	*keys_out;
+	uint32_t	*values_out;
+};
+
+struct __linear_task {
+	struct __linear_build	*build;
+	uint32_t		 begin;
+	uint32_t		 end;
+
+	vec4	lower;
+	vec4	upper;
+
+	uint32_t	histogram[LINEAR_RADIX_BUCKETS];
+} __attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+static inline float
+area(vec4 lower, vec4 upper)
+{
+	vec4 e = _mm_max_ps(upper - lower, VEC4_ZERO);
+
+	return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+}
+
+static inline vec4
+centroid(ObscuraPrimitive *primitive)
+{
+	return (primitive->lower + primitive->upper) * 0.5f;
+}
+
+static inline float
+farthest(ObscuraRayPacket *packet)
+{
+	float tmax = 0;
+	for (uint32_t mask = packet->active; mask != 0; mask &= mask - 1) {
+		tmax = fmaxf(tmax, packet->tmax[__builtin_ctz(mask)]);
+	}
+
+	return tmax;
+}
+
+/*
+ * Tests a box against the lanes of mask; returns the lanes whose interval overlaps it and the smallest
+ * entry distance among them.
+ */
+static inline uint32_t
+packetslab4(vec4 lower, vec4 upper, struct __packet_ray *pr, uint32_t mask, float *distance)
+{
+	ObscuraRayPacket *packet = pr->packet;
+
+	vec4 nearest = _mm_set1_ps(INFINITY);
+	uint32_t hits = 0;
+
+	for (uint32_t lane = 0; lane < packet->width; lane += 4) {
+		if (((mask >> lane) & 0xf) == 0) {
+			continue;
+		}
+
+		vec4 ix = _mm_loadu_ps(&pr->x[lane]);
+		vec4 iy = _mm_loadu_ps(&pr->y[lane]);
+		vec4 iz = _mm_loadu_ps(&pr->z[lane]);
+
+		vec4 x0 = (lower[0] - packet->position[0]) * ix;
+		vec4 x1 = (upper[0] - packet->position[0]) * ix;
+		vec4 y0 = (lower[1] - packet->position[1]) * iy;
+		vec4 y1 = (upper[1] - packet->position[1]) * iy;
+		vec4 z0 = (lower[2] - packet->position[2]) * iz;
+		vec4 z1 = (upper[2] - packet->position[2]) * iz;
+
+		vec4 tnear = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)),
+			_mm_max_ps(_mm_min_ps(z0, z1), _mm_loadu_ps(&packet->tmin[lane])));
+		vec4 tfar  = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)),
+			_mm_min_ps(_mm_max_ps(z0, z1), _mm_loadu_ps(&packet->tmax[lane])));
+
+		vec4 hit = _mm_cmple_ps(tnear, tfar);
+		nearest = _mm_min_ps(nearest, _mm_blendv_ps(_mm_set1_ps(INFINITY), tnear, hit));
+		hits |= _mm_movemask_ps(hit) << lane;
+	}
+
+	nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(2, 3, 0, 1)));
+	nearest = _mm_min_ps(nearest, _mm_shuffle_ps(nearest, nearest, _MM_SHUFFLE(1, 0, 3, 2)));
+	*distance = _mm_cvtss_f32(nearest);
+
+	return hits & mask;
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t
+packetslab8(vec4 lower, vec4 upper, struct __packet_ray *pr, uint32_t mask, float *distance)
+{
+	ObscuraRayPacket *packet = pr->packet;
+
+	__m256 ix = _mm256_loadu_ps(pr->x);
+	__m256 iy = _mm256_loadu_ps(pr->y);
+	__m256 iz = _mm256_loadu_ps(pr->z);
+
+	__m256 x0 = _mm256_mul_ps(_mm256_set1_ps(lower[0] - packet->position[0]), ix);
+	__m256 x1 = _mm256_mul_ps(_mm256_set1_ps(upper[0] - packet->position[0]), ix);
+	__m256 y0 = _mm256_mul_ps(_mm256_set1_ps(lower[1] - packet->position[1]), iy);
+	__m256 y1 = _mm256_mul_ps(_mm256_set1_ps(upper[1] - packet->position[1]), iy);
+	__m256 z0 = _mm256_mul_ps(_mm256_set1_ps(lower[2] - packet->position[2]), iz);
+	__m256 z1 = _mm256_mul_ps(_mm256_set1_ps(upper[2] - packet->position[2]), iz);
+
+	__m256 tnear = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)),
+		_mm256_max_ps(_mm256_min_ps(z0, z1), _mm256_loadu_ps(packet->tmin)));
+	__m256 tfar  = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)),
+		_mm256_min_ps(_mm256_max_ps(z0, z1), _mm256_loadu_ps(packet->tmax)));
+
+	__m256 hit = _mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ);
+	uint32_t hits = _mm256_movemask_ps(hit) & mask;
+	if (hits == 0) {
+		*distance = INFINITY;
+		return 0;
+	}
+
+	float distances[8];
+	_mm256_storeu_ps(distances, tnear);
+
+	float nearest = INFINITY;
+	for (uint32_t lanes = hits; lanes != 0; lanes &= lanes - 1) {
+		nearest = fminf(nearest, distances[__builtin_ctz(lanes)]);
+	}
+	*distance = nearest;
+
+	return hits;
+}
+
+static uint32_t
+partition(ObscuraPrimitive *primitives, uint32_t first, uint32_t count, int axis, float min, float scale, uint32_t split)
+{
+	uint32_t i = first;
+	uint32_t j = first + count;
+	while (i < j) {
+		uint32_t bin = (uint32_t) ((centroid(&primitives[i])[axis] - min) * scale);
+		if (bin > HIERARCHY_BINS_COUNT - 1) {
+			bin = HIERARCHY_BINS_COUNT - 1;
+		}
+
+		if (bin < split) {
+			i++;
+		} else {
+			j--;
+
+			ObscuraPrimitive tmp = primitives[i];
+			primitives[i] = primitives[j];
+			primitives[j] = tmp;
+		}
+	}
+
+	return i - first;
+}
+
+static uint32_t
+subdivide(ObscuraBoundingVolumeHierarchy *bvh, ObscuraPrimitive *primitives, uint32_t first, uint32_t count, uint32_t depth)
+{
+	uint32_t index = bvh->nodes_count++;
+	assert(index < bvh->nodes_capacity);
+
+	if (depth > bvh->depth) {
+		bvh->depth = depth;
+	}
+
+	vec4 lower  = _mm_set1_ps(FLT_MAX);
+	vec4 upper  = _mm_set1_ps(-FLT_MAX);
+	vec4 cmin   = _mm_set1_ps(FLT_MAX);
+	vec4 cmax   = _mm_set1_ps(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; i++) {
+		lower = _mm_min_ps(lower, primitives[i].lower);
+		upper = _mm_max_ps(upper, primitives[i].upper);
+
+		vec4 c = centroid(&primitives[i]);
+		cmin = _mm_min_ps(cmin, c);
+		cmax = _mm_max_ps(cmax, c);
+	}
+
+	struct __hierarchy_node *node = &bvh->nodes[index];
+	node->lower  = lower;
+	node->upper  = upper;
+	node->offset = first;
+	node->count  = count;
+
+	if (count <= 1) {
+		return index;
+	}
+
+	float best_cost = INFINITY;
+	int best_axis = -1;
+	uint32_t best_split = 0;
+
+	vec4 extent = cmax - cmin;
+	for (int axis = 0; axis < 3; axis++) {
+		if (extent[axis] <= 0) {
+			continue;
+		}
+
+		struct __hierarchy_bin bins[HIERARCHY_BINS_COUNT];
+		for (uint32_t b = 0; b < HIERARCHY_BINS_COUNT; b++) {
+			bins[b].lower = _mm_set1_ps(FLT_MAX);
+			bins[b].upper = _mm_set1_ps(-FLT_MAX);
+			bins[b].count = 0;
+		}
+
+		float scale = HIERARCHY_BINS_COUNT / extent[axis];
+		for (uint32_t i = first; i < first + count; i++) {
+			uint32_t b = (uint32_t) ((centroid(&primitives[i])[axis] - cmin[axis]) * scale);
+			if (b > HIERARCHY_BINS_COUNT - 1) {
+				b = HIERARCHY_BINS_COUNT - 1;
+			}
+
+			bins[b].lower = _mm_min_ps(bins[b].lower, primitives[i].lower);
+			bins[b].upper = _mm_max_ps(bins[b].upper, primitives[i].upper);
+			bins[b].count++;
+		}
+
+		/*
+		 * Sweep from the right accumulating the cost of every candidate right side, then from the left
+		 * evaluating the full split cost at each bin boundary.
+		 */
+		float right_areas[HIERARCHY_BINS_COUNT];
+		uint32_t right_counts[HIERARCHY_BINS_COUNT];
+
+		vec4 rl = _mm_set1_ps(FLT_MAX);
+		vec4 ru = _mm_set1_ps(-FLT_MAX);
+		uint32_t rc = 0;
+		for (uint32_t b = HIERARCHY_BINS_COUNT - 1; b > 0; b--) {
+			rl = _mm_min_ps(rl, bins[b].lower);
+			ru = _mm_max_ps(ru, bins[b].upper);
+			rc += bins[b].count;
+
+			right_areas[b]  = rc ? area(rl, ru) : 0;
+			right_counts[b] = rc;
+		}
+
+		vec4 ll = _mm_set1_ps(FLT_MAX);
+		vec4 lu = _mm_set1_ps(-FLT_MAX);
+		uint32_t lc = 0;
+		for (uint32_t b = 1; b < HIERARCHY_BINS_COUNT; b++) {
+			ll = _mm_min_ps(ll, bins[b - 1].lower);
+			lu = _mm_max_ps(lu, bins[b - 1].upper);
+			lc += bins[b - 1].count;
+
+			if (lc == 0 || right_counts[b] == 0) {
+				continue;
+			}
+
+			float cost = area(ll, lu) * lc + right_areas[b] * right_counts[b];
+			if (cost < best_cost) {
+				best_cost  = cost;
+				best_axis  = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	float parent_area = area(lower, upper);
+	float leaf_cost = HIERARCHY_INTERSECTION_COST * count;
+	float split_cost = HIERARCHY_TRAVERSAL_COST;
+	if (parent_area > 0) {
+		split_cost += HIERARCHY_INTERSECTION_COST * best_cost / parent_area;
+	}
+
+	if (count <= HIERARCHY_LEAF_CAPACITY && (best_axis < 0 || split_cost >= leaf_cost)) {
+		return index;
+	}
+
+	uint32_t left_count = 0;
+	if (best_axis >= 0) {
+		float scale = HIERARCHY_BINS_COUNT / extent[best_axis];
+		left_count = partition(primitives, first, count, best_axis, cmin[best_axis], scale, best_split);
+	}
+
+	/*
+	 * Coincident centroids cannot be separated by any plane, fall back to an object median so that the
+	 * leaves still honour their capacity.
+	 */
+	if (left_count == 0 || left_count == count) {
+		left_count = count / 2;
+	}
+
+	node->count = 0;
+
+	uint32_t left = subdivide(bvh, primitives, first, left_count, depth + 1);
+	uint32_t right = subdivide(bvh, primitives, first + left_count, count - left_count, depth + 1);
+
+	node = &bvh->nodes[index];
+	node->offset = left;
+	node->right  = right;
+
+	return index;
+}
+
+static inline uint32_t
+expand(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xff0000ffu;
+	v = (v * 0x00000101u) & 0x0f00f00fu;
+	v = (v * 0x00000011u) & 0xc30c30c3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+
+	return v;
+}
+
+static inline int
+delta(uint32_t *codes, uint32_t count, int64_t i, int64_t j)
+{
+	if (j < 0 || j >= count) {
+		return -1;
+	}
+
+	uint32_t a = codes[i];
+	uint32_t b = codes[j];
+	if (a == b) {
+		return 32 + __builtin_clz((uint32_t) i ^ (uint32_t) j);
+	}
+
+	return __builtin_clz(a ^ b);
+}
+
+static void
+dispatch(ObscuraExecutionCallbacks *executor, PFN_ObscuraTaskFunction func, struct __linear_task *tasks, uint32_t count)
+{
+	if (executor == NULL || count == 1) {
+		for (uint32_t i = 0; i < count; i++) {
+			func(&tasks[i]);
+		}
+	} else {
+		for (uint32_t i = 0; i < count; i++) {
+			executor->submit(func, &tasks[i]);
+		}
+		executor->wait();
+	}
+}
+
+static void *
+centroids(void *arg)
+{
+	struct __linear_task *task = arg;
+	ObscuraPrimitive *primitives = task->build->primitives;
+
+	vec4 lower = _mm_set1_ps(FLT_MAX);
+	vec4 upper = _mm_set1_ps(-FLT_MAX);
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		vec4 c = centroid(&primitives[i]);
+		lower = _mm_min_ps(lower, c);
+		upper = _mm_max_ps(upper, c);
+	}
+	task->lower = lower;
+	task->upper = upper;
+
+	return NULL;
+}
+
+static void *
+encode(void *arg)
+{
+	struct __linear_task *task = arg;
+	struct __linear_build *build = task->build;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		vec4 c = (centroid(&build->primitives[i]) - build->origin) * build->scale;
+		c = vec4_clamp(c, VEC4_ZERO, _mm_set1_ps(1023));
+
+		build->keys_in[i] = (expand((uint32_t) c[0]) << 2) | (expand((uint32_t) c[1]) << 1) | expand((uint32_t) c[2]);
+		build->values_in[i] = i;
+	}
+
+	return NULL;
+}
+
+static void *
+histogram(void *arg)
+{
+	struct __linear_task *task = arg;
+	struct __linear_build *build = task->build;
+
+	for (uint32_t b = 0; b < LINEAR_RADIX_BUCKETS; b++) {
+		task->histogram[b] = 0;
+	}
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		task->histogram[(build->keys_in[i] >> build->shift) & (LINEAR_RADIX_BUCKETS - 1)]++;
+	}
+
+	return NULL;
+}
+
+static void *
+scatter(void *arg)
+{
+	struct __linear_task *task = arg;
+	struct __linear_build *build = task->build;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		uint32_t key = build->keys_in[i];
+		uint32_t j = task->histogram[(key >> build->shift) & (LINEAR_RADIX_BUCKETS - 1)]++;
+
+		build->keys_out[j] = key;
+		build->values_out[j] = build->values_in[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Emits the interior nodes following Karras, "Maximizing Parallelism in the Construction of BVHs, Octrees,
+ * and k-d Trees": every interior node finds its key range and split independently of the others. Interior
+ * nodes occupy the first count - 1 slots, leaves the remaining count.
+ */
+static void *
+emit(void *arg)
+{
+	struct __linear_task *task = arg;
+	struct __linear_build *build = task->build;
+	ObscuraBoundingVolumeHierarchy *bvh = build->bvh;
+
+	uint32_t *codes = bvh->codes;
+	uint32_t count = build->count;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		bvh->visits[i] = 0;
+
+		int d = (delta(codes, count, i, (int64_t) i + 1) - delta(codes, count, i, (int64_t) i - 1)) >= 0 ? 1 : -1;
+		int dmin = delta(codes, count, i, (int64_t) i - d);
+
+		int64_t lmax = 2;
+		while (delta(codes, count, i, i + lmax * d) > dmin) {
+			lmax *= 2;
+		}
+
+		int64_t l = 0;
+		for (int64_t t = lmax / 2; t >= 1; t /= 2) {
+			if (delta(codes, count, i, i + (l + t) * d) > dmin) {
+				l += t;
+			}
+		}
+
+		int64_t j = i + l * d;
+		int dnode = delta(codes, count, i, j);
+
+		int64_t s = 0;
+		int64_t t = 0;
+		int64_t divisor = 2;
+		do {
+			t = (l + divisor - 1) / divisor;
+			if (delta(codes, count, i, i + (s + t) * d) > dnode) {
+				s += t;
+			}
+			divisor *= 2;
+		} while (t > 1);
+
+		int64_t split = i + s * d + (d < 0 ? -1 : 0);
+
+		uint32_t left  = ((i < j ? i : j) == split) ? count - 1 + split : split;
+		uint32_t right = ((i > j ? i : j) == split + 1) ? count + split : split + 1;
+
+		struct __hierarchy_node *node = &bvh->nodes[i];
+		node->offset = left;
+		node->right  = right;
+		node->count  = 0;
+
+		bvh->parents[left]  = i;
+		bvh->parents[right] = i;
+	}
+
+	return NULL;
+}
+
+/*
+ * Walks from every leaf towards the root; the second thread to reach an interior node is the one that
+ * sees both children finished, so it merges their boxes and carries on upwards.
+ */
+static void *
+refit(void *arg)
+{
+	struct __linear_task *task = arg;
+	struct __linear_build *build = task->build;
+	ObscuraBoundingVolumeHierarchy *bvh = build->bvh;
+
+	uint32_t count = build->count;
+
+	for (uint32_t i = task->begin; i < task->end; i++) {
+		uint32_t index = count - 1 + i;
+
+		struct __hierarchy_node *leaf = &bvh->nodes[index];
+		ObscuraPrimitive *primitive = &build->primitives[bvh->indices[i]];
+		leaf->lower  = primitive->lower;
+		leaf->upper  = primitive->upper;
+		leaf->offset = bvh->indices[i];
+		leaf->count  = 1;
+
+		while (index != 0) {
+			index = bvh->parents[index];
+			if (__atomic_fetch_add(&bvh->visits[index], 1, __ATOMIC_ACQ_REL) == 0) {
+				break;
+			}
+
+			struct __hierarchy_node *node = &bvh->nodes[index];
+			node->lower = _mm_min_ps(bvh->nodes[node->offset].lower, bvh->nodes[node->right].lower);
+			node->upper = _mm_max_ps(bvh->nodes[node->offset].upper, bvh->nodes[node->right].upper);
+		}
+	}
+
+	return NULL;
+}
+
+ObscuraBoundingVolumeHierarchy *
+ObscuraCreateBoundingVolumeHierarchy(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraBoundingVolumeHierarchy *bvh = allocator->allocation(sizeof(ObscuraBoundingVolumeHierarchy), 8);
+	bvh->avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+	return bvh;
+}
+
+void
+ObscuraDestroyBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	allocator->free((*ptr)->nodes);
+	allocator->free((*ptr)->codes);
+	allocator->free((*ptr)->indices);
+	allocator->free((*ptr)->parents);
+	allocator->free((void *) (*ptr)->visits);
+	allocator->free(*ptr);
+
+	*ptr = NULL;
+}
+
+void
+ObscuraBuildBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy *bvh, ObscuraPrimitive *primitives, uint32_t count,
+	ObscuraAllocationCallbacks *allocator)
+{
+	uint32_t capacity = (count > 0) ? 2 * count - 1 : 1;
+	if (bvh->nodes_capacity < capacity) {
+		allocator->free(bvh->nodes);
+
+		bvh->nodes_capacity = capacity;
+		bvh->nodes = allocator->allocation(sizeof(struct __hierarchy_node) * bvh->nodes_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	bvh->nodes_count = 0;
+	bvh->depth = 0;
+	if (count > 0) {
+		subdivide(bvh, primitives, 0, count, 0);
+	}
+}
+
+void
+ObscuraBuildLinearBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy *bvh, ObscuraPrimitive *primitives, uint32_t count,
+	ObscuraExecutionCallbacks *executor, ObscuraAllocationCallbacks *allocator)
+{
+	uint32_t capacity = (count > 0) ? 2 * count - 1 : 1;
+	if (bvh->nodes_capacity < capacity) {
+		allocator->free(bvh->nodes);
+
+		bvh->nodes_capacity = capacity;
+		bvh->nodes = allocator->allocation(sizeof(struct __hierarchy_node) * bvh->nodes_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	if (bvh->scratch_capacity < count) {
+		allocator->free(bvh->codes);
+		allocator->free(bvh->indices);
+		allocator->free(bvh->parents);
+		allocator->free((void *) bvh->visits);
+
+		bvh->scratch_capacity = count;
+		bvh->codes   = allocator->allocation(sizeof(uint32_t) * 2 * bvh->scratch_capacity, LEVEL1_DCACHE_LINESIZE);
+		bvh->indices = allocator->allocation(sizeof(uint32_t) * 2 * bvh->scratch_capacity, LEVEL1_DCACHE_LINESIZE);
+		bvh->parents = allocator->allocation(sizeof(uint32_t) * 2 * bvh->scratch_capacity, LEVEL1_DCACHE_LINESIZE);
+		bvh->visits  = allocator->allocation(sizeof(uint32_t) * bvh->scratch_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	bvh->nodes_count = (count > 0) ? 2 * count - 1 : 0;
+	bvh->depth = LINEAR_DEPTH_CAPACITY;
+	if (count == 0) {
+		return;
+	}
+
+	uint32_t tasks_count = (executor != NULL && count >= LINEAR_TASK_THRESHOLD) ? executor->nprocs() : 1;
+	struct __linear_task tasks[tasks_count];
+
+	struct __linear_build build = {
+		.bvh        = bvh,
+		.primitives = primitives,
+		.count      = count,
+	};
+
+	for (uint32_t i = 0; i < tasks_count; i++) {
+		tasks[i].build = &build;
+		tasks[i].begin = (uint64_t) count * i / tasks_count;
+		tasks[i].end   = (uint64_t) count * (i + 1) / tasks_count;
+	}
+
+	dispatch(executor, &centroids, tasks, tasks_count);
+
+	vec4 lower = tasks[0].lower;
+	vec4 upper = tasks[0].upper;
+	for (uint32_t i = 1; i < tasks_count; i++) {
+		lower = _mm_min_ps(lower, tasks[i].lower);
+		upper = _mm_max_ps(upper, tasks[i].upper);
+	}
+
+	vec4 extent = _mm_max_ps(upper - lower, _mm_set1_ps(FLT_MIN));
+	build.origin = lower;
+	build.scale  = _mm_set1_ps(1024) / extent;
+
+	build.keys_in    = bvh->codes;
+	build.values_in  = bvh->indices;
+	build.keys_out   = bvh->codes + count;
+	build.values_out = bvh->indices + count;
+	dispatch(executor, &encode, tasks, tasks_count);
+
+	/*
+	 * Least significant digit first radix sort; an even number of passes leaves the sorted codes back in
+	 * the first half of the buffers.
+	 */
+	for (build.shift = 0; build.shift < 32; build.shift += LINEAR_RADIX_BITS) {
+		dispatch(executor, &histogram, tasks, tasks_count);
+
+		uint32_t offset = 0;
+		for (uint32_t b = 0; b < LINEAR_RADIX_BUCKETS; b++) {
+			for (uint32_t i = 0; i < tasks_count; i++) {
+				uint32_t n = tasks[i].histogram[b];
+				tasks[i].histogram[b] = offset;
+				offset += n;
+			}
+		}
+
+		dispatch(executor, &scatter, tasks, tasks_count);
+
+		uint32_t *keys = build.keys_in;
+		build.keys_in  = build.keys_out;
+		build.keys_out = keys;
+
+		uint32_t *values = build.values_in;
+		build.values_in  = build.values_out;
+		build.values_out = values;
+	}
+
+	for (uint32_t i = 0; i < tasks_count; i++) {
+		tasks[i].begin = (uint64_t) (count - 1) * i / tasks_count;
+		tasks[i].end   = (uint64_t) (count - 1) * (i + 1) / tasks_count;
+	}
+	dispatch(executor, &emit, tasks, tasks_count);
+
+	for (uint32_t i = 0; i < tasks_count; i++) {
+		tasks[i].begin = (uint64_t) count * i / tasks_count;
+		tasks[i].end   = (uint64_t) count * (i + 1) / tasks_count;
+	}
+	dispatch(executor, &refit, tasks, tasks_count);
+}
+
+/*
+ * Closest hit search below root. The nearer child is always pushed last so that it is popped first, and
+ * an entry is discarded as soon as its box starts beyond the end of the ray interval, which shrinks with
+ * every hit. At most one sibling per level is pending, so the depth of the tree bounds the stack.
+ */
+static uint32_t
+descend(ObscuraBoundingVolumeHierarchy *bvh, ObscuraSphereSet *spheres, vec4 position, ObscuraBoundingVolume *ray,
+	uint32_t root, uint64_t *tests)
+{
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+	vec4 inverse = VEC4_ONE / r->direction;
+
+	uint32_t nearest = OBSCURA_SPHERE_SET_MISS;
+
+	struct __hierarchy_entry stack[bvh->depth + 1];
+	uint32_t depth = 0;
+
+	stack[depth].index    = root;
+	stack[depth].distance = ObscuraSlabTest(bvh->nodes[root].lower, bvh->nodes[root].upper, position, inverse, r->tmin,
+		r->tmax);
+	depth++;
+
+	while (depth > 0) {
+		depth--;
+		if (stack[depth].distance >= r->tmax) {
+			continue;
+		}
+
+		struct __hierarchy_node *node = &bvh->nodes[stack[depth].index];
+		if (node->count > 0) {
+			*tests += node->count;
+
+			uint32_t i = ObscuraCollidesWithSphereSet(ray, position, spheres, node->offset, node->count);
+			if (i != OBSCURA_SPHERE_SET_MISS) {
+				nearest = i;
+			}
+		} else {
+			struct __hierarchy_node *left  = &bvh->nodes[node->offset];
+			struct __hierarchy_node *right = &bvh->nodes[node->right];
+
+			float tl = ObscuraSlabTest(left->lower, left->upper, position, inverse, r->tmin, r->tmax);
+			float tr = ObscuraSlabTest(right->lower, right->upper, position, inverse, r->tmin, r->tmax);
+
+			if (tl <= tr) {
+				if (tr < r->tmax) {
+					stack[depth].index    = node->right;
+					stack[depth].distance = tr;
+					depth++;
+				}
+				if (tl < r->tmax) {
+					stack[depth].index    = node->offset;
+					stack[depth].distance = tl;
+					depth++;
+				}
+			} else {
+				if (tl < r->tmax) {
+					stack[depth].index    = node->offset;
+					stack[depth].distance = tl;
+					depth++;
+				}
+				if (tr < r->tmax) {
+					stack[depth].index    = node->right;
+					stack[depth].distance = tr;
+					depth++;
+				}
+			}
+		}
+	}
+
+	return nearest;
+}
+
+void
+ObscuraTraverseBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy *bvh, ObscuraPrimitive *primitives,
+	ObscuraSphereSet *spheres, vec4 position, ObscuraBoundingVolume *ray, ObscuraVisible *visible)
+{
+	if (bvh->nodes_count == 0) {
+		return;
+	}
+
+	uint64_t tests = 0;
+
+	uint32_t i = descend(bvh, spheres, position, ray, 0, &tests);
+	if (i != OBSCURA_SPHERE_SET_MISS) {
+		ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+		visible->geometry = primitives[i].geometry;
+		ObscuraResolveCollision(ray, position, primitives[i].position, r->tmax, &visible->collision);
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+}
+
+/*
+ * Packet traversal: children are tested against every lane still interested in their parent and visited
+ * nearest first for the packet as a whole. Lanes that disagree on the sign of a direction component share
+ * no traversal order, so such packets, and subtrees only one lane reaches, are traced ray by ray.
+ */
+void
+ObscuraTraversePacketBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy *bvh, ObscuraSphereSet *spheres,
+	ObscuraRayPacket *packet, uint32_t *indices)
+{
+	if (bvh->nodes_count == 0 || packet->active == 0) {
+		return;
+	}
+
+	struct __packet_ray pr = {
+		.packet = packet,
+	};
+
+	uint32_t positive[3] = {};
+	for (uint32_t lane = 0; lane < packet->width; lane++) {
+		pr.x[lane] = 1 / packet->x[lane];
+		pr.y[lane] = 1 / packet->y[lane];
+		pr.z[lane] = 1 / packet->z[lane];
+
+		positive[0] |= (packet->x[lane] >= 0) << lane;
+		positive[1] |= (packet->y[lane] >= 0) << lane;
+		positive[2] |= (packet->z[lane] >= 0) << lane;
+	}
+
+	bool coherent = true;
+	for (int axis = 0; axis < 3; axis++) {
+		uint32_t lanes = positive[axis] & packet->active;
+		coherent &= lanes == 0 || lanes == packet->active;
+	}
+
+	/*
+	 * Entries starting beyond the interval of every lane are skipped without touching their node.
+	 */
+	float limit = farthest(packet);
+
+	uint64_t tests = 0;
+	uint64_t visits = 0;
+	uint64_t lanes = 0;
+	uint64_t fallbacks = 0;
+
+	struct __packet_entry stack[bvh->depth + 1];
+	uint32_t depth = 0;
+
+	if (coherent) {
+		stack[depth].index = 0;
+		stack[depth].mask  = packetslab4(bvh->nodes[0].lower, bvh->nodes[0].upper, &pr, packet->active,
+			&stack[depth].distance);
+		depth += stack[depth].mask != 0;
+	} else {
+		stack[depth].index    = 0;
+		stack[depth].mask     = packet->active;
+		stack[depth].distance = 0;
+		depth++;
+	}
+
+	while (depth > 0) {
+		depth--;
+
+		if (stack[depth].distance >= limit) {
+			continue;
+		}
+
+		uint32_t index = stack[depth].index;
+		uint32_t mask  = stack[depth].mask;
+
+		if (!coherent || __builtin_popcount(mask) == 1) {
+			for (; mask != 0; mask &= mask - 1) {
+				uint32_t lane = __builtin_ctz(mask);
+
+				ObscuraBoundingVolume ray = {
+					.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+				};
+				ObscuraBoundingVolumeRay *bounds = &ray.volume.ray;
+				ObscuraLoadRay(packet, lane, bounds);
+
+				uint32_t i = descend(bvh, spheres, packet->position, &ray, index, &tests);
+				if (i != OBSCURA_SPHERE_SET_MISS) {
+					indices[lane] = i;
+					packet->tmax[lane] = bounds->tmax;
+				}
+				fallbacks++;
+			}
+			continue;
+		}
+
+		struct __hierarchy_node *node = &bvh->nodes[index];
+		visits++;
+		lanes += __builtin_popcount(mask);
+
+		if (node->count > 0) {
+			tests += node->count * __builtin_popcount(mask);
+
+			if (ObscuraCollidesWithSphereSetPacket(packet, mask, spheres, node->offset, node->count, indices) != 0) {
+				limit = farthest(packet);
+			}
+		} else {
+			float tl;
+			float tr;
+			uint32_t ml;
+			uint32_t mr;
+			if (bvh->avx2 && packet->width == 8) {
+				ml = packetslab8(bvh->nodes[node->offset].lower, bvh->nodes[node->offset].upper, &pr, mask, &tl);
+				mr = packetslab8(bvh->nodes[node->right].lower, bvh->nodes[node->right].upper, &pr, mask, &tr);
+			} else {
+				ml = packetslab4(bvh->nodes[node->offset].lower, bvh->nodes[node->offset].upper, &pr, mask, &tl);
+				mr = packetslab4(bvh->nodes[node->right].lower, bvh->nodes[node->right].upper, &pr, mask, &tr);
+			}
+
+			if (tl <= tr) {
+				if (mr != 0) {
+					stack[depth].index    = node->right;
+					stack[depth].mask     = mr;
+					stack[depth].distance = tr;
+					depth++;
+				}
+				if (ml != 0) {
+					stack[depth].index    = node->offset;
+					stack[depth].mask     = ml;
+					stack[depth].distance = tl;
+					depth++;
+				}
+			} else {
+				if (ml != 0) {
+					stack[depth].index    = node->offset;
+					stack[depth].mask     = ml;
+					stack[depth].distance = tl;
+					depth++;
+				}
+				if (mr != 0) {
+					stack[depth].index    = node->right;
+					stack[depth].mask     = mr;
+					stack[depth].distance = tr;
+					depth++;
+				}
+			}
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET], 1);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_NODE], visits);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_LANE], lanes);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_FALLBACK], fallbacks);
+}
+
+bool
+ObscuraOccludedBoundingVolumeHierarchy(ObscuraBoundingVolumeHierarchy *bvh, ObscuraSphereSet *spheres, vec4 position,
+	ObscuraBoundingVolume *ray)
+{
+	if (bvh->nodes_count == 0) {
+		return false;
+	}
+
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+	vec4 inverse = VEC4_ONE / r->direction;
+
+	bool occluded = false;
+	uint64_t tests = 0;
+
+	/*
+	 * Any hit inside the interval will do, so children are visited in no particular order.
+	 */
+	uint32_t stack[bvh->depth + 1];
+	uint32_t depth = 0;
+
+	if (ObscuraSlabTest(bvh->nodes[0].lower, bvh->nodes[0].upper, position, inverse, r->tmin, r->tmax) < r->tmax) {
+		stack[depth++] = 0;
+	}
+
+	while (depth > 0 && !occluded) {
+		struct __hierarchy_node *node = &bvh->nodes[stack[--depth]];
+		if (node->count > 0) {
+			tests += node->count;
+
+			occluded = ObscuraCollidesWithSphereSet(ray, position, spheres, node->offset, node->count) !=
+				OBSCURA_SPHERE_SET_MISS;
+		} else {
+			struct __hierarchy_node *left  = &bvh->nodes[node->offset];
+			struct __hierarchy_node *right = &bvh->nodes[node->right];
+
+			if (ObscuraSlabTest(right->lower, right->upper, position, inverse, r->tmin, r->tmax) < r->tmax) {
+				stack[depth++] = node->right;
+			}
+			if (ObscuraSlabTest(left->lower, left->upper, position, inverse, r->tmin, r->tmax) < r->tmax) {
+				stack[depth++] = node->offset;
+			}
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+
+	return occluded;
+}
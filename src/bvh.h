@@ -0,0 +1,71 @@
+#ifndef __OBSCURA_BVH_H__
+#define __OBSCURA_BVH_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "collision.h"
+#include "memory.h"
+#include "tensor.h"
+#include "thread.h"
+#include "visibility.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Interior nodes reference both children, leaf nodes reference a run of count primitives starting at
+ * offset.
+ */
+struct __hierarchy_node {
+	vec4	lower;
+	vec4	upper;
+
+	uint32_t	offset;
+	uint32_t	right;
+	uint32_t	count;
+};
+
+/*
+ * Binary bounding volume hierarchy, either built top-down with the surface area heuristic over binned
+ * primitive centroids or emitted bottom-up from the Morton order of the centroids (linear BVH).
+ */
+typedef struct ObscuraBoundingVolumeHierarchy {
+	uint32_t		 nodes_capacity;
+	uint32_t		 nodes_count;
+	struct __hierarchy_node	*nodes;
+
+	uint32_t	depth;
+	bool		avx2;
+
+	/*
+	 * Scratch storage of the linear builder. Codes and indices are double buffered for the radix sort.
+	 */
+	uint32_t		 scratch_capacity;
+	uint32_t		*codes;
+	uint32_t		*indices;
+	uint32_t		*parents;
+	volatile uint32_t	*visits;
+} ObscuraBoundingVolumeHierarchy;
+
+extern ObscuraBoundingVolumeHierarchy *	ObscuraCreateBoundingVolumeHierarchy	(ObscuraAllocationCallbacks *);
+extern void				ObscuraDestroyBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy **,
+	ObscuraAllocationCallbacks *);
+
+extern void	ObscuraBuildBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy *, ObscuraPrimitive *, uint32_t,
+	ObscuraAllocationCallbacks *);
+extern void	ObscuraBuildLinearBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy *, ObscuraPrimitive *, uint32_t,
+	ObscuraExecutionCallbacks *, ObscuraAllocationCallbacks *);
+extern void	ObscuraTraverseBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy *, ObscuraPrimitive *,
+	ObscuraSphereSet *, vec4, ObscuraBoundingVolume *, ObscuraVisible *);
+extern void	ObscuraTraversePacketBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy *, ObscuraSphereSet *,
+	ObscuraRayPacket *, uint32_t *);
+extern bool	ObscuraOccludedBoundingVolumeHierarchy	(ObscuraBoundingVolumeHierarchy *, ObscuraSphereSet *, vec4,
+	ObscuraBoundingVolume *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
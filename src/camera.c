@@ -16,20 +16,19 @@ ObscuraCreateCamera(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyCamera(ObscuraCamera **ptr, ObscuraAllocationCallbacks *allocator)
 {
-	allocator->free((*ptr)->projection);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
 }
 
 ObscuraCamera *
-ObscuraBindProjection(ObscuraCamera *camera, ObscuraCameraProjectionType type, ObscuraAllocationCallbacks *allocator)
+ObscuraBindProjection(ObscuraCamera *camera, ObscuraCameraProjectionType type, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	camera->type = type;
 
 	switch (camera->type) {
 	case OBSCURA_CAMERA_PROJECTION_TYPE_PERSPECTIVE:
-		camera->projection = allocator->allocation(sizeof(ObscuraCameraPerspective), 8);
+		camera->projection.perspective = (ObscuraCameraPerspective) {};
 		break;
 	default:
 		assert(false);
@@ -25,9 +25,21 @@ typedef enum ObscuraCameraAntiAliasingTechnique {
 	OBSCURA_CAMERA_ANTI_ALIASING_TECHNIQUE_SSAA_STOCHASTIC,
 } ObscuraCameraAntiAliasingTechnique;
 
+/*
+ * Describes the field of view of a perspective camera.
+ */
+typedef struct ObscuraCameraPerspective {
+	float	aspect_ratio;
+	float	yfov;
+	float	znear;
+	float	zfar;
+} ObscuraCameraPerspective;
+
 typedef struct ObscuraCamera {
-	ObscuraCameraProjectionType	 type;
-	void				*projection;
+	ObscuraCameraProjectionType	type;
+	union {
+		ObscuraCameraPerspective	perspective;
+	}				projection;
 
 	ObscuraCameraFilterType	filter;
 
@@ -40,16 +52,6 @@ extern void		ObscuraDestroyCamera	(ObscuraCamera **, ObscuraAllocationCallbacks
 
 extern ObscuraCamera *	ObscuraBindProjection	(ObscuraCamera *, ObscuraCameraProjectionType, ObscuraAllocationCallbacks *);
 
-/*
- * Describes the field of view of a perspective camera.
- */
-typedef struct ObscuraCameraPerspective {
-	float	aspect_ratio;
-	float	yfov;
-	float	znear;
-	float	zfar;
-} ObscuraCameraPerspective;
-
 #ifdef __cplusplus
 }
 #endif
@@ -1,34 +1,378 @@
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 
 #include "collision.h"
 
+#define SPHERE_SET_PADDING	16
+
 static void
-raysphereintersect(ObscuraBoundingVolumeRay *v1, vec4 p1, ObscuraBoundingVolumeSphere *v2, vec4 p2, ObscuraCollision *collision)
+raysphereintersect(ObscuraBoundingVolume *ray, vec4 p1, ObscuraBoundingVolumeSphere *v2, vec4 p2, ObscuraCollision *collision)
 {
+	ObscuraBoundingVolumeRay *v1 = &ray->volume.ray;
+
+	vec4 direction = v1->direction;
+	direction[3] = 0;
+
 	vec4 d = p1 - p2;
-	
-	float a = vec4_dot(v1->direction, v1->direction);
-	float b = 2 * vec4_dot(v1->direction, d);
+	d[3] = 0;
+
+	float a = vec4_dot(direction, direction);
+	float b = 2 * vec4_dot(direction, d);
 	float c = vec4_dot(d, d) - (v2->radius * v2->radius);
 
 	collision->hit = false;
 
 	float x0, x1;
-	if (quad_solver(a, b, c, &x0, &x1)) {
-		float x = (x0 > x1 && x1 > 0) ? x1 : x0;
-		if (x > 0) {
-			collision->hit        = true;
-			collision->hit_point  = p1 + v1->direction * x;
-			collision->hit_normal = vec4_normalize(collision->hit_point - p2);
+	if (quad_solver(a, b, c, &x0, &x1) && x0 > v1->tmin && x0 < v1->tmax) {
+		ObscuraResolveCollision(ray, p1, p2, x0, collision);
+	}
+}
+
+/*
+ * Slab test against the box centered on p2, the hit lying where the ray enters it; rays starting inside the
+ * box do not hit it. The normal is that of the face of the slab entered last.
+ */
+static void
+rayaabbintersect(ObscuraBoundingVolume *ray, vec4 p1, ObscuraBoundingVolumeAABB *v2, vec4 p2, ObscuraCollision *collision)
+{
+	ObscuraBoundingVolumeRay *v1 = &ray->volume.ray;
+
+	vec4 direction = v1->direction;
+	direction[3] = 0;
+
+	vec4 extent = v2->half_extents;
+	extent[3] = 0;
+
+	vec4 inverse = VEC4_ONE / direction;
+	vec4 tnear = _mm_min_ps((p2 - extent - p1) * inverse, (p2 + extent - p1) * inverse);
+
+	collision->hit = false;
+
+	float enter = ObscuraSlabTest(p2 - extent, p2 + extent, p1, inverse, -INFINITY, INFINITY);
+	if (enter > v1->tmin && enter < v1->tmax) {
+		collision->hit        = true;
+		collision->distance   = enter;
+		collision->hit_point  = p1 + direction * enter;
+		collision->hit_normal = VEC4_ZERO;
+
+		int axis = __builtin_ctz(_mm_movemask_ps(_mm_cmpeq_ps(tnear, _mm_set1_ps(enter))) | 0x4);
+		collision->hit_normal[axis] = (direction[axis] > 0) ? -1 : 1;
+	}
+}
+
+/*
+ * The kernels below keep, per lane, the nearest entry distance found so far and the sphere it belongs to.
+ * The smaller root is taken in whichever of its two forms avoids cancellation; only entry points past tmin
+ * count, matching the scalar test.
+ */
+static uint32_t
+raysphereset4(ObscuraSphereSet *set, uint32_t first, uint32_t count, vec4 o, vec4 d, float a, float tmin,
+	float *distance)
+{
+	vec4 ox = _mm_set1_ps(o[0]);
+	vec4 oy = _mm_set1_ps(o[1]);
+	vec4 oz = _mm_set1_ps(o[2]);
+	vec4 dx = _mm_set1_ps(d[0]);
+	vec4 dy = _mm_set1_ps(d[1]);
+	vec4 dz = _mm_set1_ps(d[2]);
+	vec4 va = _mm_set1_ps(a);
+	vec4 vmin = _mm_set1_ps(tmin);
+
+	vec4 best = _mm_set1_ps(*distance);
+	__m128i best_index = _mm_set1_epi32(-1);
+	int any = 0;
+
+	__m128i last = _mm_set1_epi32(first + count);
+	for (uint32_t i = first; i < first + count; i += 4) {
+		__m128i index = _mm_add_epi32(_mm_set1_epi32(i), _mm_setr_epi32(0, 1, 2, 3));
+
+		vec4 ocx = ox - _mm_loadu_ps(&set->x[i]);
+		vec4 ocy = oy - _mm_loadu_ps(&set->y[i]);
+		vec4 ocz = oz - _mm_loadu_ps(&set->z[i]);
+
+		vec4 b = dx * ocx + dy * ocy + dz * ocz;
+		vec4 c = ocx * ocx + ocy * ocy + ocz * ocz - _mm_loadu_ps(&set->radius2[i]);
+		vec4 discriminant = b * b - va * c;
+
+		vec4 s = _mm_sqrt_ps(_mm_max_ps(discriminant, VEC4_ZERO));
+		vec4 t = _mm_blendv_ps((-b - s) / va, c / (s - b), _mm_cmplt_ps(b, VEC4_ZERO));
+
+		vec4 hit = _mm_castsi128_ps(_mm_cmpgt_epi32(last, index));
+		hit = _mm_and_ps(hit, _mm_cmpge_ps(discriminant, VEC4_ZERO));
+		hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, vmin));
+		hit = _mm_and_ps(hit, _mm_cmplt_ps(t, best));
+
+		best = _mm_blendv_ps(best, t, hit);
+		best_index = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(best_index), _mm_castsi128_ps(index), hit));
+		any |= _mm_movemask_ps(hit);
+	}
+
+	if (any == 0) {
+		return OBSCURA_SPHERE_SET_MISS;
+	}
+
+	float distances[4];
+	uint32_t indices[4];
+	_mm_storeu_ps(distances, best);
+	_mm_storeu_si128((__m128i *) indices, best_index);
+
+	uint32_t nearest = OBSCURA_SPHERE_SET_MISS;
+	for (int lane = 0; lane < 4; lane++) {
+		if (indices[lane] != OBSCURA_SPHERE_SET_MISS && distances[lane] < *distance) {
+			*distance = distances[lane];
+			nearest = indices[lane];
+		}
+	}
+
+	return nearest;
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t
+raysphereset8(ObscuraSphereSet *set, uint32_t first, uint32_t count, vec4 o, vec4 d, float a, float tmin,
+	float *distance)
+{
+	__m256 ox = _mm256_set1_ps(o[0]);
+	__m256 oy = _mm256_set1_ps(o[1]);
+	__m256 oz = _mm256_set1_ps(o[2]);
+	__m256 dx = _mm256_set1_ps(d[0]);
+	__m256 dy = _mm256_set1_ps(d[1]);
+	__m256 dz = _mm256_set1_ps(d[2]);
+	__m256 va = _mm256_set1_ps(a);
+	__m256 vmin = _mm256_set1_ps(tmin);
+	__m256 zero = _mm256_setzero_ps();
+
+	__m256 best = _mm256_set1_ps(*distance);
+	__m256i best_index = _mm256_set1_epi32(-1);
+	int any = 0;
+
+	__m256i last = _mm256_set1_epi32(first + count);
+	for (uint32_t i = first; i < first + count; i += 8) {
+		__m256i index = _mm256_add_epi32(_mm256_set1_epi32(i), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+
+		__m256 ocx = _mm256_sub_ps(ox, _mm256_loadu_ps(&set->x[i]));
+		__m256 ocy = _mm256_sub_ps(oy, _mm256_loadu_ps(&set->y[i]));
+		__m256 ocz = _mm256_sub_ps(oz, _mm256_loadu_ps(&set->z[i]));
+
+		__m256 b = _mm256_fmadd_ps(dz, ocz, _mm256_fmadd_ps(dy, ocy, _mm256_mul_ps(dx, ocx)));
+		__m256 c = _mm256_fmadd_ps(ocz, ocz, _mm256_fmadd_ps(ocy, ocy, _mm256_mul_ps(ocx, ocx)));
+		c = _mm256_sub_ps(c, _mm256_loadu_ps(&set->radius2[i]));
+		__m256 discriminant = _mm256_fmsub_ps(b, b, _mm256_mul_ps(va, c));
+
+		__m256 s = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+		__m256 t = _mm256_blendv_ps(_mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), s), va),
+			_mm256_div_ps(c, _mm256_sub_ps(s, b)), _mm256_cmp_ps(b, zero, _CMP_LT_OQ));
+
+		__m256 hit = _mm256_castsi256_ps(_mm256_cmpgt_epi32(last, index));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, vmin, _CMP_GT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, best, _CMP_LT_OQ));
+
+		best = _mm256_blendv_ps(best, t, hit);
+		best_index = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(best_index), _mm256_castsi256_ps(index), hit));
+		any |= _mm256_movemask_ps(hit);
+	}
+
+	if (any == 0) {
+		return OBSCURA_SPHERE_SET_MISS;
+	}
+
+	float distances[8];
+	uint32_t indices[8];
+	_mm256_storeu_ps(distances, best);
+	_mm256_storeu_si256((__m256i *) indices, best_index);
+
+	uint32_t nearest = OBSCURA_SPHERE_SET_MISS;
+	for (int lane = 0; lane < 8; lane++) {
+		if (indices[lane] != OBSCURA_SPHERE_SET_MISS && distances[lane] < *distance) {
+			*distance = distances[lane];
+			nearest = indices[lane];
+		}
+	}
+
+	return nearest;
+}
+
+__attribute__((target("avx512f")))
+static uint32_t
+raysphereset16(ObscuraSphereSet *set, uint32_t first, uint32_t count, vec4 o, vec4 d, float a, float tmin,
+	float *distance)
+{
+	__m512 ox = _mm512_set1_ps(o[0]);
+	__m512 oy = _mm512_set1_ps(o[1]);
+	__m512 oz = _mm512_set1_ps(o[2]);
+	__m512 dx = _mm512_set1_ps(d[0]);
+	__m512 dy = _mm512_set1_ps(d[1]);
+	__m512 dz = _mm512_set1_ps(d[2]);
+	__m512 va = _mm512_set1_ps(a);
+	__m512 vmin = _mm512_set1_ps(tmin);
+	__m512 zero = _mm512_setzero_ps();
+
+	__m512 best = _mm512_set1_ps(*distance);
+	__m512i best_index = _mm512_set1_epi32(-1);
+	__mmask16 any = 0;
+
+	for (uint32_t i = first; i < first + count; i += 16) {
+		uint32_t remaining = first + count - i;
+		__mmask16 valid = (remaining >= 16) ? 0xffff : (__mmask16) ((1u << remaining) - 1);
+
+		__m512i index = _mm512_add_epi32(_mm512_set1_epi32(i),
+			_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+		__m512 ocx = _mm512_sub_ps(ox, _mm512_loadu_ps(&set->x[i]));
+		__m512 ocy = _mm512_sub_ps(oy, _mm512_loadu_ps(&set->y[i]));
+		__m512 ocz = _mm512_sub_ps(oz, _mm512_loadu_ps(&set->z[i]));
+
+		__m512 b = _mm512_fmadd_ps(dz, ocz, _mm512_fmadd_ps(dy, ocy, _mm512_mul_ps(dx, ocx)));
+		__m512 c = _mm512_fmadd_ps(ocz, ocz, _mm512_fmadd_ps(ocy, ocy, _mm512_mul_ps(ocx, ocx)));
+		c = _mm512_sub_ps(c, _mm512_loadu_ps(&set->radius2[i]));
+		__m512 discriminant = _mm512_fmsub_ps(b, b, _mm512_mul_ps(va, c));
+
+		valid = _mm512_mask_cmp_ps_mask(valid, discriminant, zero, _CMP_GE_OQ);
+
+		__m512 s = _mm512_sqrt_ps(_mm512_max_ps(discriminant, zero));
+		__m512 t = _mm512_div_ps(_mm512_sub_ps(_mm512_sub_ps(zero, b), s), va);
+		t = _mm512_mask_div_ps(t, _mm512_cmp_ps_mask(b, zero, _CMP_LT_OQ), c, _mm512_sub_ps(s, b));
+
+		valid = _mm512_mask_cmp_ps_mask(valid, t, vmin, _CMP_GT_OQ);
+		valid = _mm512_mask_cmp_ps_mask(valid, t, best, _CMP_LT_OQ);
+
+		best = _mm512_mask_mov_ps(best, valid, t);
+		best_index = _mm512_mask_mov_epi32(best_index, valid, index);
+		any |= valid;
+	}
+
+	if (any == 0) {
+		return OBSCURA_SPHERE_SET_MISS;
+	}
+
+	float nearest_distance = _mm512_reduce_min_ps(best);
+
+	__mmask16 lanes = _mm512_cmp_ps_mask(best, _mm512_set1_ps(nearest_distance), _CMP_EQ_OQ);
+	uint32_t indices[16];
+	_mm512_storeu_si512(indices, best_index);
+
+	*distance = nearest_distance;
+
+	return indices[__builtin_ctz(lanes)];
+}
+
+/*
+ * Packet kernels: the origin is shared, so only the projection of the center on each direction varies
+ * across lanes. Every sphere is loaded once and tested against the lanes of mask, which keep their own
+ * interval and nearest sphere.
+ */
+static uint32_t
+raypacketsphere4(ObscuraRayPacket *packet, uint32_t lanes, ObscuraSphereSet *set, uint32_t first, uint32_t count,
+	uint32_t *indices)
+{
+	uint32_t updated = 0;
+
+	for (uint32_t lane = 0; lane < packet->width; lane += 4) {
+		uint32_t mask = (lanes >> lane) & 0xf;
+		if (mask == 0) {
+			continue;
+		}
+
+		vec4 dx = _mm_loadu_ps(&packet->x[lane]);
+		vec4 dy = _mm_loadu_ps(&packet->y[lane]);
+		vec4 dz = _mm_loadu_ps(&packet->z[lane]);
+		vec4 tmin = _mm_loadu_ps(&packet->tmin[lane]);
+		vec4 tmax = _mm_loadu_ps(&packet->tmax[lane]);
+		vec4 a = dx * dx + dy * dy + dz * dz;
+
+		vec4 active = _mm_castsi128_ps(_mm_cmpgt_epi32(_mm_and_si128(_mm_set1_epi32(mask), _mm_setr_epi32(1, 2, 4, 8)),
+			_mm_setzero_si128()));
+		__m128i nearest = _mm_loadu_si128((__m128i *) &indices[lane]);
+		int any = 0;
+
+		for (uint32_t i = first; i < first + count; i++) {
+			float ocx = packet->position[0] - set->x[i];
+			float ocy = packet->position[1] - set->y[i];
+			float ocz = packet->position[2] - set->z[i];
+
+			vec4 b = dx * ocx + dy * ocy + dz * ocz;
+			vec4 c = _mm_set1_ps(ocx * ocx + ocy * ocy + ocz * ocz - set->radius2[i]);
+			vec4 discriminant = b * b - a * c;
+
+			vec4 s = _mm_sqrt_ps(_mm_max_ps(discriminant, VEC4_ZERO));
+			vec4 t = _mm_blendv_ps((-b - s) / a, c / (s - b), _mm_cmplt_ps(b, VEC4_ZERO));
+
+			vec4 hit = _mm_and_ps(active, _mm_cmpge_ps(discriminant, VEC4_ZERO));
+			hit = _mm_and_ps(hit, _mm_cmpgt_ps(t, tmin));
+			hit = _mm_and_ps(hit, _mm_cmplt_ps(t, tmax));
+
+			tmax = _mm_blendv_ps(tmax, t, hit);
+			nearest = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(nearest), _mm_castsi128_ps(_mm_set1_epi32(i)), hit));
+			any |= _mm_movemask_ps(hit);
+		}
+
+		if (any != 0) {
+			_mm_storeu_ps(&packet->tmax[lane], tmax);
+			_mm_storeu_si128((__m128i *) &indices[lane], nearest);
+			updated |= any << lane;
 		}
 	}
+
+	return updated;
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t
+raypacketsphere8(ObscuraRayPacket *packet, uint32_t mask, ObscuraSphereSet *set, uint32_t first, uint32_t count,
+	uint32_t *indices)
+{
+	__m256 dx = _mm256_loadu_ps(packet->x);
+	__m256 dy = _mm256_loadu_ps(packet->y);
+	__m256 dz = _mm256_loadu_ps(packet->z);
+	__m256 tmin = _mm256_loadu_ps(packet->tmin);
+	__m256 tmax = _mm256_loadu_ps(packet->tmax);
+	__m256 a = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+	__m256 zero = _mm256_setzero_ps();
+
+	__m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	__m256 active = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), lanes),
+		_mm256_setzero_si256()));
+	__m256i nearest = _mm256_loadu_si256((__m256i *) indices);
+	int any = 0;
+
+	for (uint32_t i = first; i < first + count; i++) {
+		float ocx = packet->position[0] - set->x[i];
+		float ocy = packet->position[1] - set->y[i];
+		float ocz = packet->position[2] - set->z[i];
+
+		__m256 b = _mm256_fmadd_ps(dz, _mm256_set1_ps(ocz), _mm256_fmadd_ps(dy, _mm256_set1_ps(ocy),
+			_mm256_mul_ps(dx, _mm256_set1_ps(ocx))));
+		__m256 c = _mm256_set1_ps(ocx * ocx + ocy * ocy + ocz * ocz - set->radius2[i]);
+		__m256 discriminant = _mm256_fmsub_ps(b, b, _mm256_mul_ps(a, c));
+
+		__m256 s = _mm256_sqrt_ps(_mm256_max_ps(discriminant, zero));
+		__m256 t = _mm256_blendv_ps(_mm256_div_ps(_mm256_sub_ps(_mm256_sub_ps(zero, b), s), a),
+			_mm256_div_ps(c, _mm256_sub_ps(s, b)), _mm256_cmp_ps(b, zero, _CMP_LT_OQ));
+
+		__m256 hit = _mm256_and_ps(active, _mm256_cmp_ps(discriminant, zero, _CMP_GE_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tmin, _CMP_GT_OQ));
+		hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tmax, _CMP_LT_OQ));
+
+		tmax = _mm256_blendv_ps(tmax, t, hit);
+		nearest = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(nearest), _mm256_castsi256_ps(_mm256_set1_epi32(i)),
+			hit));
+		any |= _mm256_movemask_ps(hit);
+	}
+
+	if (any != 0) {
+		_mm256_storeu_ps(packet->tmax, tmax);
+		_mm256_storeu_si256((__m256i *) indices, nearest);
+	}
+
+	return any;
 }
 
 ObscuraBoundingVolume *
 ObscuraCreateBoundingVolume(ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraBoundingVolume *volume = allocator->allocation(sizeof(ObscuraBoundingVolume), 8);
+	ObscuraBoundingVolume *volume = allocator->allocation(sizeof(ObscuraBoundingVolume), 16);
 
 	return volume;
 }
@@ -36,26 +380,25 @@ ObscuraCreateBoundingVolume(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyBoundingVolume(ObscuraBoundingVolume **ptr, ObscuraAllocationCallbacks *allocator)
 {
-	allocator->free((*ptr)->volume);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
 }
 
 ObscuraBoundingVolume *
-ObscuraBindBoundingVolume(ObscuraBoundingVolume *volume, ObscuraBoundingVolumeType type, ObscuraAllocationCallbacks *allocator)
+ObscuraBindBoundingVolume(ObscuraBoundingVolume *volume, ObscuraBoundingVolumeType type, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	volume->type = type;
 
 	switch (volume->type) {
 	case OBSCURA_BOUNDING_VOLUME_TYPE_AABB:
-		volume->volume = allocator->allocation(sizeof(ObscuraBoundingVolumeAABB), 8);
+		volume->volume.aabb = (ObscuraBoundingVolumeAABB) {};
 		break;
 	case OBSCURA_BOUNDING_VOLUME_TYPE_RAY:
-		volume->volume = allocator->allocation(sizeof(ObscuraBoundingVolumeRay), 8);
+		volume->volume.ray = (ObscuraBoundingVolumeRay) { .tmax = INFINITY };
 		break;
 	case OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE:
-		volume->volume = allocator->allocation(sizeof(ObscuraBoundingVolumeSphere), 8);
+		volume->volume.sphere = (ObscuraBoundingVolumeSphere) {};
 		break;
 	default:
 		assert(false);
@@ -87,6 +430,9 @@ ObscuraCollidesWith(ObscuraBoundingVolume *v1, vec4 p1, ObscuraBoundingVolume *v
 	switch (v1->type) {
 	case OBSCURA_BOUNDING_VOLUME_TYPE_AABB:
 		switch (v2->type) {
+		case OBSCURA_BOUNDING_VOLUME_TYPE_RAY:
+			rayaabbintersect(v2, p2, &v1->volume.aabb, p1, collision);
+			break;
 		default:
 			assert(false);
 			break;
@@ -94,8 +440,11 @@ ObscuraCollidesWith(ObscuraBoundingVolume *v1, vec4 p1, ObscuraBoundingVolume *v
 		break;
 	case OBSCURA_BOUNDING_VOLUME_TYPE_RAY:
 		switch (v2->type) {
+		case OBSCURA_BOUNDING_VOLUME_TYPE_AABB:
+			rayaabbintersect(v1, p1, &v2->volume.aabb, p2, collision);
+			break;
 		case OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE:
-			raysphereintersect(v1->volume, p1, v2->volume, p2, collision);
+			raysphereintersect(v1, p1, &v2->volume.sphere, p2, collision);
 			break;
 		default:
 			assert(false);
@@ -105,7 +454,7 @@ ObscuraCollidesWith(ObscuraBoundingVolume *v1, vec4 p1, ObscuraBoundingVolume *v
 	case OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE:
 		switch (v2->type) {
 		case OBSCURA_BOUNDING_VOLUME_TYPE_RAY:
-			raysphereintersect(v2->volume, p2, v1->volume, p1, collision);
+			raysphereintersect(v2, p2, &v1->volume.sphere, p1, collision);
 			break;
 		default:
 			assert(false);
@@ -117,3 +466,142 @@ ObscuraCollidesWith(ObscuraBoundingVolume *v1, vec4 p1, ObscuraBoundingVolume *v
 		break;
 	}
 }
+
+void
+ObscuraResolveCollision(ObscuraBoundingVolume *ray, vec4 position, vec4 center, float distance, ObscuraCollision *collision)
+{
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+	vec4 direction = r->direction;
+	direction[3] = 0;
+
+	collision->hit        = true;
+	collision->distance   = distance;
+	collision->hit_point  = position + direction * distance;
+
+	vec4 normal = collision->hit_point - center;
+	normal[3] = 0;
+	collision->hit_normal = vec4_normalize(normal);
+}
+
+void
+ObscuraLoadRay(ObscuraRayPacket *packet, uint32_t lane, ObscuraBoundingVolumeRay *ray)
+{
+	ray->direction = _mm_setr_ps(packet->x[lane], packet->y[lane], packet->z[lane], 0);
+	ray->tmin      = packet->tmin[lane];
+	ray->tmax      = packet->tmax[lane];
+}
+
+void
+ObscuraStoreRay(ObscuraRayPacket *packet, uint32_t lane, ObscuraBoundingVolumeRay *ray)
+{
+	packet->x[lane]    = ray->direction[0];
+	packet->y[lane]    = ray->direction[1];
+	packet->z[lane]    = ray->direction[2];
+	packet->tmin[lane] = ray->tmin;
+	packet->tmax[lane] = ray->tmax;
+}
+
+ObscuraSphereSet *
+ObscuraCreateSphereSet(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraSphereSet *set = allocator->allocation(sizeof(ObscuraSphereSet), 8);
+
+	if (__builtin_cpu_supports("avx512f")) {
+		set->width = 16;
+	} else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		set->width = 8;
+	} else {
+		set->width = 4;
+	}
+
+	return set;
+}
+
+void
+ObscuraDestroySphereSet(ObscuraSphereSet **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	allocator->free((*ptr)->x);
+	allocator->free((*ptr)->y);
+	allocator->free((*ptr)->z);
+	allocator->free((*ptr)->radius2);
+	allocator->free(*ptr);
+
+	*ptr = NULL;
+}
+
+void
+ObscuraResizeSphereSet(ObscuraSphereSet *set, uint32_t count, ObscuraAllocationCallbacks *allocator)
+{
+	set->count = count;
+
+	if (set->capacity < count + SPHERE_SET_PADDING) {
+		allocator->free(set->x);
+		allocator->free(set->y);
+		allocator->free(set->z);
+		allocator->free(set->radius2);
+
+		set->capacity = count + SPHERE_SET_PADDING;
+		set->x       = allocator->allocation(sizeof(float) * set->capacity, LEVEL1_DCACHE_LINESIZE);
+		set->y       = allocator->allocation(sizeof(float) * set->capacity, LEVEL1_DCACHE_LINESIZE);
+		set->z       = allocator->allocation(sizeof(float) * set->capacity, LEVEL1_DCACHE_LINESIZE);
+		set->radius2 = allocator->allocation(sizeof(float) * set->capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+}
+
+void
+ObscuraStoreSphere(ObscuraSphereSet *set, uint32_t index, vec4 center, ObscuraBoundingVolume *volume)
+{
+	assert(volume->type == OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE);
+	float radius = volume->volume.sphere.radius;
+
+	set->x[index]       = center[0];
+	set->y[index]       = center[1];
+	set->z[index]       = center[2];
+	set->radius2[index] = radius * radius;
+}
+
+/*
+ * Returns the index of the sphere among count starting at first whose entry point is nearest within the
+ * ray interval, which then ends at that entry point.
+ */
+uint32_t
+ObscuraCollidesWithSphereSet(ObscuraBoundingVolume *ray, vec4 position, ObscuraSphereSet *set, uint32_t first,
+	uint32_t count)
+{
+	assert(ray->type == OBSCURA_BOUNDING_VOLUME_TYPE_RAY);
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+	vec4 direction = r->direction;
+	direction[3] = 0;
+	float a = vec4_dot(direction, direction);
+
+	/*
+	 * Short runs, typical of hierarchy leaves, go to the narrowest kernel that covers them in one step.
+	 */
+	if (set->width >= 16 && count > 8) {
+		return raysphereset16(set, first, count, position, direction, a, r->tmin, &r->tmax);
+	} else if (set->width >= 8 && count > 4) {
+		return raysphereset8(set, first, count, position, direction, a, r->tmin, &r->tmax);
+	} else {
+		return raysphereset4(set, first, count, position, direction, a, r->tmin, &r->tmax);
+	}
+}
+
+/*
+ * Packet counterpart of the above: indices receives, for every lane of mask, the sphere whose entry point
+ * is nearest within the interval of that lane. mask is a subset of the active lanes, such as those that
+ * reached a leaf. Returns the mask of lanes whose nearest sphere changed.
+ */
+uint32_t
+ObscuraCollidesWithSphereSetPacket(ObscuraRayPacket *packet, uint32_t mask, ObscuraSphereSet *set, uint32_t first,
+	uint32_t count, uint32_t *indices)
+{
+	assert((mask & ~packet->active) == 0);
+
+	if (packet->width == 8 && set->width >= 8) {
+		return raypacketsphere8(packet, mask, set, first, count, indices);
+	} else {
+		return raypacketsphere4(packet, mask, set, first, count, indices);
+	}
+}
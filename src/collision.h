@@ -2,6 +2,7 @@
 #define __OBSCURA_COLLISION_H__ 1
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "memory.h"
 #include "tensor.h"
@@ -16,9 +17,32 @@ typedef enum ObscuraBoundingVolumeType {
 	OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE,
 } ObscuraBoundingVolumeType;
 
+typedef struct ObscuraBoundingVolumeAABB {
+	vec4	half_extents;
+} ObscuraBoundingVolumeAABB;
+
+/*
+ * Only hits at a distance within the open interval (tmin, tmax) count. Closest hit queries shrink tmax to
+ * the nearest hit found so far, so every later test is clipped against it; a tmin above zero keeps rays
+ * leaving a surface from hitting that same surface again.
+ */
+typedef struct ObscuraBoundingVolumeRay {
+	vec4	direction;
+	float	tmin;
+	float	tmax;
+} ObscuraBoundingVolumeRay;
+
+typedef struct ObscuraBoundingVolumeSphere {
+	float	radius;
+} ObscuraBoundingVolumeSphere;
+
 typedef struct ObscuraBoundingVolume {
-	ObscuraBoundingVolumeType	 type;
-	void				*volume;
+	ObscuraBoundingVolumeType	type;
+	union {
+		ObscuraBoundingVolumeAABB	aabb;
+		ObscuraBoundingVolumeRay	ray;
+		ObscuraBoundingVolumeSphere	sphere;
+	}				volume;
 } ObscuraBoundingVolume;
 
 extern ObscuraBoundingVolume *	ObscuraCreateBoundingVolume	(ObscuraAllocationCallbacks *);
@@ -29,6 +53,7 @@ extern ObscuraBoundingVolume *	ObscuraBindBoundingVolume	(ObscuraBoundingVolume
 
 typedef struct ObscuraCollision {
 	bool	hit;
+	float	distance;
 	vec4	hit_point;
 	vec4	hit_normal;
 } ObscuraCollision;
@@ -37,18 +62,87 @@ extern ObscuraCollision *	ObscuraCreateCollision	(ObscuraAllocationCallbacks *);
 extern void			ObscuraDestroyCollision	(ObscuraCollision **, ObscuraAllocationCallbacks *);
 
 extern void	ObscuraCollidesWith	(ObscuraBoundingVolume *, vec4, ObscuraBoundingVolume *, vec4, ObscuraCollision *);
+extern void	ObscuraResolveCollision	(ObscuraBoundingVolume *, vec4, vec4, float, ObscuraCollision *);
 
-typedef struct ObscuraBoundingVolumeAABB {
-	vec4	half_extents;
-} ObscuraBoundingVolumeAABB;
+/*
+ * Slab test of a ray against the box [lower, upper], all three axes at once: returns the distance at which
+ * the ray enters the box clipped to [tmin, tmax], or INFINITY if it misses. inverse holds the reciprocals
+ * of the direction of the ray.
+ */
+static inline float
+ObscuraSlabTest(vec4 lower, vec4 upper, vec4 origin, vec4 inverse, float tmin, float tmax)
+{
+	vec4 t0 = (lower - origin) * inverse;
+	vec4 t1 = (upper - origin) * inverse;
 
-typedef struct ObscuraBoundingVolumeRay {
-	vec4	direction;
-} ObscuraBoundingVolumeRay;
+	/*
+	 * The unused fourth lane carries the ray interval so that the horizontal reductions clip against
+	 * it for free.
+	 */
+	vec4 tnear = _mm_blend_ps(_mm_min_ps(t0, t1), _mm_set1_ps(tmin), 0x8);
+	vec4 tfar  = _mm_blend_ps(_mm_max_ps(t0, t1), _mm_set1_ps(tmax), 0x8);
 
-typedef struct ObscuraBoundingVolumeSphere {
-	float	radius;
-} ObscuraBoundingVolumeSphere;
+	tnear = _mm_max_ps(tnear, _mm_shuffle_ps(tnear, tnear, _MM_SHUFFLE(2, 3, 0, 1)));
+	tnear = _mm_max_ps(tnear, _mm_shuffle_ps(tnear, tnear, _MM_SHUFFLE(1, 0, 3, 2)));
+	tfar  = _mm_min_ps(tfar, _mm_shuffle_ps(tfar, tfar, _MM_SHUFFLE(2, 3, 0, 1)));
+	tfar  = _mm_min_ps(tfar, _mm_shuffle_ps(tfar, tfar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	float enter = _mm_cvtss_f32(tnear);
+	float exit  = _mm_cvtss_f32(tfar);
+
+	return (enter <= exit) ? enter : INFINITY;
+}
+
+#define OBSCURA_RAY_EPSILON	1e-4f
+
+#define OBSCURA_RAY_PACKET_WIDTH	8
+
+/*
+ * Rays sharing an origin, stored lane by lane so that a node or a sphere is tested against all of them at
+ * once: four lanes (2x2 pixels) with SSE, eight (4x2 pixels) with AVX2. Lanes outside the active mask
+ * are left untouched.
+ */
+typedef struct ObscuraRayPacket {
+	uint32_t	width;
+	uint32_t	active;
+	vec4		position;
+
+	float	x[OBSCURA_RAY_PACKET_WIDTH];
+	float	y[OBSCURA_RAY_PACKET_WIDTH];
+	float	z[OBSCURA_RAY_PACKET_WIDTH];
+	float	tmin[OBSCURA_RAY_PACKET_WIDTH];
+	float	tmax[OBSCURA_RAY_PACKET_WIDTH];
+} ObscuraRayPacket;
+
+extern void	ObscuraLoadRay	(ObscuraRayPacket *, uint32_t, ObscuraBoundingVolumeRay *);
+extern void	ObscuraStoreRay	(ObscuraRayPacket *, uint32_t, ObscuraBoundingVolumeRay *);
+
+#define OBSCURA_SPHERE_SET_MISS	UINT32_MAX
+
+/*
+ * Structure of arrays copy of a list of spheres, so that one ray is tested against 4, 8 or 16 of them per
+ * instruction depending on the widest vector unit available. The arrays are padded past the last sphere
+ * so that a run starting anywhere can be loaded a full vector at a time.
+ */
+typedef struct ObscuraSphereSet {
+	uint32_t	width;
+
+	uint32_t	 capacity;
+	uint32_t	 count;
+	float		*x;
+	float		*y;
+	float		*z;
+	float		*radius2;
+} ObscuraSphereSet;
+
+extern ObscuraSphereSet *	ObscuraCreateSphereSet	(ObscuraAllocationCallbacks *);
+extern void			ObscuraDestroySphereSet	(ObscuraSphereSet **, ObscuraAllocationCallbacks *);
+
+extern void	ObscuraResizeSphereSet		(ObscuraSphereSet *, uint32_t, ObscuraAllocationCallbacks *);
+extern void	ObscuraStoreSphere		(ObscuraSphereSet *, uint32_t, vec4, ObscuraBoundingVolume *);
+extern uint32_t	ObscuraCollidesWithSphereSet	(ObscuraBoundingVolume *, vec4, ObscuraSphereSet *, uint32_t, uint32_t);
+extern uint32_t	ObscuraCollidesWithSphereSetPacket	(ObscuraRayPacket *, uint32_t, ObscuraSphereSet *, uint32_t, uint32_t,
+	uint32_t *);
 
 #ifdef __cplusplus
 }
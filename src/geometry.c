@@ -14,20 +14,19 @@ ObscuraCreateGeometry(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyGeometry(ObscuraGeometry **ptr, ObscuraAllocationCallbacks *allocator)
 {
-	allocator->free((*ptr)->geometry);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
 }
 
 ObscuraGeometry *
-ObscuraBindGeometry(ObscuraGeometry *geometry, ObscuraGeometryType type, ObscuraAllocationCallbacks *allocator)
+ObscuraBindGeometry(ObscuraGeometry *geometry, ObscuraGeometryType type, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	geometry->type = type;
 
 	switch (geometry->type) {
 	case OBSCURA_GEOMETRY_TYPE_PARAMETRIC_SPHERE:
-		geometry->geometry = allocator->allocation(sizeof(ObscuraGeometrySphere), 8);
+		geometry->geometry.sphere = (ObscuraGeometrySphere) {};
 		break;
 	default:
 		assert(false);
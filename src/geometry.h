@@ -11,9 +11,15 @@ typedef enum ObscuraGeometryType {
 	OBSCURA_GEOMETRY_TYPE_PARAMETRIC_SPHERE,
 } ObscuraGeometryType;
 
+typedef struct ObscuraGeometrySphere {
+	float	radius;
+} ObscuraGeometrySphere;
+
 typedef struct ObscuraGeometry {
-	ObscuraGeometryType	 type;
-	void			*geometry;
+	ObscuraGeometryType	type;
+	union {
+		ObscuraGeometrySphere	sphere;
+	}			geometry;
 } ObscuraGeometry;
 
 extern ObscuraGeometry *	ObscuraCreateGeometry(ObscuraAllocationCallbacks *);
@@ -21,10 +27,6 @@ extern void			ObscuraDestroyGeometry(ObscuraGeometry **, ObscuraAllocationCallba
 
 extern ObscuraGeometry *	ObscuraBindGeometry(ObscuraGeometry *, ObscuraGeometryType, ObscuraAllocationCallbacks *);
 
-typedef struct ObscuraGeometrySphere {
-	float	radius;
-} ObscuraGeometrySphere;
-
 #ifdef __cplusplus
 }
 #endif
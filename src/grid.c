@@ -0,0 +1,296 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "grid.h"
+#include "stat.h"
+
+/*
+ * Target number of cells per primitive, following Cleary and Wyvill's cube root rule; the resolution of
+ * every axis is clamped so that degenerate scenes cannot exhaust memory.
+ */
+#define GRID_DENSITY			4.0f
+#define GRID_RESOLUTION_CAPACITY	256
+
+static inline int32_t
+clampi(int32_t v, int32_t lo, int32_t hi)
+{
+	return (v < lo) ? lo : ((v > hi) ? hi : v);
+}
+
+static inline void
+cells(ObscuraUniformGrid *grid, vec4 p, int32_t *c)
+{
+	vec4 v = (p - grid->lower) * grid->inverse_cell_size;
+
+	for (int axis = 0; axis < 3; axis++) {
+		c[axis] = clampi((int32_t) v[axis], 0, grid->resolution[axis] - 1);
+	}
+}
+
+/*
+ * Amanatides and Woo's 3D-DDA: next holds the distance at which the ray crosses into the following cell
+ * along each axis and delta the distance between two consecutive crossings. Axes the ray runs parallel to
+ * never advance; their last cell is the current one, so stepping there ends the walk.
+ */
+struct __grid_walk {
+	int32_t	cell[3];
+	int32_t	step[3];
+	int32_t	last[3];
+	float	next[3];
+	float	delta[3];
+};
+
+static bool
+start(ObscuraUniformGrid *grid, vec4 position, ObscuraBoundingVolumeRay *r, struct __grid_walk *walk)
+{
+	if (grid->cells_count == 0) {
+		return false;
+	}
+
+	vec4 inverse = VEC4_ONE / r->direction;
+
+	vec4 t0 = (grid->lower - position) * inverse;
+	vec4 t1 = (grid->upper - position) * inverse;
+	vec4 tnear = _mm_min_ps(t0, t1);
+	vec4 tfar  = _mm_max_ps(t0, t1);
+
+	float enter = fmaxf(fmaxf(tnear[0], tnear[1]), fmaxf(tnear[2], r->tmin));
+	float exit  = fminf(fminf(tfar[0], tfar[1]), fminf(tfar[2], r->tmax));
+	if (!(enter <= exit)) {
+		return false;
+	}
+
+	cells(grid, position + r->direction * enter, walk->cell);
+
+	for (int axis = 0; axis < 3; axis++) {
+		float d = r->direction[axis];
+		float boundary = grid->lower[axis] + walk->cell[axis] * grid->cell_size[axis];
+
+		if (d > 0) {
+			walk->step[axis]  = 1;
+			walk->last[axis]  = grid->resolution[axis];
+			walk->next[axis]  = (boundary + grid->cell_size[axis] - position[axis]) * inverse[axis];
+			walk->delta[axis] = grid->cell_size[axis] * inverse[axis];
+		} else if (d < 0) {
+			walk->step[axis]  = -1;
+			walk->last[axis]  = -1;
+			walk->next[axis]  = (boundary - position[axis]) * inverse[axis];
+			walk->delta[axis] = -grid->cell_size[axis] * inverse[axis];
+		} else {
+			walk->step[axis]  = 0;
+			walk->last[axis]  = walk->cell[axis];
+			walk->next[axis]  = INFINITY;
+			walk->delta[axis] = INFINITY;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Steps into the next cell unless the walk has left the grid or the ray interval ends, which is the case
+ * as soon as a hit inside the current cell is known.
+ */
+static bool
+advance(struct __grid_walk *walk, float tmax)
+{
+	int axis = (walk->next[0] < walk->next[1]) ? ((walk->next[0] < walk->next[2]) ? 0 : 2) :
+		((walk->next[1] < walk->next[2]) ? 1 : 2);
+
+	if (tmax <= walk->next[axis]) {
+		return false;
+	}
+
+	walk->cell[axis] += walk->step[axis];
+	if (walk->cell[axis] == walk->last[axis]) {
+		return false;
+	}
+	walk->next[axis] += walk->delta[axis];
+
+	return true;
+}
+
+ObscuraUniformGrid *
+ObscuraCreateUniformGrid(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraUniformGrid *grid = allocator->allocation(sizeof(ObscuraUniformGrid), 8);
+
+	return grid;
+}
+
+void
+ObscuraDestroyUniformGrid(ObscuraUniformGrid **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	allocator->free((*ptr)->offsets);
+	allocator->free((*ptr)->references);
+	allocator->free(*ptr);
+
+	*ptr = NULL;
+}
+
+void
+ObscuraBuildUniformGrid(ObscuraUniformGrid *grid, ObscuraPrimitive *primitives, uint32_t count,
+	ObscuraAllocationCallbacks *allocator)
+{
+	grid->cells_count = 0;
+	grid->references_count = 0;
+	if (count == 0) {
+		return;
+	}
+
+	vec4 lower = primitives[0].lower;
+	vec4 upper = primitives[0].upper;
+	for (uint32_t i = 1; i < count; i++) {
+		lower = _mm_min_ps(lower, primitives[i].lower);
+		upper = _mm_max_ps(upper, primitives[i].upper);
+	}
+
+	vec4 extent = upper - lower;
+	float longest = fmaxf(fmaxf(extent[0], extent[1]), extent[2]);
+	extent = _mm_max_ps(extent, _mm_set1_ps(fmaxf(longest * 1e-3f, FLT_MIN)));
+
+	float volume = extent[0] * extent[1] * extent[2];
+	float k = cbrtf(GRID_DENSITY * count / volume);
+
+	grid->lower = lower;
+	grid->upper = lower + extent;
+	for (int axis = 0; axis < 3; axis++) {
+		grid->resolution[axis] = clampi((int32_t) (extent[axis] * k), 1, GRID_RESOLUTION_CAPACITY);
+	}
+	grid->lower[3] = 0;
+	grid->upper[3] = 0;
+
+	grid->cell_size = extent / _mm_setr_ps(grid->resolution[0], grid->resolution[1], grid->resolution[2], 1);
+	grid->cell_size[3] = 1;
+	grid->inverse_cell_size = VEC4_ONE / grid->cell_size;
+
+	grid->cells_count = grid->resolution[0] * grid->resolution[1] * grid->resolution[2];
+	if (grid->cells_capacity < grid->cells_count) {
+		allocator->free(grid->offsets);
+
+		grid->cells_capacity = grid->cells_count;
+		grid->offsets = allocator->allocation(sizeof(uint32_t) * (grid->cells_capacity + 1), LEVEL1_DCACHE_LINESIZE);
+	}
+	for (uint32_t i = 0; i <= grid->cells_count; i++) {
+		grid->offsets[i] = 0;
+	}
+
+	/*
+	 * Counting sort of the references by cell: count into the slot past every cell, turn the counts into
+	 * start offsets, then scatter while advancing each start to the end of its cell.
+	 */
+	for (uint32_t i = 0; i < count; i++) {
+		int32_t lo[3];
+		int32_t hi[3];
+		cells(grid, primitives[i].lower, lo);
+		cells(grid, primitives[i].upper, hi);
+
+		for (int32_t z = lo[2]; z <= hi[2]; z++) {
+			for (int32_t y = lo[1]; y <= hi[1]; y++) {
+				for (int32_t x = lo[0]; x <= hi[0]; x++) {
+					grid->offsets[(z * grid->resolution[1] + y) * grid->resolution[0] + x + 1]++;
+				}
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < grid->cells_count; i++) {
+		grid->offsets[i + 1] += grid->offsets[i];
+	}
+
+	grid->references_count = grid->offsets[grid->cells_count];
+	if (grid->references_capacity < grid->references_count) {
+		allocator->free(grid->references);
+
+		grid->references_capacity = grid->references_count;
+		grid->references = allocator->allocation(sizeof(uint32_t) * grid->references_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		int32_t lo[3];
+		int32_t hi[3];
+		cells(grid, primitives[i].lower, lo);
+		cells(grid, primitives[i].upper, hi);
+
+		for (int32_t z = lo[2]; z <= hi[2]; z++) {
+			for (int32_t y = lo[1]; y <= hi[1]; y++) {
+				for (int32_t x = lo[0]; x <= hi[0]; x++) {
+					grid->references[grid->offsets[(z * grid->resolution[1] + y) * grid->resolution[0] + x]++] = i;
+				}
+			}
+		}
+	}
+
+	for (uint32_t i = grid->cells_count; i > 0; i--) {
+		grid->offsets[i] = grid->offsets[i - 1];
+	}
+	grid->offsets[0] = 0;
+}
+
+void
+ObscuraTraverseUniformGrid(ObscuraUniformGrid *grid, ObscuraPrimitive *primitives, vec4 position,
+	ObscuraBoundingVolume *ray, ObscuraVisible *visible)
+{
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+	struct __grid_walk walk;
+	if (!start(grid, position, r, &walk)) {
+		return;
+	}
+
+	uint64_t tests = 0;
+
+	do {
+		uint32_t index = (walk.cell[2] * grid->resolution[1] + walk.cell[1]) * grid->resolution[0] + walk.cell[0];
+
+		for (uint32_t i = grid->offsets[index]; i < grid->offsets[index + 1]; i++) {
+			ObscuraPrimitive *primitive = &primitives[grid->references[i]];
+			tests++;
+
+			ObscuraCollision collision = {};
+			ObscuraCollidesWith(ray, position, primitive->volume, primitive->position, &collision);
+			if (collision.hit) {
+				r->tmax = collision.distance;
+
+				visible->geometry  = primitive->geometry;
+				visible->collision = collision;
+			}
+		}
+	} while (advance(&walk, r->tmax));
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+}
+
+bool
+ObscuraOccludedUniformGrid(ObscuraUniformGrid *grid, ObscuraPrimitive *primitives, vec4 position,
+	ObscuraBoundingVolume *ray)
+{
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+
+	struct __grid_walk walk;
+	if (!start(grid, position, r, &walk)) {
+		return false;
+	}
+
+	bool occluded = false;
+	uint64_t tests = 0;
+
+	do {
+		uint32_t index = (walk.cell[2] * grid->resolution[1] + walk.cell[1]) * grid->resolution[0] + walk.cell[0];
+
+		for (uint32_t i = grid->offsets[index]; i < grid->offsets[index + 1] && !occluded; i++) {
+			ObscuraPrimitive *primitive = &primitives[grid->references[i]];
+			tests++;
+
+			ObscuraCollision collision = {};
+			ObscuraCollidesWith(ray, position, primitive->volume, primitive->position, &collision);
+			occluded = collision.hit;
+		}
+	} while (!occluded && advance(&walk, r->tmax));
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+
+	return occluded;
+}
@@ -0,0 +1,50 @@
+#ifndef __OBSCURA_GRID_H__
+#define __OBSCURA_GRID_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "collision.h"
+#include "memory.h"
+#include "tensor.h"
+#include "visibility.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Uniform grid over the bounds of the scene. Every cell lists the primitives whose box overlaps it: the
+ * references of cell i are references[offsets[i]] up to references[offsets[i + 1]]. Suited to dense sets
+ * of similarly sized primitives, where a hierarchy spends most of its time descending interior nodes.
+ */
+typedef struct ObscuraUniformGrid {
+	vec4	lower;
+	vec4	upper;
+	vec4	cell_size;
+	vec4	inverse_cell_size;
+
+	int32_t	resolution[3];
+
+	uint32_t	 cells_capacity;
+	uint32_t	 cells_count;
+	uint32_t	*offsets;
+
+	uint32_t	 references_capacity;
+	uint32_t	 references_count;
+	uint32_t	*references;
+} ObscuraUniformGrid;
+
+extern ObscuraUniformGrid *	ObscuraCreateUniformGrid	(ObscuraAllocationCallbacks *);
+extern void			ObscuraDestroyUniformGrid	(ObscuraUniformGrid **, ObscuraAllocationCallbacks *);
+
+extern void	ObscuraBuildUniformGrid		(ObscuraUniformGrid *, ObscuraPrimitive *, uint32_t, ObscuraAllocationCallbacks *);
+extern void	ObscuraTraverseUniformGrid	(ObscuraUniformGrid *, ObscuraPrimitive *, vec4, ObscuraBoundingVolume *,
+	ObscuraVisible *);
+extern bool	ObscuraOccludedUniformGrid	(ObscuraUniformGrid *, ObscuraPrimitive *, vec4, ObscuraBoundingVolume *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
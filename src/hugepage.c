@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <linux/mempolicy.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "hugepage.h"
+
+/*
+ * Every allocation is preceded by a header telling whether it was mapped on its own and how large it is;
+ * allocations aligned beyond the header size are padded up to their alignment.
+ */
+#define HUGEPAGE_HEADER_SIZE	16
+
+#define HUGEPAGE_DEFAULT_SIZE	(2 << 20)
+
+/*
+ * Bits of the node masks passed to the memory policy system calls, as many as the kernel supports at most.
+ */
+#define HUGEPAGE_MAX_NODES	1024
+
+struct __hugepage_header {
+	uint64_t	size;
+	uint32_t	offset;
+	uint32_t	mapped;
+};
+
+#define HUGEPAGE_HEADER(ptr)	((struct __hugepage_header *) ((uint8_t *) (ptr) - HUGEPAGE_HEADER_SIZE))
+
+static const char *names[__PAGE_MODE_NUM_ELMS] = {
+	"normal pages",
+	"transparent huge pages",
+	"explicit huge pages",
+};
+
+static ObscuraAllocationCallbacks *upstream = NULL;
+static ObscuraPageMode mode = OBSCURA_PAGE_MODE_NORMAL;
+static size_t huge_size = 0;
+
+static inline size_t
+round_up(size_t size, size_t alignment)
+{
+	return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/*
+ * Maps length bytes aligned to a huge page, so that the kernel is able to back all of it with huge pages.
+ */
+static uint8_t *
+map(size_t length)
+{
+	if (mode == OBSCURA_PAGE_MODE_EXPLICIT) {
+		void *ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			return ptr;
+		}
+
+		/*
+		 * The hugetlb pool ran dry, fall back to transparent huge pages.
+		 */
+	}
+
+	uint8_t *ptr = mmap(NULL, length + huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		return NULL;
+	}
+
+	uint8_t *aligned = (uint8_t *) round_up((uintptr_t) ptr, huge_size);
+	if (aligned > ptr) {
+		munmap(ptr, aligned - ptr);
+	}
+	munmap(aligned + length, ptr + huge_size - aligned);
+
+	madvise(aligned, length, MADV_HUGEPAGE);
+
+	return aligned;
+}
+
+static void *
+allocation(size_t size, size_t alignment)
+{
+	assert(upstream);
+	assert(alignment <= huge_size);
+
+	size_t offset = alignment > HUGEPAGE_HEADER_SIZE ? alignment : HUGEPAGE_HEADER_SIZE;
+
+	uint8_t *base = NULL;
+	bool mapped = false;
+
+	if (mode != OBSCURA_PAGE_MODE_NORMAL && offset + size >= huge_size) {
+		base = map(round_up(offset + size, huge_size));
+		mapped = base != NULL;
+	}
+	if (base == NULL) {
+		base = upstream->allocation(offset + size, offset);
+	}
+
+	uint8_t *ptr = base + offset;
+
+	struct __hugepage_header *header = HUGEPAGE_HEADER(ptr);
+	header->size   = size;
+	header->offset = offset;
+	header->mapped = mapped;
+
+	return ptr;
+}
+
+static void
+release(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	struct __hugepage_header *header = HUGEPAGE_HEADER(ptr);
+	uint8_t *base = (uint8_t *) ptr - header->offset;
+
+	if (header->mapped) {
+		munmap(base, round_up(header->offset + header->size, huge_size));
+	} else {
+		upstream->free(base);
+	}
+}
+
+static void *
+reallocation(void *original, size_t size, size_t alignment)
+{
+	void *ptr = allocation(size, alignment);
+
+	if (original != NULL) {
+		size_t original_size = HUGEPAGE_HEADER(original)->size;
+		memcpy(ptr, original, original_size < size ? original_size : size);
+		release(original);
+	}
+
+	return ptr;
+}
+
+ObscuraAllocationCallbacks ObscuraHugePageAllocationCallbacks = {
+	.allocation   = &allocation,
+	.reallocation = &reallocation,
+	.free         = &release,
+};
+
+/*
+ * Whether the transparent huge page setting in path selects anything else than never (or deny).
+ */
+static bool
+enabled(const char *path)
+{
+	char setting[128] = {};
+
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		return false;
+	}
+	if (fgets(setting, sizeof(setting), file) == NULL) {
+		setting[0] = '\0';
+	}
+	fclose(file);
+
+	return setting[0] != '\0' && strstr(setting, "[never]") == NULL && strstr(setting, "[deny]") == NULL;
+}
+
+size_t
+ObscuraHugePageSize(void)
+{
+	if (huge_size == 0) {
+		huge_size = HUGEPAGE_DEFAULT_SIZE;
+
+		FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+		if (file != NULL) {
+			size_t size = 0;
+			if (fscanf(file, "%zu", &size) == 1 && size > 0 && (size & (size - 1)) == 0) {
+				huge_size = size;
+			}
+			fclose(file);
+		}
+	}
+
+	return huge_size;
+}
+
+/*
+ * Routes the callbacks to allocator and picks the closest page mode to the one requested that the system
+ * provides: explicit huge pages need a non-empty hugetlb pool, transparent ones must not be disabled.
+ */
+ObscuraPageMode
+ObscuraUseHugePages(ObscuraAllocationCallbacks *allocator, ObscuraPageMode requested)
+{
+	upstream = allocator;
+	mode = requested;
+
+	size_t size = ObscuraHugePageSize();
+
+	if (mode == OBSCURA_PAGE_MODE_EXPLICIT) {
+		void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr == MAP_FAILED) {
+			mode = OBSCURA_PAGE_MODE_TRANSPARENT;
+		} else {
+			munmap(ptr, size);
+		}
+	}
+
+	if (mode == OBSCURA_PAGE_MODE_TRANSPARENT && !enabled("/sys/kernel/mm/transparent_hugepage/enabled")) {
+		mode = OBSCURA_PAGE_MODE_NORMAL;
+	}
+
+	return mode;
+}
+
+/*
+ * Asks for the shared memory mapping at ptr to be backed by transparent huge pages, and tells whether they
+ * are enabled for shared memory at all.
+ */
+ObscuraPageMode
+ObscuraAdviseSharedHugePages(void *ptr, size_t size)
+{
+	if (!enabled("/sys/kernel/mm/transparent_hugepage/shmem_enabled") || madvise(ptr, size, MADV_HUGEPAGE) == -1) {
+		return OBSCURA_PAGE_MODE_NORMAL;
+	}
+
+	return OBSCURA_PAGE_MODE_TRANSPARENT;
+}
+
+/*
+ * Spreads the pages of the mapping at ptr round robin over the NUMA nodes the process may allocate from. It
+ * only places pages touched afterwards, hence it is called before anything writes the mapping. Returns the
+ * number of nodes the pages are spread over, or 0 if the kernel refused the policy.
+ */
+uint32_t
+ObscuraInterleavePages(void *ptr, size_t size)
+{
+	unsigned long nodes[HUGEPAGE_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+
+	if (syscall(SYS_get_mempolicy, NULL, nodes, HUGEPAGE_MAX_NODES, NULL, MPOL_F_MEMS_ALLOWED) == -1) {
+		return 0;
+	}
+
+	if (syscall(SYS_mbind, ptr, size, MPOL_INTERLEAVE, nodes, HUGEPAGE_MAX_NODES, 0) == -1) {
+		return 0;
+	}
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < sizeof(nodes) / sizeof(nodes[0]); i++) {
+		count += __builtin_popcountl(nodes[i]);
+	}
+
+	return count;
+}
+
+const char *
+ObscuraPageModeName(ObscuraPageMode page_mode)
+{
+	assert(page_mode < __PAGE_MODE_NUM_ELMS);
+
+	return names[page_mode];
+}
@@ -0,0 +1,37 @@
+#ifndef __OBSCURA_HUGEPAGE_H__
+#define __OBSCURA_HUGEPAGE_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum ObscuraPageMode {
+	OBSCURA_PAGE_MODE_NORMAL,
+	OBSCURA_PAGE_MODE_TRANSPARENT,
+	OBSCURA_PAGE_MODE_EXPLICIT,
+	__PAGE_MODE_NUM_ELMS,
+} ObscuraPageMode;
+
+/*
+ * Allocations of at least a huge page are mapped on their own and backed by huge pages, either transparent
+ * ones requested with madvise or explicit ones from the hugetlb pool; smaller allocations are passed to the
+ * allocator given to ObscuraUseHugePages.
+ */
+extern ObscuraAllocationCallbacks	ObscuraHugePageAllocationCallbacks;
+
+extern ObscuraPageMode	ObscuraUseHugePages		(ObscuraAllocationCallbacks *, ObscuraPageMode);
+extern ObscuraPageMode	ObscuraAdviseSharedHugePages	(void *, size_t);
+extern uint32_t		ObscuraInterleavePages		(void *, size_t);
+extern size_t		ObscuraHugePageSize		(void);
+extern const char *	ObscuraPageModeName		(ObscuraPageMode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
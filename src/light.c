@@ -6,7 +6,7 @@
 ObscuraLight *
 ObscuraCreateLight(ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraLight *light = allocator->allocation(sizeof(ObscuraLight), 8);
+	ObscuraLight *light = allocator->allocation(sizeof(ObscuraLight), 16);
 
 	return light;
 }
@@ -14,29 +14,28 @@ ObscuraCreateLight(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyLight(ObscuraLight **ptr, ObscuraAllocationCallbacks *allocator)
 {
-	allocator->free((*ptr)->source);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
 }
 
 ObscuraLight *
-ObscuraBindSource(ObscuraLight *light, ObscuraLightSourceType type, ObscuraAllocationCallbacks *allocator)
+ObscuraBindSource(ObscuraLight *light, ObscuraLightSourceType type, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	light->type = type;
 
 	switch (light->type) {
 	case OBSCURA_LIGHT_SOURCE_TYPE_AMBIENT:
-		light->source = allocator->allocation(sizeof(ObscuraLightAmbient), 8);
+		light->source.ambient = (ObscuraLightAmbient) {};
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_DIRECTIONAL:
-		light->source = allocator->allocation(sizeof(ObscuraLightDirectional), 8);
+		light->source.directional = (ObscuraLightDirectional) {};
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_POINT:
-		light->source = allocator->allocation(sizeof(ObscuraLightPoint), 8);
+		light->source.point = (ObscuraLightPoint) {};
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_SPOT:
-		light->source = allocator->allocation(sizeof(ObscuraLightSpot), 8);
+		light->source.spot = (ObscuraLightSpot) {};
 		break;
 	default:
 		assert(false);
@@ -15,16 +15,6 @@ typedef enum ObscuraLightSourceType {
 	OBSCURA_LIGHT_SOURCE_TYPE_SPOT,
 } ObscuraLightSourceType;
 
-typedef struct ObscuraLight {
-	ObscuraLightSourceType	 type;
-	void			*source;
-} ObscuraLight;
-
-extern ObscuraLight *	ObscuraCreateLight	(ObscuraAllocationCallbacks *);
-extern void		ObscuraDestroyLight	(ObscuraLight **, ObscuraAllocationCallbacks *);
-
-extern ObscuraLight *	ObscuraBindSource	(ObscuraLight *, ObscuraLightSourceType, ObscuraAllocationCallbacks *);
-
 /*
  * The ambient element declares the parameters required to describe an ambient light source. An
  * ambient light is one that lights everything evenly, regardless of location or orientation.
@@ -71,6 +61,21 @@ typedef struct ObscuraLightSpot {
 	float	falloff_exponent;
 } ObscuraLightSpot;
 
+typedef struct ObscuraLight {
+	ObscuraLightSourceType	type;
+	union {
+		ObscuraLightAmbient	ambient;
+		ObscuraLightDirectional	directional;
+		ObscuraLightPoint	point;
+		ObscuraLightSpot	spot;
+	}			source;
+} ObscuraLight;
+
+extern ObscuraLight *	ObscuraCreateLight	(ObscuraAllocationCallbacks *);
+extern void		ObscuraDestroyLight	(ObscuraLight **, ObscuraAllocationCallbacks *);
+
+extern ObscuraLight *	ObscuraBindSource	(ObscuraLight *, ObscuraLightSourceType, ObscuraAllocationCallbacks *);
+
 #define OBSCURA_LIGHT_ATTENUATION(l, d)	\
 	((l)->constant_attenuation + ((d) * (l)->linear_attenuation) + (((d) * (d)) * (l)->quadratic_attenuation))
 
@@ -24,10 +24,14 @@
 #include <X11/extensions/XShm.h>
 
 #include "camera.h"
+#include "hugepage.h"
 #include "renderer.h"
+#include "slab.h"
 #include "scene.h"
 #include "stat.h"
+#include "steal.h"
 #include "thread.h"
+#include "track.h"
 #include "tensor.h"
 #include "world.h"
 
@@ -47,6 +51,20 @@ sighandler(int signum __attribute__((unused)), siginfo_t *siginfo, void *context
 	_exit(EXIT_FAILURE);
 }
 
+static volatile sig_atomic_t dump_requested = 0;
+
+static void
+dumphandler(int signum __attribute__((unused)))
+{
+	dump_requested = 1;
+}
+
+static void
+dump(void)
+{
+	ObscuraDumpAllocationStats(stderr);
+}
+
 static void
 memfree(void *ptr)
 {
@@ -84,7 +102,7 @@ memrealloc(void *original, size_t size, size_t alignment)
 		ptr = memalloc(size, alignment);
 	} else if (usable_size > size) {
 		ptr = memalloc(size, alignment);
-		memcpy(ptr, original, usable_size);
+		memcpy(ptr, original, size);
 		memfree(original);
 	} else {
 		ptr = realloc(original, size);
@@ -117,6 +135,49 @@ thrnprocs()
 	return workqueue->threads_capacity;
 }
 
+/*
+ * In multi-producer mode, the tasks submitted between two waits form a group, and waiting leaves alone any
+ * task enqueued into the queue by other means.
+ */
+static ObscuraTaskGroup batch = {};
+
+static void
+groupsubmit(PFN_ObscuraTaskFunction start, void *arg)
+{
+	ObscuraEnqueueGroupTask(&batch, start, arg);
+}
+
+static void
+groupwait()
+{
+	ObscuraSubmitTaskGroup(&batch);
+	ObscuraWaitTaskGroup(&batch);
+	ObscuraInitTaskGroup(&batch, workqueue, NULL, NULL);
+}
+
+static ObscuraWorkStealingQueue *stealqueue = NULL;
+
+static void
+stealsubmit(PFN_ObscuraTaskFunction start, void *arg)
+{
+	ObscuraSpawnTask(stealqueue, start, arg);
+}
+
+static void
+stealwait()
+{
+	ObscuraSyncTasks(stealqueue);
+}
+
+/*
+ * The thread waiting for tasks runs them too, one more than the workers.
+ */
+static uint32_t
+stealnprocs()
+{
+	return stealqueue->threads_capacity + 1;
+}
+
 static void
 loop(Display *display, Window window, ObscuraRenderer *renderer)
 {
@@ -205,6 +266,53 @@ loop(Display *display, Window window, ObscuraRenderer *renderer)
 
 			free(str);
 		}
+		if (asprintf(&str, "packets:%ld|lanes/node:%.2f|fallback:%ld",
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET],
+				(double) ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_LANE] /
+					(ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_NODE] ? ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_NODE] : 1),
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_PACKET_FALLBACK]) != -1) {
+			XGCValues gc_values = {
+				.foreground = 0x22ff00,
+			};
+
+			GC gc = XCreateGC(display, window, GCForeground, &gc_values);
+			XDrawString(display, window, gc, 10, 60, str, strlen(str));
+
+			free(str);
+		}
+		if (renderer->mode == OBSCURA_RENDERER_MODE_WAVEFRONT && asprintf(&str,
+				"generate:%ldus|intersect:%ldus|sort:%ldus|shade:%ldus|occlude:%ldus|composite:%ldus",
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_GENERATE] / 1000,
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_INTERSECT] / 1000,
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_SORT] / 1000,
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_SHADE] / 1000,
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_OCCLUDE] / 1000,
+				ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_COMPOSITE] / 1000) != -1) {
+			XGCValues gc_values = {
+				.foreground = 0x22ff00,
+			};
+
+			GC gc = XCreateGC(display, window, GCForeground, &gc_values);
+			XDrawString(display, window, gc, 10, 80, str, strlen(str));
+
+			free(str);
+		}
+		if (renderer->mode == OBSCURA_RENDERER_MODE_RECURSIVE && asprintf(&str, "tiles:%u|imbalance:%.1f%%",
+				renderer->schedule_count, renderer->imbalance * 100) != -1) {
+			XGCValues gc_values = {
+				.foreground = 0x22ff00,
+			};
+
+			GC gc = XCreateGC(display, window, GCForeground, &gc_values);
+			XDrawString(display, window, gc, 10, 80, str, strlen(str));
+
+			free(str);
+		}
+
+		if (dump_requested) {
+			dump_requested = 0;
+			dump();
+		}
 
 		frame_count++;
 
@@ -232,17 +340,70 @@ int main(int argc, char **argv) {
 	uint16_t width  = 1280;
 	uint16_t height = 720;
 
+	ObscuraRendererMode mode = OBSCURA_RENDERER_MODE_RECURSIVE;
+
+	ObscuraPageMode pages = OBSCURA_PAGE_MODE_NORMAL;
+
+	bool steal = false;
+	ObscuraWorkQueueMode queue_mode = OBSCURA_WORK_QUEUE_MODE_SINGLE_PRODUCER;
+
+	bool track = false;
+	bool forbid = false;
+
 	int opt = 0;
-	while ((opt = getopt(argc, argv, "h:w:")) != -1) {
+	while ((opt = getopt(argc, argv, "e:h:m:p:tTw:")) != -1) {
 		switch (opt) {
+		case 'e':
+			if (strcmp(optarg, "queue") == 0) {
+				steal = false;
+				queue_mode = OBSCURA_WORK_QUEUE_MODE_SINGLE_PRODUCER;
+			} else if (strcmp(optarg, "mpmc") == 0) {
+				steal = false;
+				queue_mode = OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER;
+			} else if (strcmp(optarg, "steal") == 0) {
+				steal = true;
+			} else {
+				fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "unknown executor");
+				exit(EXIT_FAILURE);
+			}
+			break;
 		case 'h':
 			height = atoi(optarg);
 			break;
+		case 'm':
+			if (strcmp(optarg, "recursive") == 0) {
+				mode = OBSCURA_RENDERER_MODE_RECURSIVE;
+			} else if (strcmp(optarg, "wavefront") == 0) {
+				mode = OBSCURA_RENDERER_MODE_WAVEFRONT;
+			} else {
+				fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "unknown renderer mode");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'p':
+			if (strcmp(optarg, "normal") == 0) {
+				pages = OBSCURA_PAGE_MODE_NORMAL;
+			} else if (strcmp(optarg, "transparent") == 0) {
+				pages = OBSCURA_PAGE_MODE_TRANSPARENT;
+			} else if (strcmp(optarg, "explicit") == 0) {
+				pages = OBSCURA_PAGE_MODE_EXPLICIT;
+			} else {
+				fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "unknown page mode");
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 't':
+			track = true;
+			break;
+		case 'T':
+			track = true;
+			forbid = true;
+			break;
 		case 'w':
 			width = atoi(optarg);
 			break;
 		default:
-			fprintf(stderr, "Usage: %s [-h height] [-w width]\n", basename(argv[0]));
+			fprintf(stderr, "Usage: %s [-e queue|mpmc|steal] [-h height] [-m recursive|wavefront] [-p normal|transparent|explicit] [-t|-T] [-w width]\n", basename(argv[0]));
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -298,12 +459,42 @@ int main(int argc, char **argv) {
 	XImage *image = NULL;
 	image = XShmCreateImage(display, visual_info->visual, visual_info->depth, ZPixmap, NULL, &shm_info, width, height);
 
+	/*
+	 * The framebuffer is shared with the X server, hence it takes huge pages from shared memory rather than
+	 * from the allocator.
+	 */
+	ObscuraPageMode framebuffer_pages = OBSCURA_PAGE_MODE_NORMAL;
+
 	size_t image_size = image->bytes_per_line * image->height;
-	shm_info.shmid = shmget((key_t) 0, image_size, IPC_CREAT | 0777);
+	size_t segment_size = image_size;
+	shm_info.shmid = -1;
+	if (pages == OBSCURA_PAGE_MODE_EXPLICIT) {
+		size_t huge_size = ObscuraHugePageSize();
+		shm_info.shmid = shmget((key_t) 0, (image_size + huge_size - 1) & ~(huge_size - 1),
+			IPC_CREAT | SHM_HUGETLB | 0777);
+		if (shm_info.shmid != -1) {
+			framebuffer_pages = OBSCURA_PAGE_MODE_EXPLICIT;
+			segment_size = (image_size + huge_size - 1) & ~(huge_size - 1);
+		}
+	}
+	if (shm_info.shmid == -1) {
+		shm_info.shmid = shmget((key_t) 0, image_size, IPC_CREAT | 0777);
+	}
 
 	shm_info.shmaddr = (char *) shmat(shm_info.shmid, 0, 0);
 	image->data = shm_info.shmaddr;
 
+	if (pages != OBSCURA_PAGE_MODE_NORMAL && framebuffer_pages == OBSCURA_PAGE_MODE_NORMAL) {
+		framebuffer_pages = ObscuraAdviseSharedHugePages(shm_info.shmaddr, image_size);
+	}
+
+	/*
+	 * Tiles go to whichever worker takes them next, so rows have no worker of their own to be first touched
+	 * by: the framebuffer pages are spread over the NUMA nodes instead, before the X server or any worker
+	 * writes them.
+	 */
+	uint32_t framebuffer_nodes = ObscuraInterleavePages(shm_info.shmaddr, segment_size);
+
 	XShmAttach(display, &shm_info);
 	XSync(display, False);
 	shmctl(shm_info.shmid, IPC_RMID, 0);
@@ -314,9 +505,52 @@ int main(int argc, char **argv) {
 		.free         = &memfree,
 	};
 
-	ObscuraRenderer *renderer = ObscuraCreateRenderer(&allocator);
-	renderer->world = ObscuraCreateWorld(&allocator);
-	ObscuraLoadWorld(renderer->world, argv[0], &allocator);
+	ObscuraAllocationCallbacks *base = &allocator;
+	if (pages != OBSCURA_PAGE_MODE_NORMAL) {
+		pages = ObscuraUseHugePages(&allocator, pages);
+		base = &ObscuraHugePageAllocationCallbacks;
+	}
+
+	fprintf(stderr, "pages: %s for large allocations, %s for the framebuffer (huge page size %zu KiB)\n",
+		ObscuraPageModeName(pages), ObscuraPageModeName(framebuffer_pages), ObscuraHugePageSize() >> 10);
+	if (framebuffer_nodes > 0) {
+		fprintf(stderr, "numa: framebuffer pages interleaved over %u node(s)\n", framebuffer_nodes);
+	} else {
+		fprintf(stderr, "numa: framebuffer pages placed on first touch, the memory policy was refused\n");
+	}
+
+	/*
+	 * Small objects are served from slabs, anything else from the page allocator picked above.
+	 */
+	ObscuraUseSlabs(base);
+	base = &ObscuraSlabAllocationCallbacks;
+
+	/*
+	 * When tracking, every subsystem allocates through the callbacks of its own tag; the statistics are dumped
+	 * at exit and whenever SIGUSR2 is received.
+	 */
+	ObscuraAllocationCallbacks *allocators[__ALLOCATION_TAG_NUM_ELMS] = {};
+	for (uint32_t i = 0; i < __ALLOCATION_TAG_NUM_ELMS; i++) {
+		allocators[i] = track ? &ObscuraTrackedAllocationCallbacks[i] : base;
+	}
+
+	if (track) {
+		ObscuraTrackAllocations(base, forbid);
+
+		struct sigaction dump_act = {
+			.sa_handler = &dumphandler,
+		};
+
+		if (sigaction(SIGUSR2, &dump_act, NULL) == -1 || atexit(&dump) != 0) {
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ObscuraRenderer *renderer = ObscuraCreateRenderer(allocators[OBSCURA_ALLOCATION_TAG_RENDERER]);
+	renderer->mode = mode;
+	renderer->world = ObscuraCreateWorld(allocators[OBSCURA_ALLOCATION_TAG_SCENE]);
+	ObscuraLoadWorld(renderer->world, argv[0], allocators[OBSCURA_ALLOCATION_TAG_WORLD]);
 
 	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
 	framebuffer->width  = width;
@@ -324,26 +558,49 @@ int main(int argc, char **argv) {
 	framebuffer->image  = image;
 	framebuffer->paint  = &putpixel;
 
-	const uint32_t threads_capacity = get_nprocs();
-	const uint32_t tasks_capacity   = threads_capacity * threads_capacity;
-	workqueue = ObscuraCreateWorkQueue(threads_capacity, tasks_capacity, &ObscuraYieldWait, &allocator);
-
 	ObscuraExecutionCallbacks executor = {
 		.submit = &thrsubmit,
 		.wait   = &thrwait,
 		.nprocs = &thrnprocs,
 	};
 
-	renderer->allocator = &allocator;
+	if (steal) {
+		const uint32_t threads_capacity = get_nprocs() - 1;
+		const uint32_t tasks_capacity   = 1024;
+		stealqueue = ObscuraCreateWorkStealingQueue(threads_capacity, tasks_capacity, &ObscuraParkWait,
+			allocators[OBSCURA_ALLOCATION_TAG_WORK_QUEUE]);
+
+		executor.submit = &stealsubmit;
+		executor.wait   = &stealwait;
+		executor.nprocs = &stealnprocs;
+	} else {
+		const uint32_t threads_capacity = get_nprocs();
+		const uint32_t tasks_capacity   = threads_capacity * threads_capacity;
+		workqueue = ObscuraCreateWorkQueue(threads_capacity, tasks_capacity, &ObscuraParkWait, queue_mode,
+			allocators[OBSCURA_ALLOCATION_TAG_WORK_QUEUE]);
+
+		if (queue_mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+			ObscuraInitTaskGroup(&batch, workqueue, NULL, NULL);
+
+			executor.submit = &groupsubmit;
+			executor.wait   = &groupwait;
+		}
+	}
+
+	renderer->allocator = allocators[OBSCURA_ALLOCATION_TAG_RENDERER];
 	renderer->executor  = &executor;
 
 	loop(display, window, renderer);
 
-	ObscuraDestroyWorkQueue(&workqueue, &allocator);
+	if (steal) {
+		ObscuraDestroyWorkStealingQueue(&stealqueue, allocators[OBSCURA_ALLOCATION_TAG_WORK_QUEUE]);
+	} else {
+		ObscuraDestroyWorkQueue(&workqueue, allocators[OBSCURA_ALLOCATION_TAG_WORK_QUEUE]);
+	}
 
-	ObscuraUnloadWorld(renderer->world, &allocator);
-	ObscuraDestroyWorld(&renderer->world, &allocator);
-	ObscuraDestroyRenderer(&renderer, &allocator);
+	ObscuraUnloadWorld(renderer->world, allocators[OBSCURA_ALLOCATION_TAG_WORLD]);
+	ObscuraDestroyWorld(&renderer->world, allocators[OBSCURA_ALLOCATION_TAG_SCENE]);
+	ObscuraDestroyRenderer(&renderer, allocators[OBSCURA_ALLOCATION_TAG_RENDERER]);
 
 	XShmDetach(display, &shm_info);
 	XFree(framebuffer->image);
@@ -6,7 +6,7 @@
 ObscuraMaterial *
 ObscuraCreateMaterial(ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraMaterial *material = allocator->allocation(sizeof(ObscuraMaterial), 8);
+	ObscuraMaterial *material = allocator->allocation(sizeof(ObscuraMaterial), 16);
 
 	return material;
 }
@@ -14,23 +14,22 @@ ObscuraCreateMaterial(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyMaterial(ObscuraMaterial **ptr, ObscuraAllocationCallbacks *allocator)
 {
-	allocator->free((*ptr)->effect);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
 }
 
 ObscuraMaterial *
-ObscuraBindEffect(ObscuraMaterial *material, ObscuraMaterialEffectType type, ObscuraAllocationCallbacks *allocator)
+ObscuraBindEffect(ObscuraMaterial *material, ObscuraMaterialEffectType type, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	material->type = type;
 
 	switch (material->type) {
 	case OBSCURA_MATERIAL_EFFECT_TYPE_CONSTANT:
-		material->effect = allocator->allocation(sizeof(ObscuraMaterialConstant), 8);
+		material->effect.constant = (ObscuraMaterialConstant) {};
 		break;
 	case OBSCURA_MATERIAL_EFFECT_TYPE_PHONG:
-		material->effect = allocator->allocation(sizeof(ObscuraMaterialPhong), 8);
+		material->effect.phong = (ObscuraMaterialPhong) {};
 		break;
 	default:
 		assert(false);
@@ -48,7 +47,7 @@ ObscuraSurfaceAttrs(ObscuraMaterial *material, vec4 coords)
 	switch (material->type) {
 	case OBSCURA_MATERIAL_EFFECT_TYPE_CONSTANT:
 	{
-		ObscuraMaterialConstant *effect = material->effect;
+		ObscuraMaterialConstant *effect = &material->effect.constant;
 		switch (effect->emission.type) {
 		case OBSCURA_MATERIAL_VALUE_TYPE_COLOR:
 			attrs.emission_color = effect->emission.value.color;
@@ -61,7 +60,7 @@ ObscuraSurfaceAttrs(ObscuraMaterial *material, vec4 coords)
 		break;
 	case OBSCURA_MATERIAL_EFFECT_TYPE_PHONG:
 	{
-		ObscuraMaterialPhong *effect = material->effect;
+		ObscuraMaterialPhong *effect = &material->effect.phong;
 
 		switch (effect->emission.type) {
 		case OBSCURA_MATERIAL_VALUE_TYPE_COLOR:
@@ -13,16 +13,6 @@ typedef enum ObscuraMaterialEffectType {
 	OBSCURA_MATERIAL_EFFECT_TYPE_PHONG,
 } ObscuraMaterialEffectType;
 
-typedef struct ObscuraMaterial {
-	ObscuraMaterialEffectType	 type;
-	void				*effect;
-} ObscuraMaterial;
-
-extern ObscuraMaterial *	ObscuraCreateMaterial	(ObscuraAllocationCallbacks *);
-extern void			ObscuraDestroyMaterial	(ObscuraMaterial **, ObscuraAllocationCallbacks *);
-
-extern ObscuraMaterial *	ObscuraBindEffect	(ObscuraMaterial *, ObscuraMaterialEffectType, ObscuraAllocationCallbacks *);
-
 struct __material_color_or_texture {
 	enum {
 		OBSCURA_MATERIAL_VALUE_TYPE_COLOR,
@@ -33,16 +23,6 @@ struct __material_color_or_texture {
 	}	value;
 };
 
-typedef struct ObscuraSurfaceAttributes {
-	vec4	emission_color;
-	vec4	ambient_color;
-	vec4	diffuse_color;
-	vec4	specular_color;
-	vec4	shininess;
-} ObscuraSurfaceAttributes;
-
-extern ObscuraSurfaceAttributes	ObscuraSurfaceAttrs	(ObscuraMaterial *, vec4);
-
 /*
  * Produces a constantly shaded surface that is independent of lighting.
  */
@@ -72,6 +52,29 @@ typedef struct ObscuraMaterialPhong {
 	float					index_of_refraction;
 } ObscuraMaterialPhong;
 
+typedef struct ObscuraMaterial {
+	ObscuraMaterialEffectType	type;
+	union {
+		ObscuraMaterialConstant	constant;
+		ObscuraMaterialPhong	phong;
+	}				effect;
+} ObscuraMaterial;
+
+extern ObscuraMaterial *	ObscuraCreateMaterial	(ObscuraAllocationCallbacks *);
+extern void			ObscuraDestroyMaterial	(ObscuraMaterial **, ObscuraAllocationCallbacks *);
+
+extern ObscuraMaterial *	ObscuraBindEffect	(ObscuraMaterial *, ObscuraMaterialEffectType, ObscuraAllocationCallbacks *);
+
+typedef struct ObscuraSurfaceAttributes {
+	vec4	emission_color;
+	vec4	ambient_color;
+	vec4	diffuse_color;
+	vec4	specular_color;
+	vec4	shininess;
+} ObscuraSurfaceAttributes;
+
+extern ObscuraSurfaceAttributes	ObscuraSurfaceAttrs	(ObscuraMaterial *, vec4);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "pool.h"
+
+/*
+ * Elements are kept 16 byte aligned so that vector members of any element type stay aligned.
+ */
+#define POOL_ELEMENT_ALIGNMENT	16
+
+static inline uint8_t *
+element(ObscuraPool *pool, uint32_t index)
+{
+	return pool->chunks[index / OBSCURA_POOL_CHUNK_CAPACITY] + (index % OBSCURA_POOL_CHUNK_CAPACITY) * pool->element_size;
+}
+
+static void
+grow(ObscuraPool *pool, ObscuraAllocationCallbacks *allocator)
+{
+	if (pool->chunks_count == pool->chunks_capacity) {
+		uint32_t capacity = pool->chunks_capacity ? pool->chunks_capacity * 2 : 1;
+		uint32_t slots = capacity * OBSCURA_POOL_CHUNK_CAPACITY;
+
+		uint8_t **chunks = allocator->allocation(sizeof(uint8_t *) * capacity, 8);
+		uint8_t *generations = allocator->allocation(sizeof(uint8_t) * slots, LEVEL1_DCACHE_LINESIZE);
+		bool *occupied = allocator->allocation(sizeof(bool) * slots, LEVEL1_DCACHE_LINESIZE);
+		uint32_t *released = allocator->allocation(sizeof(uint32_t) * slots, LEVEL1_DCACHE_LINESIZE);
+
+		if (pool->chunks_capacity > 0) {
+			memcpy(chunks, pool->chunks, sizeof(uint8_t *) * pool->chunks_count);
+			memcpy(generations, pool->generations, sizeof(uint8_t) * pool->slots_count);
+			memcpy(occupied, pool->occupied, sizeof(bool) * pool->slots_count);
+			memcpy(released, pool->released, sizeof(uint32_t) * pool->released_count);
+		}
+
+		allocator->free(pool->chunks);
+		allocator->free(pool->generations);
+		allocator->free(pool->occupied);
+		allocator->free(pool->released);
+
+		pool->chunks_capacity = capacity;
+		pool->chunks      = chunks;
+		pool->generations = generations;
+		pool->occupied    = occupied;
+		pool->released    = released;
+	}
+
+	pool->chunks[pool->chunks_count++] = allocator->allocation(pool->element_size * OBSCURA_POOL_CHUNK_CAPACITY,
+		LEVEL1_DCACHE_LINESIZE);
+}
+
+ObscuraPool *
+ObscuraCreatePool(size_t element_size, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraPool *pool = allocator->allocation(sizeof(ObscuraPool), 8);
+	pool->element_size = (element_size + POOL_ELEMENT_ALIGNMENT - 1) & ~(size_t) (POOL_ELEMENT_ALIGNMENT - 1);
+
+	return pool;
+}
+
+void
+ObscuraDestroyPool(ObscuraPool **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraPool *pool = *ptr;
+
+	for (uint32_t i = 0; i < pool->chunks_count; i++) {
+		allocator->free(pool->chunks[i]);
+	}
+	allocator->free(pool->chunks);
+	allocator->free(pool->generations);
+	allocator->free(pool->occupied);
+	allocator->free(pool->released);
+	allocator->free(pool);
+
+	*ptr = NULL;
+}
+
+/*
+ * Hands out a zeroed element, reusing the most recently released slot if there is one.
+ */
+ObscuraHandle
+ObscuraAcquireElement(ObscuraPool *pool, ObscuraAllocationCallbacks *allocator)
+{
+	uint32_t index = 0;
+
+	if (pool->released_count > 0) {
+		index = pool->released[--pool->released_count];
+	} else {
+		if (pool->slots_count == pool->chunks_count * OBSCURA_POOL_CHUNK_CAPACITY) {
+			grow(pool, allocator);
+		}
+
+		index = pool->slots_count++;
+		pool->generations[index] = 1;
+	}
+	assert(index <= OBSCURA_HANDLE_INDEX(~0u));
+
+	pool->occupied[index] = true;
+	pool->count++;
+
+	memset(element(pool, index), 0, pool->element_size);
+
+	return ((ObscuraHandle) pool->generations[index] << 24) | index;
+}
+
+void
+ObscuraReleaseElement(ObscuraPool *pool, ObscuraHandle handle)
+{
+	if (ObscuraResolveElement(pool, handle) == NULL) {
+		return;
+	}
+
+	uint32_t index = OBSCURA_HANDLE_INDEX(handle);
+
+	pool->occupied[index] = false;
+	pool->count--;
+
+	pool->generations[index]++;
+	if (pool->generations[index] == 0) {
+		pool->generations[index] = 1;
+	}
+
+	pool->released[pool->released_count++] = index;
+}
+
+/*
+ * Returns the element named by handle, or NULL once its slot has been released.
+ */
+void *
+ObscuraResolveElement(ObscuraPool *pool, ObscuraHandle handle)
+{
+	uint32_t index = OBSCURA_HANDLE_INDEX(handle);
+
+	if (index >= pool->slots_count || !pool->occupied[index] ||
+			pool->generations[index] != OBSCURA_HANDLE_GENERATION(handle)) {
+		return NULL;
+	}
+
+	return element(pool, index);
+}
@@ -0,0 +1,61 @@
+#ifndef __OBSCURA_POOL_H__
+#define __OBSCURA_POOL_H__ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A handle names a slot of a pool by its index in the low 24 bits and the generation of the slot in the
+ * high 8 bits. Releasing a slot moves it to the next generation, so handles still naming it are told
+ * apart from the handle of whatever reuses the slot. Generations start at 1, hence no handle is ever 0.
+ */
+typedef uint32_t	ObscuraHandle;
+
+#define OBSCURA_HANDLE_NULL		0
+#define OBSCURA_HANDLE_INDEX(h)		((h) & 0xffffff)
+#define OBSCURA_HANDLE_GENERATION(h)	((h) >> 24)
+
+#define OBSCURA_POOL_CHUNK_CAPACITY	256
+
+/*
+ * Dense storage of equally sized elements. Elements live in cache line aligned chunks of
+ * OBSCURA_POOL_CHUNK_CAPACITY, which never move once allocated: pointers to elements stay valid for as long
+ * as the element is acquired, and iterating slot by slot streams through memory. Released slots are reused
+ * before the pool grows.
+ */
+typedef struct ObscuraPool {
+	size_t	element_size;
+
+	uint32_t	 chunks_capacity;
+	uint32_t	 chunks_count;
+	uint8_t		**chunks;
+
+	uint32_t	 slots_count;
+	uint8_t		*generations;
+	bool		*occupied;
+
+	uint32_t	 released_count;
+	uint32_t	*released;
+
+	uint32_t	count;
+} ObscuraPool;
+
+extern ObscuraPool *	ObscuraCreatePool	(size_t, ObscuraAllocationCallbacks *);
+extern void		ObscuraDestroyPool	(ObscuraPool **, ObscuraAllocationCallbacks *);
+
+extern ObscuraHandle	ObscuraAcquireElement	(ObscuraPool *, ObscuraAllocationCallbacks *);
+extern void		ObscuraReleaseElement	(ObscuraPool *, ObscuraHandle);
+extern void *		ObscuraResolveElement	(ObscuraPool *, ObscuraHandle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
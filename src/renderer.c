@@ -1,79 +1,98 @@
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "acceleration.h"
 #include "camera.h"
 #include "light.h"
 #include "material.h"
 #include "renderer.h"
 #include "shade.h"
+#include "snapshot.h"
 #include "stat.h"
+#include "track.h"
 #include "visibility.h"
 
-static bool
-overcast(ObscuraRenderer *renderer, ObscuraLight *light, vec4 position, vec4 intersect)
+/*
+ * How a light reaches a surface point: unconditionally, not at all, or only if a shadow ray towards it
+ * along direction and up to distance is unobstructed.
+ */
+typedef enum {
+	EXPOSURE_LIT,
+	EXPOSURE_SHADOWED,
+	EXPOSURE_TRACE,
+} exposure_t;
+
+static exposure_t
+expose(ObscuraSnapshotLight *light, vec4 intersect, vec4 normal, vec4 *direction, float *distance)
 {
-	ObscuraScene *scene = renderer->world->scene;
-
-	ObscuraBoundingVolumeRay bounds = {};
-	ObscuraBoundingVolume volume = {
-		.type   = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
-		.volume = &bounds,
-	};
-	ObscuraRendererRay ray = {
-		.type     = OBSCURA_RENDERER_RAY_TYPE_SHADOW,
-		.position = intersect,
-		.volume   = &volume,
-	};
-
-	ObscuraVisible occlusion = {};
+	*direction = VEC4_ZERO;
+	*distance  = INFINITY;
 
 	switch (light->type) {
 	case OBSCURA_LIGHT_SOURCE_TYPE_AMBIENT:
-		break;
+		return EXPOSURE_LIT;
 	case OBSCURA_LIGHT_SOURCE_TYPE_DIRECTIONAL:
-		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_SHADOW], 1);
-
-		bounds.direction = ((ObscuraLightDirectional *) light->source)->direction;
-
-		occlusion = ObscuraTraceRay(scene, ray.position, ray.volume);
+		*direction = light->source.directional.direction;
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_POINT:
-		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_SHADOW], 1);
+	case OBSCURA_LIGHT_SOURCE_TYPE_SPOT:
+		*distance  = vec4_distance(light->position, intersect);
+		*direction = vec4_normalize(light->position - intersect);
+		break;
+	default:
+		assert(false);
+		break;
+	}
 
-		bounds.direction = position - intersect;
-		bounds.direction = vec4_normalize(bounds.direction);
+	/*
+	 * A surface facing away from the light shadows itself, no ray needed.
+	 */
+	if (vec4_dot(normal, *direction) <= 0) {
+		return EXPOSURE_SHADOWED;
+	}
 
-		occlusion = ObscuraTraceRay(scene, ray.position, ray.volume);
-		break;
-	case OBSCURA_LIGHT_SOURCE_TYPE_SPOT:
-		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_SHADOW], 1);
+	return EXPOSURE_TRACE;
+}
+
+static bool
+overcast(ObscuraRenderer *renderer, ObscuraSnapshotLight *light, vec4 intersect, vec4 normal)
+{
+	ObscuraScene *scene = renderer->world->scene;
 
-		occlusion = ObscuraTraceRay(scene, ray.position, ray.volume);
+	vec4 direction = {};
+	float distance = 0;
+
+	switch (expose(light, intersect, normal, &direction, &distance)) {
+	case EXPOSURE_LIT:
+		return false;
+	case EXPOSURE_SHADOWED:
+		return true;
+	case EXPOSURE_TRACE:
 		break;
 	default:
 		assert(false);
 		break;
 	}
 
-	return occlusion.collision.hit;
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_SHADOW], 1);
+
+	return ObscuraOccluded(scene, intersect, direction, OBSCURA_RAY_EPSILON, distance);
 }
 
 static vec4
 shade(ObscuraRenderer *renderer, ObscuraVisible *visible)
 {
-	ObscuraScene *scene = renderer->world->scene;
-	ObscuraNode *view = scene->view;
+	ObscuraSnapshot *snapshot = renderer->world->scene->snapshot;
 
 	vec4 color = { 0, 0, 0, 0 };
-	for (uint32_t i = 0; i < renderer->lights_count; i++) {
-		ObscuraNode *light = renderer->lights[i];
-
-		ObscuraLight *l = ObscuraFindAnyComponent(light, OBSCURA_COMPONENT_FAMILY_LIGHT)->component;
-		if (!overcast(renderer, l, light->position, visible->collision.hit_point)) {
-			color = blend(color, ObscuraShade(visible, light, view));
+	for (uint32_t i = 0; i < snapshot->lights_count; i++) {
+		if (!overcast(renderer, &snapshot->lights[i], visible->collision.hit_point, visible->collision.hit_normal)) {
+			color = blend(color, ObscuraShade(snapshot, visible, i));
 		}
 	}
 
@@ -81,29 +100,21 @@ shade(ObscuraRenderer *renderer, ObscuraVisible *visible)
 }
 
 static vec4
-cast(ObscuraRenderer *renderer, ObscuraRendererRay *ray)
+resolve(ObscuraRenderer *renderer, ObscuraVisible *visible)
 {
-	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_CAMERA], 1);
-
-	ObscuraScene *scene = renderer->world->scene;
-	ObscuraVisible visible = ObscuraTraceRay(scene, ray->position, ray->volume);
-
 	vec4 color = { 0, 0, 1, 0 };
-	if (visible.collision.hit) {
-		ObscuraComponent *component = ObscuraFindAnyComponent(scene->view, OBSCURA_COMPONENT_FAMILY_CAMERA);
-		ObscuraCamera *camera = component->component;
-
-		switch (camera->filter) {
+	if (visible->collision.hit) {
+		switch (renderer->world->scene->snapshot->filter) {
 		case OBSCURA_CAMERA_FILTER_TYPE_COLOR:
-			color = shade(renderer, &visible);
+			color = shade(renderer, visible);
 			break;
 		case OBSCURA_CAMERA_FILTER_TYPE_DEPTH:
-			color[0] = color[1] = color[2] = visible.collision.hit_point[2];
+			color[0] = color[1] = color[2] = visible->collision.hit_point[2];
 			break;
 		case OBSCURA_CAMERA_FILTER_TYPE_NORMAL:
-			color[0] = (visible.collision.hit_normal[0] + 1) * 0.5;
-			color[1] = (visible.collision.hit_normal[1] + 1) * 0.5;
-			color[2] = (visible.collision.hit_normal[2] + 1) * 0.5;
+			color[0] = (visible->collision.hit_normal[0] + 1) * 0.5;
+			color[1] = (visible->collision.hit_normal[1] + 1) * 0.5;
+			color[2] = (visible->collision.hit_normal[2] + 1) * 0.5;
 			break;
 		default:
 			assert(false);
@@ -114,101 +125,510 @@ cast(ObscuraRenderer *renderer, ObscuraRendererRay *ray)
 	return color;
 }
 
-struct partition_info {
-	int	 y0, y1;
+static vec4
+cast(ObscuraRenderer *renderer, ObscuraRendererRay *ray)
+{
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_CAMERA], 1);
+
+	ObscuraScene *scene = renderer->world->scene;
+	ObscuraVisible visible = ObscuraTraceRay(scene, ray->position, ray->volume);
+
+	return resolve(renderer, &visible);
+}
 
+struct render_info {
 	ObscuraRenderer	*renderer;
-};
 
-static void *
-draw(void *arg)
+	/*
+	 * Nanoseconds the worker spent drawing tiles.
+	 */
+	uint64_t	busy;
+} __attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+/*
+ * Direction of the camera ray through the point (x, y) of the framebuffer, in pixels.
+ */
+static vec4
+primary(ObscuraFramebuffer *framebuffer, ObscuraCameraPerspective *projection, mat4 transformation, float x, float y)
 {
-	struct partition_info *info = arg;
+	float pixel_ndc_x = x / framebuffer->width;
+	float pixel_ndc_y = y / framebuffer->height;
 
-	ObscuraRenderer *renderer = info->renderer;
-	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
+	float pixel_screen_x = 2 * pixel_ndc_x - 1;
+	float pixel_screen_y = 1 - 2 * pixel_ndc_y;
+
+	float scale = tanf(DEG2RADF(projection->yfov / 2));
+	float pixel_camera_x = pixel_screen_x * projection->aspect_ratio * scale;
+	float pixel_camera_y = pixel_screen_y * scale;
 
-	ObscuraNode *view = renderer->world->scene->view;
-	ObscuraCamera *camera = ObscuraFindComponent(view, OBSCURA_COMPONENT_FAMILY_CAMERA,
-		OBSCURA_CAMERA_PROJECTION_TYPE_PERSPECTIVE)->component;
-	ObscuraCameraPerspective *projection = camera->projection;
+	vec4 pt = { pixel_camera_x, pixel_camera_y, -1, 0 };
 
-	mat4 transformation = {};
-	mat4_lookat(view->position, view->interest, view->up, transformation);
+	return vec4_normalize(mat4_transform(transformation, pt));
+}
+
+static void
+draw(ObscuraRenderer *renderer, struct __render_tile *tile)
+{
+	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
+
+	ObscuraSnapshot *snapshot = renderer->world->scene->snapshot;
 
-	ObscuraBoundingVolumeRay bounds = {};
 	ObscuraBoundingVolume volume = {
-		.type   = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
-		.volume = &bounds,
+		.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
 	};
+	ObscuraBoundingVolumeRay *bounds = &volume.volume.ray;
 	ObscuraRendererRay ray = {
 		.type     = OBSCURA_RENDERER_RAY_TYPE_CAMERA,
-		.position = view->position,
+		.position = snapshot->eye,
 		.volume   = &volume,
 	};
 
-	for (int y = info->y0; y < info->y1; y++) {
-		for (int x = 0; x < framebuffer->width; x++) {
-			vec4 color = { 0, 0, 0, 0 };
-			switch (camera->anti_aliasing) {
-			case OBSCURA_CAMERA_ANTI_ALIASING_TECHNIQUE_SSAA_STOCHASTIC:
-				for (uint32_t i = 0; i < camera->samples_count; i++) {
-					float pixel_ndc_x = (x + drand48()) / framebuffer->width;
-					float pixel_ndc_y = (y + drand48()) / framebuffer->height;
+	switch (snapshot->anti_aliasing) {
+	case OBSCURA_CAMERA_ANTI_ALIASING_TECHNIQUE_SSAA_STOCHASTIC:
+		for (int y = tile->y0; y < tile->y1; y++) {
+			for (int x = tile->x0; x < tile->x1; x++) {
+				vec4 color = { 0, 0, 0, 0 };
+				for (uint32_t i = 0; i < snapshot->samples_count; i++) {
+					bounds->direction = primary(framebuffer, &snapshot->projection, snapshot->transformation, x + drand48(), y + drand48());
+					bounds->tmin = 0;
+					bounds->tmax = INFINITY;
 
-					float pixel_screen_x = 2 * pixel_ndc_x - 1;
-					float pixel_screen_y = 1 - 2 * pixel_ndc_y;
+					color += cast(renderer, &ray);
+				}
+				color /= (float) snapshot->samples_count;
+
+				framebuffer->paint(framebuffer->image, x, y, COLOR2UINT32(color));
+			}
+		}
+		break;
+	default:
+		{
+			/*
+			 * One sample per pixel: neighbouring pixels are traced together as a packet, two rows high
+			 * and as wide as the packet allows.
+			 */
+			int columns = renderer->packet_width / 2;
+
+			for (int y = tile->y0; y < tile->y1; y += 2) {
+				for (int x = tile->x0; x < tile->x1; x += columns) {
+					ObscuraRayPacket packet = {
+						.width    = renderer->packet_width,
+						.active   = 0,
+						.position = snapshot->eye,
+					};
+
+					for (uint32_t lane = 0; lane < packet.width; lane++) {
+						int px = x + lane % columns;
+						int py = y + lane / columns;
+
+						bounds->direction = primary(framebuffer, &snapshot->projection, snapshot->transformation, px + 0.5f, py + 0.5f);
+						bounds->tmin = 0;
+						bounds->tmax = INFINITY;
+						ObscuraStoreRay(&packet, lane, bounds);
+
+						if (px < tile->x1 && py < tile->y1) {
+							packet.active |= 1 << lane;
+						}
+					}
+
+					__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_CAMERA], __builtin_popcount(packet.active));
+
+					ObscuraVisible visible[OBSCURA_RAY_PACKET_WIDTH] = {};
+					ObscuraTracePacket(renderer->world->scene, &packet, visible);
+
+					for (uint32_t mask = packet.active; mask != 0; mask &= mask - 1) {
+						uint32_t lane = __builtin_ctz(mask);
+
+						vec4 color = resolve(renderer, &visible[lane]);
+						framebuffer->paint(framebuffer->image, x + lane % columns, y + lane / columns, COLOR2UINT32(color));
+					}
+				}
+			}
+		}
+		break;
+	}
+}
 
-					float scale = tanf(DEG2RADF(projection->yfov / 2));
-					float pixel_camera_x = pixel_screen_x * projection->aspect_ratio * scale;
-					float pixel_camera_y = pixel_screen_y * scale;
+static uint64_t
+elapsed(struct timespec *t0)
+{
+	struct timespec t1 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t1);
 
-					vec4 pt = { pixel_camera_x, pixel_camera_y, -1, 1 };
+	return (t1.tv_sec - t0->tv_sec) * 1000000000 + (t1.tv_nsec - t0->tv_nsec);
+}
 
-					bounds.direction = mat4_transform(transformation, pt);
-					bounds.direction = vec4_normalize(bounds.direction);
+/*
+ * Every worker keeps taking the next tile of the schedule until none is left, so that a worker done with
+ * cheap tiles goes on with other ones instead of idling until the end of the frame. Rows thus have no
+ * worker of their own, which is why the framebuffer pages are interleaved over the NUMA nodes up front
+ * rather than placed by the first worker to draw them.
+ */
+static void *
+render(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
 
-					color += cast(renderer, &ray);
-				}
-				color /= (float) camera->samples_count;
-				break;
-			default:
-				{
-					float pixel_ndc_x = (x + 0.5) / framebuffer->width;
-					float pixel_ndc_y = (y + 0.5) / framebuffer->height;
+	struct render_info *info = arg;
+	ObscuraRenderer *renderer = info->renderer;
 
-					float pixel_screen_x = 2 * pixel_ndc_x - 1;
-					float pixel_screen_y = 1 - 2 * pixel_ndc_y;
+	for (;;) {
+		uint32_t t = __atomic_fetch_add(&renderer->schedule_cursor, 1, __ATOMIC_RELAXED);
+		if (t >= renderer->schedule_count) {
+			break;
+		}
 
-					float scale = tanf(DEG2RADF(projection->yfov / 2));
-					float pixel_camera_x = pixel_screen_x * projection->aspect_ratio * scale;
-					float pixel_camera_y = pixel_screen_y * scale;
+		draw(renderer, &renderer->schedule[t]);
+	}
 
-					vec4 pt = { pixel_camera_x, pixel_camera_y, -1, 1 };
+	info->busy = elapsed(&t0);
 
-					bounds.direction = mat4_transform(transformation, pt);
-					bounds.direction = vec4_normalize(bounds.direction);
+	return NULL;
+}
 
-					color = cast(renderer, &ray);
+/*
+ * Lays the tiles covering the framebuffer out in a square spiral starting from the tile at its center;
+ * the schedule only changes with the size of the framebuffer.
+ */
+static void
+spiral(ObscuraRenderer *renderer)
+{
+	ObscuraAllocationCallbacks *allocator = renderer->allocator;
+	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
+
+	if (renderer->schedule != NULL && renderer->schedule_width == framebuffer->width &&
+			renderer->schedule_height == framebuffer->height) {
+		return;
+	}
+
+	int columns = (framebuffer->width + OBSCURA_RENDER_TILE_SIZE - 1) / OBSCURA_RENDER_TILE_SIZE;
+	int rows = (framebuffer->height + OBSCURA_RENDER_TILE_SIZE - 1) / OBSCURA_RENDER_TILE_SIZE;
+	uint32_t tiles_count = columns * rows;
+
+	allocator->free(renderer->schedule);
+	renderer->schedule = allocator->allocation(sizeof(struct __render_tile) * tiles_count, LEVEL1_DCACHE_LINESIZE);
+	renderer->schedule_width  = framebuffer->width;
+	renderer->schedule_height = framebuffer->height;
+	renderer->schedule_count  = 0;
+
+	/*
+	 * Legs of the spiral grow by one every other turn; cells of the spiral outside the grid are skipped.
+	 */
+	int x = (columns - 1) / 2;
+	int y = (rows - 1) / 2;
+	int dx = 1, dy = 0;
+
+	for (int leg = 1; renderer->schedule_count < tiles_count; leg++) {
+		for (int turn = 0; turn < 2; turn++) {
+			for (int step = 0; step < leg; step++) {
+				if (x >= 0 && x < columns && y >= 0 && y < rows) {
+					struct __render_tile *tile = &renderer->schedule[renderer->schedule_count++];
+					tile->x0 = x * OBSCURA_RENDER_TILE_SIZE;
+					tile->y0 = y * OBSCURA_RENDER_TILE_SIZE;
+					tile->x1 = tile->x0 + OBSCURA_RENDER_TILE_SIZE;
+					tile->y1 = tile->y0 + OBSCURA_RENDER_TILE_SIZE;
+					if (tile->x1 > framebuffer->width) {
+						tile->x1 = framebuffer->width;
+					}
+					if (tile->y1 > framebuffer->height) {
+						tile->y1 = framebuffer->height;
+					}
 				}
-				break;
+
+				x += dx;
+				y += dy;
+			}
+
+			int t = dx;
+			dx = -dy;
+			dy = t;
+		}
+	}
+}
+
+static void *
+generate(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraRenderer *renderer = tile->renderer;
+	ObscuraSnapshot *snapshot = renderer->world->scene->snapshot;
+
+	tile->rays_count = 0;
+	for (int y = tile->y0; y < tile->y1; y++) {
+		for (int x = tile->x0; x < tile->x1; x++) {
+			tile->directions[tile->rays_count++] = primary(&renderer->framebuffer, &snapshot->projection, snapshot->transformation,
+				x + 0.5f, y + 0.5f);
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_GENERATE], elapsed(&t0));
+
+	return NULL;
+}
+
+static void *
+intersect(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraScene *scene = tile->renderer->world->scene;
+
+	ObscuraBoundingVolume volume = {
+		.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+	};
+	ObscuraBoundingVolumeRay *bounds = &volume.volume.ray;
+
+	for (uint32_t i = 0; i < tile->rays_count; i++) {
+		bounds->direction = tile->directions[i];
+		bounds->tmin = 0;
+		bounds->tmax = INFINITY;
+
+		tile->hits[i] = ObscuraTraceRay(scene, scene->snapshot->eye, &volume);
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_CAMERA], tile->rays_count);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_INTERSECT], elapsed(&t0));
+
+	return NULL;
+}
+
+/*
+ * Counting sort of the hits by material, misses last, so that shading runs over one material at a time.
+ */
+static void *
+sort(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraSnapshot *snapshot = tile->renderer->world->scene->snapshot;
+
+	uint32_t keys_count = snapshot->surfaces_count + 1;
+	uint32_t offsets[keys_count + 1];
+	for (uint32_t k = 0; k <= keys_count; k++) {
+		offsets[k] = 0;
+	}
+
+	uint32_t keys[tile->rays_count];
+	for (uint32_t i = 0; i < tile->rays_count; i++) {
+		ObscuraVisible *hit = &tile->hits[i];
+		keys[i] = hit->collision.hit ? snapshot->materials[hit->geometry] : snapshot->surfaces_count;
+
+		offsets[keys[i] + 1]++;
+	}
+
+	for (uint32_t k = 0; k < keys_count; k++) {
+		offsets[k + 1] += offsets[k];
+	}
+
+	for (uint32_t i = 0; i < tile->rays_count; i++) {
+		tile->order[offsets[keys[i]]++] = i;
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_SORT], elapsed(&t0));
+
+	return NULL;
+}
+
+/*
+ * Resolves misses and the depth and normal filters right away. With the color filter every light
+ * contributes a color to the hit and, unless it is ambient or behind the surface, a shadow ray that
+ * decides whether the contribution is kept.
+ */
+static void *
+illuminate(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraRenderer *renderer = tile->renderer;
+	ObscuraSnapshot *snapshot = renderer->world->scene->snapshot;
+
+	tile->shadows_count = 0;
+	for (uint32_t k = 0; k < tile->rays_count; k++) {
+		uint32_t i = tile->order[k];
+
+		ObscuraVisible *hit = &tile->hits[i];
+		if (!hit->collision.hit || snapshot->filter != OBSCURA_CAMERA_FILTER_TYPE_COLOR) {
+			tile->colors[i] = resolve(renderer, hit);
+			continue;
+		}
+
+		tile->colors[i] = (vec4) { 0, 0, 0, 0 };
+		for (uint32_t j = 0; j < snapshot->lights_count; j++) {
+			vec4 direction = {};
+			float distance = 0;
+			exposure_t exposure = expose(&snapshot->lights[j], hit->collision.hit_point, hit->collision.hit_normal,
+				&direction, &distance);
+			if (exposure == EXPOSURE_SHADOWED) {
+				continue;
 			}
 
-			framebuffer->paint(framebuffer->image, x, y, COLOR2UINT32(color));
+			assert(tile->shadows_count < tile->shadows_capacity);
+			tile->shadows[tile->shadows_count++] = (struct __wavefront_shadow) {
+				.origin    = hit->collision.hit_point,
+				.direction = direction,
+				.color     = ObscuraShade(snapshot, hit, j),
+				.distance  = distance,
+				.pixel     = i,
+				.trace     = exposure == EXPOSURE_TRACE,
+				.occluded  = false,
+			};
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_SHADE], elapsed(&t0));
+
+	return NULL;
+}
+
+static void *
+occlude(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraScene *scene = tile->renderer->world->scene;
+
+	uint64_t traced = 0;
+	for (uint32_t i = 0; i < tile->shadows_count; i++) {
+		struct __wavefront_shadow *shadow = &tile->shadows[i];
+		if (shadow->trace) {
+			shadow->occluded = ObscuraOccluded(scene, shadow->origin, shadow->direction, OBSCURA_RAY_EPSILON,
+				shadow->distance);
+			traced++;
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_SHADOW], traced);
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_OCCLUDE], elapsed(&t0));
+
+	return NULL;
+}
+
+/*
+ * Blending is not commutative: the contributions of a pixel are applied in light order, which is the
+ * order the shading stage emitted them in.
+ */
+static void *
+composite(void *arg)
+{
+	struct timespec t0 = {};
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	struct __wavefront_tile *tile = arg;
+
+	ObscuraFramebuffer *framebuffer = &tile->renderer->framebuffer;
+
+	for (uint32_t i = 0; i < tile->shadows_count; i++) {
+		struct __wavefront_shadow *shadow = &tile->shadows[i];
+		if (!shadow->occluded) {
+			tile->colors[shadow->pixel] = blend(tile->colors[shadow->pixel], shadow->color);
 		}
 	}
 
+	int columns = tile->x1 - tile->x0;
+	for (uint32_t i = 0; i < tile->rays_count; i++) {
+		framebuffer->paint(framebuffer->image, tile->x0 + i % columns, tile->y0 + i / columns, COLOR2UINT32(tile->colors[i]));
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_STAGE_COMPOSITE], elapsed(&t0));
+
 	return NULL;
 }
 
+/*
+ * Tiles are processed in waves of one tile per processor; every stage of a wave is a task per tile and
+ * the wave waits for all of them before the next stage starts.
+ */
 static void
-enumlights(ObscuraNode *node, void *arg)
+wavefront(ObscuraRenderer *renderer)
 {
-	ObscuraRenderer *renderer = arg;
+	static const PFN_ObscuraTaskFunction stages[] = {
+		&generate,
+		&intersect,
+		&sort,
+		&illuminate,
+		&occlude,
+		&composite,
+	};
+
+	ObscuraAllocationCallbacks *allocator = renderer->allocator;
+	ObscuraExecutionCallbacks *executor = renderer->executor;
+
+	const uint32_t tile_pixels = OBSCURA_WAVEFRONT_TILE_SIZE * OBSCURA_WAVEFRONT_TILE_SIZE;
+
+	if (renderer->tiles == NULL) {
+		renderer->tiles_capacity = executor->nprocs();
+		renderer->tiles = allocator->allocation(sizeof(struct __wavefront_tile) * renderer->tiles_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+
+		for (uint32_t t = 0; t < renderer->tiles_capacity; t++) {
+			struct __wavefront_tile *tile = &renderer->tiles[t];
+			tile->renderer   = renderer;
+			tile->directions = allocator->allocation(sizeof(vec4) * tile_pixels, LEVEL1_DCACHE_LINESIZE);
+			tile->hits       = allocator->allocation(sizeof(ObscuraVisible) * tile_pixels, LEVEL1_DCACHE_LINESIZE);
+			tile->order      = allocator->allocation(sizeof(uint32_t) * tile_pixels, LEVEL1_DCACHE_LINESIZE);
+			tile->colors     = allocator->allocation(sizeof(vec4) * tile_pixels, LEVEL1_DCACHE_LINESIZE);
+		}
+	}
+
+	for (uint32_t t = 0; t < renderer->tiles_capacity; t++) {
+		struct __wavefront_tile *tile = &renderer->tiles[t];
+		if (tile->shadows_capacity < tile_pixels * renderer->world->scene->snapshot->lights_count) {
+			allocator->free(tile->shadows);
 
-	if (ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_LIGHT) != NULL) {
-		uint32_t i = renderer->lights_count++;
-		renderer->lights[i] = node;
+			tile->shadows_capacity = tile_pixels * renderer->world->scene->snapshot->lights_count;
+			tile->shadows = allocator->allocation(sizeof(struct __wavefront_shadow) * tile->shadows_capacity,
+				LEVEL1_DCACHE_LINESIZE);
+		}
+	}
+
+	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
+	int columns = (framebuffer->width + OBSCURA_WAVEFRONT_TILE_SIZE - 1) / OBSCURA_WAVEFRONT_TILE_SIZE;
+	int rows = (framebuffer->height + OBSCURA_WAVEFRONT_TILE_SIZE - 1) / OBSCURA_WAVEFRONT_TILE_SIZE;
+	uint32_t tiles_count = columns * rows;
+
+	for (uint32_t first = 0; first < tiles_count; first += renderer->tiles_capacity) {
+		uint32_t count = tiles_count - first;
+		if (count > renderer->tiles_capacity) {
+			count = renderer->tiles_capacity;
+		}
+
+		for (uint32_t t = 0; t < count; t++) {
+			struct __wavefront_tile *tile = &renderer->tiles[t];
+			tile->x0 = ((first + t) % columns) * OBSCURA_WAVEFRONT_TILE_SIZE;
+			tile->y0 = ((first + t) / columns) * OBSCURA_WAVEFRONT_TILE_SIZE;
+			tile->x1 = tile->x0 + OBSCURA_WAVEFRONT_TILE_SIZE;
+			tile->y1 = tile->y0 + OBSCURA_WAVEFRONT_TILE_SIZE;
+			if (tile->x1 > framebuffer->width) {
+				tile->x1 = framebuffer->width;
+			}
+			if (tile->y1 > framebuffer->height) {
+				tile->y1 = framebuffer->height;
+			}
+		}
+
+		for (size_t s = 0; s < sizeof(stages) / sizeof(stages[0]); s++) {
+			for (uint32_t t = 0; t < count; t++) {
+				executor->submit(stages[s], &renderer->tiles[t]);
+			}
+			executor->wait();
+		}
 	}
 }
 
@@ -244,8 +664,7 @@ ObscuraRenderer *
 ObscuraCreateRenderer(ObscuraAllocationCallbacks *allocator)
 {
 	ObscuraRenderer *renderer = allocator->allocation(sizeof(ObscuraRenderer), 8);
-	renderer->lights_capacity = 64;
-	renderer->lights = allocator->allocation(sizeof(ObscuraNode *) * renderer->lights_capacity, 8);
+	renderer->packet_width = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? 8 : 4;
 
 	return renderer;
 }
@@ -254,7 +673,16 @@ void
 ObscuraDestroyRenderer(ObscuraRenderer **ptr, ObscuraAllocationCallbacks *allocator)
 {
 	ObscuraRenderer *renderer = *ptr;
-	allocator->free(renderer->lights);
+	for (uint32_t t = 0; t < renderer->tiles_capacity; t++) {
+		struct __wavefront_tile *tile = &renderer->tiles[t];
+		allocator->free(tile->directions);
+		allocator->free(tile->hits);
+		allocator->free(tile->order);
+		allocator->free(tile->colors);
+		allocator->free(tile->shadows);
+	}
+	allocator->free(renderer->tiles);
+	allocator->free(renderer->schedule);
 	allocator->free(renderer);
 
 	*ptr = NULL;
@@ -265,22 +693,45 @@ ObscuraDraw(ObscuraRenderer *renderer)
 {
 	explicit_bzero(ObscuraCounters, sizeof(ObscuraPerfCounters));
 
-	renderer->lights_count = 0;
-	ObscuraTraverseScene(renderer->world->scene, &enumlights, renderer);
+	ObscuraEnterHotPath();
 
-	uint32_t partitions_count = renderer->executor->nprocs();
-	struct partition_info partitions[partitions_count];
+	ObscuraScene *scene = renderer->world->scene;
+	ObscuraUpdateTransforms(scene);
+	ObscuraUpdateSnapshot(scene->snapshot);
 
-	ObscuraFramebuffer *framebuffer = &renderer->framebuffer;
-	size_t partition_size = framebuffer->height / partitions_count;
+	if (scene->acceleration != NULL) {
+		ObscuraUpdateAccelerationStructure(scene->acceleration, scene->snapshot, renderer->executor, renderer->allocator);
+	}
+
+	if (renderer->mode == OBSCURA_RENDERER_MODE_WAVEFRONT) {
+		wavefront(renderer);
+		ObscuraLeaveHotPath();
+		return;
+	}
 
-	for (uint32_t i = 0; i < partitions_count; i++) {
-		partitions[i].y0 = i * partition_size;
-		partitions[i].y1 = partitions[i].y0 + partition_size;
-		partitions[i].renderer = renderer;
+	spiral(renderer);
 
-		renderer->executor->submit(&draw, &partitions[i]);
+	uint32_t workers_count = renderer->executor->nprocs();
+	struct render_info workers[workers_count];
+
+	renderer->schedule_cursor = 0;
+	for (uint32_t i = 0; i < workers_count; i++) {
+		workers[i].renderer = renderer;
+		workers[i].busy = 0;
+
+		renderer->executor->submit(&render, &workers[i]);
 	}
 
 	renderer->executor->wait();
+
+	uint64_t busiest = 0, total = 0;
+	for (uint32_t i = 0; i < workers_count; i++) {
+		if (workers[i].busy > busiest) {
+			busiest = workers[i].busy;
+		}
+		total += workers[i].busy;
+	}
+	renderer->imbalance = (total > 0) ? (float) busiest * workers_count / total - 1 : 0;
+
+	ObscuraLeaveHotPath();
 }
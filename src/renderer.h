@@ -1,12 +1,14 @@
 #ifndef __OBSCURA_RENDERER_H__
 #define __OBSCURA_RENDERER_H__ 1
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "collision.h"
 #include "memory.h"
 #include "tensor.h"
 #include "thread.h"
+#include "visibility.h"
 #include "world.h"
 
 #ifdef __cplusplus
@@ -41,6 +43,60 @@ extern void			ObscuraDestroyRendererRay	(ObscuraRendererRay **, ObscuraAllocatio
 
 extern ObscuraRendererRay *	ObscuraBindRay	(ObscuraRendererRay *, ObscuraRendererRayType, ObscuraAllocationCallbacks *);
 
+/*
+ * Recursive rendering follows every camera ray through shading and its shadow rays before starting the
+ * next one. Wavefront rendering advances all rays of a tile one stage at a time instead: generation,
+ * intersection, sorting by material, shading and shadow tracing each run in bulk over their own queue.
+ */
+typedef enum ObscuraRendererMode {
+	OBSCURA_RENDERER_MODE_RECURSIVE,
+	OBSCURA_RENDERER_MODE_WAVEFRONT,
+} ObscuraRendererMode;
+
+#define OBSCURA_WAVEFRONT_TILE_SIZE	32
+
+/*
+ * Recursive rendering hands tiles of this many pixels square out to the workers one at a time, in a spiral
+ * from the center of the image outwards: the tiles likely to be the most expensive go first, and the cheap
+ * ones at the borders fill the gaps at the end of the frame.
+ */
+#define OBSCURA_RENDER_TILE_SIZE	16
+
+struct __render_tile {
+	int	x0, y0, x1, y1;
+};
+
+struct __wavefront_shadow {
+	vec4		origin;
+	vec4		direction;
+	vec4		color;
+	float		distance;
+	uint32_t	pixel;
+	bool		trace;
+	bool		occluded;
+};
+
+/*
+ * Queues of one tile in flight. Camera rays, hits, their material order and the colors are indexed by
+ * pixel within the tile; shadow rays are appended by the shading stage, those of a pixel contiguous and in
+ * light order.
+ */
+struct __wavefront_tile {
+	struct ObscuraRenderer	*renderer;
+
+	int	x0, y0, x1, y1;
+
+	uint32_t	 rays_count;
+	vec4		*directions;
+	ObscuraVisible	*hits;
+	uint32_t	*order;
+	vec4		*colors;
+
+	uint32_t			 shadows_capacity;
+	uint32_t			 shadows_count;
+	struct __wavefront_shadow	*shadows;
+} __attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
 typedef struct ObscuraRenderer {
 	ObscuraAllocationCallbacks	*allocator;
 	ObscuraExecutionCallbacks	*executor;
@@ -49,9 +105,28 @@ typedef struct ObscuraRenderer {
 
 	ObscuraWorld		*world;
 
-	uint32_t	  lights_capacity;
-	uint32_t	  lights_count;
-	ObscuraNode	**lights;
+	/*
+	 * Lanes per primary ray packet: 8 (4x2 pixels) with AVX2, 4 (2x2 pixels) otherwise.
+	 */
+	uint32_t	packet_width;
+
+	ObscuraRendererMode	mode;
+
+	uint32_t		 tiles_capacity;
+	struct __wavefront_tile	*tiles;
+
+	int			 schedule_width;
+	int			 schedule_height;
+	uint32_t		 schedule_count;
+	struct __render_tile	*schedule;
+
+	/*
+	 * How much longer the busiest worker drew than the average one during the last frame, as a fraction
+	 * of the average: zero when the work was perfectly balanced.
+	 */
+	float	imbalance;
+
+	volatile uint32_t	schedule_cursor	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
 } ObscuraRenderer;
 
 extern ObscuraRenderer *	ObscuraCreateRenderer	(ObscuraAllocationCallbacks *);
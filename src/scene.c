@@ -1,12 +1,20 @@
 #include <assert.h>
+#include <math.h>
 #include <stdbool.h>
 
+#include "acceleration.h"
 #include "camera.h"
 #include "collision.h"
 #include "geometry.h"
 #include "light.h"
 #include "material.h"
 #include "scene.h"
+#include "snapshot.h"
+
+/*
+ * Nodes ahead of the current one that flat traversals prefetch.
+ */
+#define SCENE_PREFETCH_DISTANCE	8
 
 static void
 traverse(ObscuraNode *node, PFN_ObscuraSceneVisitorFunction visitor, void *arg)
@@ -19,6 +27,135 @@ traverse(ObscuraNode *node, PFN_ObscuraSceneVisitorFunction visitor, void *arg)
 	visitor(node, arg);
 }
 
+static uint32_t
+count(ObscuraNode *node)
+{
+	uint32_t n = 1;
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		n += count(node->children[i]);
+	}
+
+	return n;
+}
+
+static void
+flatten(ObscuraNode *node, ObscuraNode **order, uint32_t *order_count)
+{
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		flatten(node->children[i], order, order_count);
+	}
+
+	order[(*order_count)++] = node;
+}
+
+/*
+ * Refreshes the world transform of node from its parent, and marks its children for they depend on it.
+ */
+static inline void
+transform(ObscuraNode *node)
+{
+	mat4 local = {
+		{ 1, 0, 0, 0 },
+		{ 0, 1, 0, 0 },
+		{ 0, 0, 1, 0 },
+		{ node->position[0], node->position[1], node->position[2], 1 },
+	};
+
+	if (node->parent != NULL) {
+		mat4_mul(node->parent->transform, local, node->transform);
+	} else {
+		node->transform[0] = local[0];
+		node->transform[1] = local[1];
+		node->transform[2] = local[2];
+		node->transform[3] = local[3];
+	}
+	node->dirty = false;
+
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		node->children[i]->dirty = true;
+	}
+}
+
+/*
+ * Bounds the volume of node, if any, and the bounds of its children, which must be up to date.
+ */
+static inline void
+bound(ObscuraNode *node)
+{
+	vec4 lower = _mm_set1_ps(INFINITY);
+	vec4 upper = _mm_set1_ps(-INFINITY);
+
+	ObscuraComponent *component = ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME);
+	if (component != NULL) {
+		ObscuraBoundingVolume *volume = component->component;
+
+		vec4 extent = VEC4_ZERO;
+		switch (volume->type) {
+		case OBSCURA_BOUNDING_VOLUME_TYPE_AABB:
+			extent = volume->volume.aabb.half_extents;
+			break;
+		case OBSCURA_BOUNDING_VOLUME_TYPE_SPHERE:
+			extent = _mm_set1_ps(volume->volume.sphere.radius);
+			break;
+		default:
+			assert(false);
+			break;
+		}
+		extent[3] = 0;
+
+		vec4 position = ObscuraWorldPosition(node);
+		lower = position - extent;
+		upper = position + extent;
+	}
+
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		lower = _mm_min_ps(lower, node->children[i]->lower);
+		upper = _mm_max_ps(upper, node->children[i]->upper);
+	}
+
+	node->lower = lower;
+	node->upper = upper;
+}
+
+static void
+update(ObscuraNode *node)
+{
+	if (node->dirty) {
+		transform(node);
+	}
+
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		update(node->children[i]);
+	}
+
+	bound(node);
+}
+
+/*
+ * Concrete type the payload of a component is bound to.
+ */
+static uint32_t
+kind(ObscuraComponent *component)
+{
+	switch (component->family) {
+	case OBSCURA_COMPONENT_FAMILY_CAMERA:
+		return ((ObscuraCamera *) component->component)->type;
+	case OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME:
+		return ((ObscuraBoundingVolume *) component->component)->type;
+	case OBSCURA_COMPONENT_FAMILY_GEOMETRY:
+		return ((ObscuraGeometry *) component->component)->type;
+	case OBSCURA_COMPONENT_FAMILY_LIGHT:
+		return ((ObscuraLight *) component->component)->type;
+	case OBSCURA_COMPONENT_FAMILY_MATERIAL:
+		return ((ObscuraMaterial *) component->component)->type;
+	default:
+		assert(false);
+		break;
+	}
+
+	return 0;
+}
+
 ObscuraComponent *
 ObscuraCreateComponent(ObscuraComponentFamily family, ObscuraAllocationCallbacks *allocator)
 {
@@ -63,13 +200,14 @@ ObscuraDestroyComponent(ObscuraComponent **ptr, ObscuraAllocationCallbacks *allo
 ObscuraNode *
 ObscuraCreateNode(ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraNode *node = allocator->allocation(sizeof(ObscuraNode), 8);
+	ObscuraNode *node = allocator->allocation(sizeof(ObscuraNode), __alignof__(ObscuraNode));
+	node->dirty = true;
 
-	node->components_capacity = 64;
-	node->components = allocator->allocation(sizeof(ObscuraComponent *) * node->components_capacity, 8);
+	node->components_capacity = OBSCURA_NODE_INLINE_COMPONENTS;
+	node->components = node->components_storage;
 
-	node->children_capacity = 64;
-	node->children = allocator->allocation(sizeof(ObscuraNode *) * node->children_capacity, 8);
+	node->children_capacity = OBSCURA_NODE_INLINE_CHILDREN;
+	node->children = node->children_storage;
 
 	return node;
 }
@@ -79,17 +217,16 @@ ObscuraDestroyNode(ObscuraNode **ptr, ObscuraAllocationCallbacks *allocator)
 {
 	ObscuraNode *node = *ptr;
 	if (node != NULL) {
-		for (uint32_t i = 0; i < node->components_count; i++) {
-			ObscuraComponent *component = node->components[i];
-			ObscuraDetachComponent(node, component);
-		}
-		allocator->free(node->components);
+		/*
+		 * The components belong to the scene, which may already have destroyed them.
+		 */
+		ObscuraFreeSmallVector(node->components, node->components_storage, allocator);
 
 		for (uint32_t i = 0; i < node->children_count; i++) {
 			ObscuraNode *child = node->children[i];
 			ObscuraDetachChild(node, child);
 		}
-		allocator->free(node->children);
+		ObscuraFreeSmallVector(node->children, node->children_storage, allocator);
 
 		allocator->free(node);
 
@@ -98,66 +235,73 @@ ObscuraDestroyNode(ObscuraNode **ptr, ObscuraAllocationCallbacks *allocator)
 }
 
 ObscuraNode *
-ObscuraAttachComponent(ObscuraNode *node, ObscuraComponent *component)
+ObscuraAttachComponent(ObscuraNode *node, ObscuraComponent *component, ObscuraAllocationCallbacks *allocator)
 {
-	if (node->components_count < node->components_capacity) {
-		node->components[node->components_count] = component;
-		node->components_count++;
-	} else {
-		assert(false);
+	if (node->components_count == node->components_capacity) {
+		node->components = ObscuraGrowSmallVector(node->components, node->components_storage,
+			&node->components_capacity, sizeof(ObscuraComponent *), allocator);
+	}
+
+	if (!ObscuraHasComponent(node, component->family)) {
+		node->families |= 1 << component->family;
+		node->slots[component->family] = node->components_count;
 	}
 
+	node->components[node->components_count] = component;
+	node->components_count++;
+
 	return node;
 }
 
+/*
+ * Points the slot of family back at the first component of that family left on the node, if any.
+ */
+static void
+reslot(ObscuraNode *node, ObscuraComponentFamily family)
+{
+	node->families &= ~(1 << family);
+
+	for (uint32_t i = 0; i < node->components_count; i++) {
+		if (node->components[i]->family == family) {
+			node->families |= 1 << family;
+			node->slots[family] = i;
+			break;
+		}
+	}
+}
+
 void
 ObscuraDetachComponent(ObscuraNode *node, ObscuraComponent *component)
 {
 	for (uint32_t i = 0; i < node->components_count; i++) {
 		if (node->components[i] == component) {
+			ObscuraComponentFamily moved = node->components[node->components_count - 1]->family;
+
 			node->components[i] = node->components[node->components_count - 1];
 			node->components_count--;
+
+			reslot(node, component->family);
+			reslot(node, moved);
 			break;
 		}
 	}
 }
 
+/*
+ * The first component of the family is found through its slot; only nodes carrying several components of
+ * one family fall back to scanning for the requested type.
+ */
 ObscuraComponent *
 ObscuraFindComponent(ObscuraNode *node, uint32_t family, uint32_t type)
 {
-	for (uint32_t i = 0; i < node->components_count; i++) {
+	if (!ObscuraHasComponent(node, family)) {
+		return NULL;
+	}
+
+	for (uint32_t i = node->slots[family]; i < node->components_count; i++) {
 		ObscuraComponent *component = node->components[i];
-		if (component->family == family) {
-			switch (component->family) {
-			case OBSCURA_COMPONENT_FAMILY_CAMERA:
-				if (((ObscuraCamera *) component->component)->type == type) {
-					return component;
-				}
-				break;
-			case OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME:
-				if (((ObscuraBoundingVolume *) component->component)->type == type) {
-					return component;
-				}
-				break;
-			case OBSCURA_COMPONENT_FAMILY_GEOMETRY:
-				if (((ObscuraGeometry *) component->component)->type == type) {
-					return component;
-				}
-				break;
-			case OBSCURA_COMPONENT_FAMILY_LIGHT:
-				if (((ObscuraLight *) component->component)->type == type) {
-					return component;
-				}
-				break;
-			case OBSCURA_COMPONENT_FAMILY_MATERIAL:
-				if (((ObscuraMaterial *) component->component)->type == type) {
-					return component;
-				}
-				break;
-			default:
-				assert(false);
-				break;
-			}
+		if (component->family == family && kind(component) == type) {
+			return component;
 		}
 	}
 
@@ -167,26 +311,27 @@ ObscuraFindComponent(ObscuraNode *node, uint32_t family, uint32_t type)
 ObscuraComponent *
 ObscuraFindAnyComponent(ObscuraNode *node, uint32_t family)
 {
-	for (uint32_t i = 0; i < node->components_count; i++) {
-		ObscuraComponent *component = node->components[i];
-		if (component->family == family) {
-			return component;
-		}
+	if (!ObscuraHasComponent(node, family)) {
+		return NULL;
 	}
 
-	return NULL;
+	return node->components[node->slots[family]];
 }
 
 ObscuraNode *
-ObscuraAttachChild(ObscuraNode *node, ObscuraNode *child)
+ObscuraAttachChild(ObscuraNode *node, ObscuraNode *child, ObscuraAllocationCallbacks *allocator)
 {
-	if (node->children_count < node->children_capacity) {
-		node->children[node->children_count] = child;
-		node->children_count++;
-	} else {
-		assert(false);
+	if (node->children_count == node->children_capacity) {
+		node->children = ObscuraGrowSmallVector(node->children, node->children_storage, &node->children_capacity,
+			sizeof(ObscuraNode *), allocator);
 	}
 
+	node->children[node->children_count] = child;
+	node->children_count++;
+
+	child->parent = node;
+	child->dirty = true;
+
 	return node;
 }
 
@@ -197,33 +342,54 @@ ObscuraDetachChild(ObscuraNode *node, ObscuraNode *child)
 		if (node->children[i] == child) {
 			node->children[i] = node->children[node->children_count - 1];
 			node->children_count--;
+
+			child->parent = NULL;
+			child->dirty = true;
 			break;
 		}
 	}
 }
 
-ObscuraScene *
-ObscuraCreateScene(ObscuraAllocationCallbacks *allocator)
-{
-	ObscuraScene *scene = allocator->allocation(sizeof(ObscuraScene), 8);
 
-	scene->cameras_capacity = 64;
-	scene->cameras = allocator->allocation(sizeof(ObscuraComponent *) * scene->cameras_capacity, 8);
+/*
+ * Family payloads, their bound type inline, follow the component in the same pool element, kept 16 byte
+ * aligned.
+ */
+#define COMPONENT_HEADER_SIZE	((sizeof(ObscuraComponent) + 15) & ~(size_t) 15)
 
-	scene->bounding_volumes_capacity = 64;
-	scene->bounding_volumes = allocator->allocation(sizeof(ObscuraComponent *) * scene->bounding_volumes_capacity, 8);
+static size_t
+payload(ObscuraComponentFamily family)
+{
+	switch (family) {
+	case OBSCURA_COMPONENT_FAMILY_CAMERA:
+		return sizeof(ObscuraCamera);
+	case OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME:
+		return sizeof(ObscuraBoundingVolume);
+	case OBSCURA_COMPONENT_FAMILY_GEOMETRY:
+		return sizeof(ObscuraGeometry);
+	case OBSCURA_COMPONENT_FAMILY_LIGHT:
+		return sizeof(ObscuraLight);
+	case OBSCURA_COMPONENT_FAMILY_MATERIAL:
+		return sizeof(ObscuraMaterial);
+	default:
+		assert(false);
+		break;
+	}
 
-	scene->geometries_capacity = 64;
-	scene->geometries = allocator->allocation(sizeof(ObscuraComponent *) * scene->geometries_capacity, 8);
+	return 0;
+}
 
-	scene->lights_capacity = 64;
-	scene->lights = allocator->allocation(sizeof(ObscuraComponent *) * scene->lights_capacity, 8);
+ObscuraScene *
+ObscuraCreateScene(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraScene *scene = allocator->allocation(sizeof(ObscuraScene), 8);
 
-	scene->materials_capacity = 64;
-	scene->materials = allocator->allocation(sizeof(ObscuraComponent *) * scene->materials_capacity, 8);
+	for (uint32_t family = 0; family < __COMPONENT_FAMILY_NUM_ELMS; family++) {
+		scene->components[family] = ObscuraCreatePool(COMPONENT_HEADER_SIZE + payload(family), allocator);
+	}
 
-	scene->nodes_capacity = 64;
-	scene->nodes = allocator->allocation(sizeof(ObscuraNode *) * scene->nodes_capacity, 8);
+	scene->nodes_capacity = OBSCURA_SCENE_INLINE_NODES;
+	scene->nodes = scene->nodes_storage;
 
 	return scene;
 }
@@ -232,41 +398,24 @@ void
 ObscuraDestroyScene(ObscuraScene **ptr, ObscuraAllocationCallbacks *allocator)
 {
 	if (*ptr != NULL) {
-		for (uint32_t i = 0; i < (*ptr)->cameras_count; i++) {
-			ObscuraComponent *component = (*ptr)->cameras[i];
-			ObscuraDestroyComponent(&component, allocator);
-		}
-		allocator->free((*ptr)->cameras);
-
-		for (uint32_t i = 0; i < (*ptr)->bounding_volumes_count; i++) {
-			ObscuraComponent *component = (*ptr)->bounding_volumes[i];
-			ObscuraDestroyComponent(&component, allocator);
+		for (uint32_t family = 0; family < __COMPONENT_FAMILY_NUM_ELMS; family++) {
+			ObscuraDestroyPool(&(*ptr)->components[family], allocator);
 		}
-		allocator->free((*ptr)->bounding_volumes);
 
-		for (uint32_t i = 0; i < (*ptr)->geometries_count; i++) {
-			ObscuraComponent *component = (*ptr)->geometries[i];
-			ObscuraDestroyComponent(&component, allocator);
-		}
-		allocator->free((*ptr)->geometries);
-
-		for (uint32_t i = 0; i < (*ptr)->lights_count; i++) {
-			ObscuraComponent *component = (*ptr)->lights[i];
-			ObscuraDestroyComponent(&component, allocator);
+		for (uint32_t i = 0; i < (*ptr)->nodes_count; i++) {
+			ObscuraNode *node = (*ptr)->nodes[i];
+			ObscuraDestroyNode(&node, allocator);
 		}
-		allocator->free((*ptr)->lights);
+		ObscuraFreeSmallVector((*ptr)->nodes, (*ptr)->nodes_storage, allocator);
+		allocator->free((*ptr)->order);
 
-		for (uint32_t i = 0; i < (*ptr)->materials_count; i++) {
-			ObscuraComponent *component = (*ptr)->materials[i];
-			ObscuraDestroyComponent(&component, allocator);
+		if ((*ptr)->acceleration != NULL) {
+			ObscuraDestroyAccelerationStructure(&(*ptr)->acceleration, allocator);
 		}
-		allocator->free((*ptr)->materials);
 
-		for (uint32_t i = 0; i < (*ptr)->nodes_count; i++) {
-			ObscuraNode *node = (*ptr)->nodes[i];
-			ObscuraDestroyNode(&node, allocator);
+		if ((*ptr)->snapshot != NULL) {
+			ObscuraDestroySnapshot(&(*ptr)->snapshot, allocator);
 		}
-		allocator->free((*ptr)->nodes);
 
 		allocator->free(*ptr);
 
@@ -277,115 +426,70 @@ ObscuraDestroyScene(ObscuraScene **ptr, ObscuraAllocationCallbacks *allocator)
 ObscuraComponent *
 ObscuraAcquireComponent(ObscuraScene *scene, ObscuraComponentFamily family, ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraComponent *component = ObscuraCreateComponent(family, allocator);
+	ObscuraHandle handle = ObscuraAcquireElement(scene->components[family], allocator);
 
-	switch (family) {
-	case OBSCURA_COMPONENT_FAMILY_CAMERA:
-		if (scene->cameras_count < scene->cameras_capacity) {
-			scene->cameras[scene->cameras_count] = component;
-			scene->cameras_count++;
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME:
-		if (scene->bounding_volumes_count < scene->bounding_volumes_capacity) {
-			scene->bounding_volumes[scene->bounding_volumes_count] = component;
-			scene->bounding_volumes_count++;
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_GEOMETRY:
-		if (scene->geometries_count < scene->geometries_capacity) {
-			scene->geometries[scene->geometries_count] = component;
-			scene->geometries_count++;
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_LIGHT:
-		if (scene->lights_count < scene->lights_capacity) {
-			scene->lights[scene->lights_count] = component;
-			scene->lights_count++;
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_MATERIAL:
-		if (scene->materials_count < scene->materials_capacity) {
-			scene->materials[scene->materials_count] = component;
-			scene->materials_count++;
-		}
-		break;
-	default:
-		assert(false);
-		break;
-	}
+	ObscuraComponent *component = ObscuraResolveElement(scene->components[family], handle);
+	component->family    = family;
+	component->handle    = handle;
+	component->component = (uint8_t *) component + COMPONENT_HEADER_SIZE;
 
 	return component;
 }
 
-void
-ObscuraReleaseComponent(ObscuraScene *scene, ObscuraComponent **ptr, ObscuraAllocationCallbacks *allocator)
+static void
+detach(ObscuraNode *node, void *arg)
 {
-	int family = (*ptr)->family;
+	ObscuraComponent *component = arg;
 
-	switch (family) {
-	case OBSCURA_COMPONENT_FAMILY_CAMERA:
-		for (uint32_t i = 0; i < scene->cameras_count; i++) {
-			if (scene->cameras[i] == *ptr) {
-				ObscuraDestroyComponent(ptr, allocator);
-				scene->cameras[i] = scene->cameras[scene->cameras_count - 1];
-				scene->cameras_count--;
-			}
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME:
-		for (uint32_t i = 0; i < scene->bounding_volumes_count; i++) {
-			if (scene->bounding_volumes[i] == *ptr) {
-				ObscuraDestroyComponent(ptr, allocator);
-				scene->bounding_volumes[i] = scene->bounding_volumes[scene->bounding_volumes_count - 1];
-				scene->bounding_volumes_count--;
-			}
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_GEOMETRY:
-		for (uint32_t i = 0; i < scene->geometries_count; i++) {
-			if (scene->geometries[i] == *ptr) {
-				ObscuraDestroyComponent(ptr, allocator);
-				scene->geometries[i] = scene->geometries[scene->geometries_count - 1];
-				scene->geometries_count--;
-			}
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_LIGHT:
-		for (uint32_t i = 0; i < scene->lights_count; i++) {
-			if (scene->lights[i] == *ptr) {
-				ObscuraDestroyComponent(ptr, allocator);
-				scene->lights[i] = scene->lights[scene->lights_count - 1];
-				scene->lights_count--;
-			}
-		}
-		break;
-	case OBSCURA_COMPONENT_FAMILY_MATERIAL:
-		for (uint32_t i = 0; i < scene->materials_count; i++) {
-			if (scene->materials[i] == *ptr) {
-				ObscuraDestroyComponent(ptr, allocator);
-				scene->materials[i] = scene->materials[scene->materials_count - 1];
-				scene->materials_count--;
-			}
+	for (uint32_t i = node->components_count; i-- > 0;) {
+		if (node->components[i] == component) {
+			ObscuraDetachComponent(node, component);
 		}
-		break;
-	default:
-		assert(false);
-		break;
 	}
 }
 
+/*
+ * The component is detached from every node of the scene carrying it first, since nodes hold it by pointer
+ * and its slot is up for reuse once released. Stale handles, whose component has already been released, are
+ * ignored.
+ */
+void
+ObscuraReleaseComponent(ObscuraScene *scene, ObscuraComponentFamily family, ObscuraHandle handle)
+{
+	ObscuraComponent *component = ObscuraResolveComponent(scene, family, handle);
+	if (component == NULL) {
+		return;
+	}
+
+	for (uint32_t i = 0; i < scene->nodes_count; i++) {
+		traverse(scene->nodes[i], &detach, component);
+	}
+	scene->dirty = true;
+
+	ObscuraReleaseElement(scene->components[family], handle);
+}
+
+ObscuraComponent *
+ObscuraResolveComponent(ObscuraScene *scene, ObscuraComponentFamily family, ObscuraHandle handle)
+{
+	return ObscuraResolveElement(scene->components[family], handle);
+}
+
 ObscuraNode *
 ObscuraAcquireNode(ObscuraScene *scene, ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraNode *node = NULL;
-
-	if (scene->nodes_count < scene->nodes_capacity) {
-		node = ObscuraCreateNode(allocator);
-		scene->nodes[scene->nodes_count] = node;
-		scene->nodes_count++;
+	if (scene->nodes_count == scene->nodes_capacity) {
+		scene->nodes = ObscuraGrowSmallVector(scene->nodes, scene->nodes_storage, &scene->nodes_capacity,
+			sizeof(ObscuraNode *), allocator);
 	}
 
+	ObscuraNode *node = ObscuraCreateNode(allocator);
+	scene->nodes[scene->nodes_count] = node;
+	scene->nodes_count++;
+
+	scene->dirty = true;
+	scene->flattened = false;
+
 	return node;
 }
 
@@ -397,15 +501,108 @@ ObscuraReleaseNode(ObscuraScene *scene, ObscuraNode **ptr, ObscuraAllocationCall
 			ObscuraDestroyNode(ptr, allocator);
 			scene->nodes[i] = scene->nodes[scene->nodes_count - 1];
 			scene->nodes_count--;
+
+			scene->flattened = false;
 		}
 	}
 }
 
 void
-ObscuraTraverseScene(ObscuraScene *scene, PFN_ObscuraSceneVisitorFunction visitor, void *arg)
+ObscuraFlattenScene(ObscuraScene *scene, ObscuraAllocationCallbacks *allocator)
 {
+	uint32_t order_count = 0;
+	for (uint32_t i = 0; i < scene->nodes_count; i++) {
+		order_count += count(scene->nodes[i]);
+	}
+
+	if (scene->order_capacity < order_count) {
+		allocator->free(scene->order);
+
+		scene->order_capacity = order_count;
+		scene->order = allocator->allocation(sizeof(ObscuraNode *) * scene->order_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	scene->order_count = 0;
 	for (uint32_t i = 0; i < scene->nodes_count; i++) {
-		ObscuraNode *node = scene->nodes[i];
-		traverse(node, visitor, arg);
+		flatten(scene->nodes[i], scene->order, &scene->order_count);
+	}
+
+	/*
+	 * Children may have been attached or detached since the last time, and are dirty then.
+	 */
+	scene->dirty = true;
+	scene->flattened = true;
+}
+
+void
+ObscuraMoveNode(ObscuraScene *scene, ObscuraNode *node, vec4 position)
+{
+	node->position = position;
+	node->dirty = true;
+
+	scene->dirty = true;
+}
+
+/*
+ * Visits every node, children before their parent. A scene that was not flattened since its nodes changed
+ * is walked recursively instead.
+ */
+void
+ObscuraTraverseScene(ObscuraScene *scene, PFN_ObscuraSceneVisitorFunction visitor, void *arg)
+{
+	if (!scene->flattened) {
+		for (uint32_t i = 0; i < scene->nodes_count; i++) {
+			ObscuraNode *node = scene->nodes[i];
+			traverse(node, visitor, arg);
+		}
+		return;
+	}
+
+	for (uint32_t i = 0; i < scene->order_count; i++) {
+		if (i + SCENE_PREFETCH_DISTANCE < scene->order_count) {
+			__builtin_prefetch(scene->order[i + SCENE_PREFETCH_DISTANCE]);
+		}
+
+		visitor(scene->order[i], arg);
+	}
+}
+
+/*
+ * Refreshes the world transforms of dirty nodes and of their descendants, then the bounds of every node.
+ * Walking the flat order backwards meets every parent before its children, walking it forwards meets the
+ * children first.
+ */
+void
+ObscuraUpdateTransforms(ObscuraScene *scene)
+{
+	if (!scene->dirty) {
+		return;
+	}
+	scene->dirty = false;
+
+	if (!scene->flattened) {
+		for (uint32_t i = 0; i < scene->nodes_count; i++) {
+			update(scene->nodes[i]);
+		}
+		return;
+	}
+
+	for (uint32_t i = scene->order_count; i-- > 0;) {
+		if (i >= SCENE_PREFETCH_DISTANCE) {
+			__builtin_prefetch(scene->order[i - SCENE_PREFETCH_DISTANCE]);
+		}
+
+		ObscuraNode *node = scene->order[i];
+		if (node->dirty) {
+			transform(node);
+		}
+	}
+
+	for (uint32_t i = 0; i < scene->order_count; i++) {
+		if (i + SCENE_PREFETCH_DISTANCE < scene->order_count) {
+			__builtin_prefetch(scene->order[i + SCENE_PREFETCH_DISTANCE]);
+		}
+
+		bound(scene->order[i]);
 	}
 }
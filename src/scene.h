@@ -1,10 +1,13 @@
 #ifndef __OBSCURA_SCENE_H__
 #define __OBSCURA_SCENE_H__ 1
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "memory.h"
+#include "pool.h"
 #include "tensor.h"
+#include "vector.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,82 +19,138 @@ typedef enum ObscuraComponentFamily {
 	OBSCURA_COMPONENT_FAMILY_GEOMETRY,
 	OBSCURA_COMPONENT_FAMILY_LIGHT,
 	OBSCURA_COMPONENT_FAMILY_MATERIAL,
+
+	__COMPONENT_FAMILY_NUM_ELMS,
 } ObscuraComponentFamily;
 
+/*
+ * Components acquired from a scene carry their handle in the pool of their family; standalone components
+ * have none.
+ */
 typedef struct ObscuraComponent {
 	ObscuraComponentFamily	 family;
+	ObscuraHandle		 handle;
 	void			*component;
 } ObscuraComponent;
 
 extern ObscuraComponent *	ObscuraCreateComponent	(ObscuraComponentFamily, ObscuraAllocationCallbacks *);
 extern void			ObscuraDestroyComponent	(ObscuraComponent **, ObscuraAllocationCallbacks *);
 
+#define OBSCURA_NODE_INLINE_COMPONENTS	4
+#define OBSCURA_NODE_INLINE_CHILDREN	2
+
+/*
+ * Bit f of families is set when the node carries a component of family f; slots[f] is then the index in
+ * components of the first such component. Components and children are small vectors, most nodes never
+ * leave their inline storage.
+ *
+ * Position, interest and up are given in the space of the parent node. transform caches the mapping from the
+ * space of the node to world space; it is refreshed by ObscuraUpdateTransforms for dirty nodes and their
+ * descendants only. Nodes are moved with ObscuraMoveNode, which marks them dirty. lower and upper bound the
+ * volumes of the node and of all its descendants in world space, refreshed along with the transforms; they
+ * are empty, lower above upper, when none of them has a bounding volume.
+ */
 typedef struct ObscuraNode {
 	vec4	position;
 	vec4	interest;
 	vec4	up;
 
+	mat4			 transform;
+	struct ObscuraNode	*parent;
+	bool			 dirty;
+
+	vec4	lower;
+	vec4	upper;
+
+	uint32_t	families;
+	uint32_t	slots[__COMPONENT_FAMILY_NUM_ELMS];
+
 	uint32_t		  components_capacity;
 	uint32_t		  components_count;
 	ObscuraComponent	**components;
+	ObscuraComponent	 *components_storage[OBSCURA_NODE_INLINE_COMPONENTS];
 
 	uint32_t		  children_capacity;
 	uint32_t		  children_count;
-	struct ObscuraNode **children;
+	struct ObscuraNode	**children;
+	struct ObscuraNode	 *children_storage[OBSCURA_NODE_INLINE_CHILDREN];
 } ObscuraNode;
 
 extern ObscuraNode *	ObscuraCreateNode	(ObscuraAllocationCallbacks *);
 extern void		ObscuraDestroyNode	(ObscuraNode **, ObscuraAllocationCallbacks *);
 
-extern ObscuraNode *	ObscuraAttachComponent	(ObscuraNode *, ObscuraComponent *);
+extern ObscuraNode *	ObscuraAttachComponent	(ObscuraNode *, ObscuraComponent *, ObscuraAllocationCallbacks *);
 extern void		ObscuraDetachComponent	(ObscuraNode *, ObscuraComponent *);
 
 extern ObscuraComponent *	ObscuraFindComponent	(ObscuraNode *, uint32_t, uint32_t);
 extern ObscuraComponent *	ObscuraFindAnyComponent	(ObscuraNode *, uint32_t);
 
-extern ObscuraNode *	ObscuraAttachChild	(ObscuraNode *, ObscuraNode *);
-extern void		ObscuraDetachChild	(ObscuraNode *, ObscuraNode *);
-
-typedef struct ObscuraScene {
-	uint32_t		  cameras_capacity;
-	uint32_t		  cameras_count;
-	ObscuraComponent	**cameras;
-
-	uint32_t		  bounding_volumes_capacity;
-	uint32_t		  bounding_volumes_count;
-	ObscuraComponent	**bounding_volumes;
+static inline bool
+ObscuraHasComponent(ObscuraNode *node, uint32_t family)
+{
+	return (node->families & (1 << family)) != 0;
+}
 
-	uint32_t		  geometries_capacity;
-	uint32_t		  geometries_count;
-	ObscuraComponent	**geometries;
+extern ObscuraNode *	ObscuraAttachChild	(ObscuraNode *, ObscuraNode *, ObscuraAllocationCallbacks *);
+extern void		ObscuraDetachChild	(ObscuraNode *, ObscuraNode *);
 
-	uint32_t		  lights_capacity;
-	uint32_t		  lights_count;
-	ObscuraComponent	**lights;
+/*
+ * Position of the node in world space, as of the last ObscuraUpdateTransforms.
+ */
+static inline vec4
+ObscuraWorldPosition(ObscuraNode *node)
+{
+	return _mm_blend_ps(node->transform[3], _mm_setzero_ps(), 0x8);
+}
 
-	uint32_t		  materials_capacity;
-	uint32_t		  materials_count;
-	ObscuraComponent	**materials;
+#define OBSCURA_SCENE_INLINE_NODES	4
+
+/*
+ * Components live in one pool per family, every element holding the component immediately followed by
+ * its family payload (ObscuraCamera, ObscuraLight...).
+ *
+ * order lists every node of the hierarchy depth first, children before their parent, as computed by the
+ * last ObscuraFlattenScene; acquiring or releasing a node invalidates it, and so does attaching or detaching
+ * children, which the scene cannot tell: the scene has to be flattened again after such changes. dirty is set
+ * as long as some node waits for its transform to be refreshed.
+ */
+typedef struct ObscuraScene {
+	ObscuraPool	*components[__COMPONENT_FAMILY_NUM_ELMS];
 
 	uint32_t	  nodes_capacity;
 	uint32_t	  nodes_count;
 	ObscuraNode	**nodes;
+	ObscuraNode	 *nodes_storage[OBSCURA_SCENE_INLINE_NODES];
+
+	bool		  dirty;
+	bool		  flattened;
+	uint32_t	  order_capacity;
+	uint32_t	  order_count;
+	ObscuraNode	**order;
 
 	ObscuraNode	*view;
+
+	struct ObscuraAccelerationStructure	*acceleration;
+	struct ObscuraSnapshot			*snapshot;
 } ObscuraScene;
 
 extern ObscuraScene *	ObscuraCreateScene	(ObscuraAllocationCallbacks *);
 extern void		ObscuraDestroyScene	(ObscuraScene **, ObscuraAllocationCallbacks *);
 
 extern ObscuraComponent *	ObscuraAcquireComponent	(ObscuraScene *, ObscuraComponentFamily, ObscuraAllocationCallbacks *);
-extern void			ObscuraReleaseComponent	(ObscuraScene *, ObscuraComponent **, ObscuraAllocationCallbacks *);
+extern void			ObscuraReleaseComponent	(ObscuraScene *, ObscuraComponentFamily, ObscuraHandle);
+extern ObscuraComponent *	ObscuraResolveComponent	(ObscuraScene *, ObscuraComponentFamily, ObscuraHandle);
 
 extern ObscuraNode *	ObscuraAcquireNode	(ObscuraScene *, ObscuraAllocationCallbacks *);
 extern void		ObscuraReleaseNode	(ObscuraScene *, ObscuraNode **, ObscuraAllocationCallbacks *);
 
 typedef void	(*PFN_ObscuraSceneVisitorFunction)	(ObscuraNode *, void *);
 
+extern void	ObscuraMoveNode		(ObscuraScene *, ObscuraNode *, vec4);
+
+extern void	ObscuraFlattenScene	(ObscuraScene *, ObscuraAllocationCallbacks *);
 extern void	ObscuraTraverseScene	(ObscuraScene *, PFN_ObscuraSceneVisitorFunction, void *);
+extern void	ObscuraUpdateTransforms	(ObscuraScene *);
 
 #ifdef __cplusplus
 }
@@ -4,20 +4,21 @@
 #include "light.h"
 #include "material.h"
 #include "shade.h"
+#include "snapshot.h"
 
 static vec4
-enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, ObscuraLight *light, vec4 position, vec4 eye)
+enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, ObscuraSnapshotLight *light, vec4 eye)
 {
 	vec4 color = {};
 	color = blend(surface.emission_color, surface.ambient_color);
 
 	switch (light->type) {
 	case OBSCURA_LIGHT_SOURCE_TYPE_AMBIENT:
-		color = blend(color, ((ObscuraLightAmbient *) light->source)->color);
+		color = blend(color, light->source.ambient.color);
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_DIRECTIONAL:
 	{
-		ObscuraLightDirectional *directional = light->source;
+		ObscuraLightDirectional *directional = &light->source.directional;
 
 		surface.diffuse_color *= clampf(vec4_dot(normal, directional->direction), 0, 1);
 		color = blend(color, surface.diffuse_color);
@@ -32,9 +33,9 @@ enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, Obscura
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_POINT:
 	{
-		ObscuraLightPoint *point = (ObscuraLightPoint *) light->source;
+		ObscuraLightPoint *point = &light->source.point;
 
-		vec4 direction = vec4_normalize(position - intersect);
+		vec4 direction = vec4_normalize(light->position - intersect);
 		surface.diffuse_color *= clampf(vec4_dot(normal, direction), 0, 1);
 		color = blend(color, surface.diffuse_color);
 
@@ -43,13 +44,13 @@ enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, Obscura
 		surface.specular_color = vec4_pow(surface.specular_color, 1 - surface.shininess);
 		color = blend(color, surface.specular_color);
 
-		float attenuation = OBSCURA_LIGHT_ATTENUATION(point, vec4_distance(intersect, position));
+		float attenuation = OBSCURA_LIGHT_ATTENUATION(point, vec4_distance(intersect, light->position));
 		color = blend(color, point->color / attenuation);
 	}
 		break;
 	case OBSCURA_LIGHT_SOURCE_TYPE_SPOT:
 	{
-		ObscuraLightSpot *spot = ((ObscuraLightSpot *) light->source);
+		ObscuraLightSpot *spot = &light->source.spot;
 
 		surface.diffuse_color *= clampf(vec4_dot(normal, spot->direction), 0, 1);
 		color = blend(color, surface.diffuse_color);
@@ -59,7 +60,7 @@ enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, Obscura
 		surface.specular_color = vec4_pow(surface.specular_color, 1 - surface.shininess);
 		color = blend(color, surface.specular_color);
 
-		float attenuation = OBSCURA_LIGHT_ATTENUATION(spot, vec4_distance(intersect, position));
+		float attenuation = OBSCURA_LIGHT_ATTENUATION(spot, vec4_distance(intersect, light->position));
 		color = blend(color, spot->color / attenuation);
 	}
 		break;
@@ -71,19 +72,15 @@ enlighten(ObscuraSurfaceAttributes surface, vec4 normal, vec4 intersect, Obscura
 	return color;
 }
 
+/*
+ * Color contributed by light to the hit, with the surface attributes its material was resolved into when
+ * the snapshot was compiled.
+ */
 vec4
-ObscuraShade(ObscuraVisible *visible, ObscuraNode *light, ObscuraNode *view)
+ObscuraShade(ObscuraSnapshot *snapshot, ObscuraVisible *visible, uint32_t light)
 {
-	vec4 coords = {};
-	ObscuraSurfaceAttributes surface = {};
+	ObscuraSurfaceAttributes *surface = &snapshot->surfaces[snapshot->materials[visible->geometry]];
 
-	ObscuraMaterial *m = ObscuraFindAnyComponent(visible->geometry, OBSCURA_COMPONENT_FAMILY_MATERIAL)->component;
-	surface = ObscuraSurfaceAttrs(m, coords);
-
-	vec4 color = {};
-	
-	ObscuraLight *l = ObscuraFindAnyComponent(light, OBSCURA_COMPONENT_FAMILY_LIGHT)->component;
-	color = enlighten(surface, visible->collision.hit_normal, visible->collision.hit_point, l, light->position, view->interest);
-
-	return color;
+	return enlighten(*surface, visible->collision.hit_normal, visible->collision.hit_point, &snapshot->lights[light],
+		snapshot->interest);
 }
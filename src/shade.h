@@ -2,6 +2,7 @@
 #define __OBSCURA_SHADE_H__ 1
 
 #include "scene.h"
+#include "snapshot.h"
 #include "tensor.h"
 #include "visibility.h"
 
@@ -9,7 +10,7 @@
 extern "C" {
 #endif
 
-extern vec4	ObscuraShade	(ObscuraVisible *, ObscuraNode *, ObscuraNode *);
+extern vec4	ObscuraShade	(ObscuraSnapshot *, ObscuraVisible *, uint32_t);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,308 @@
+#include <assert.h>
+#include <emmintrin.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+static const uint32_t sizes[OBSCURA_SLAB_CLASSES_COUNT] = {
+	16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512,
+};
+
+struct __slab_object {
+	struct __slab_object	*next;
+};
+
+/*
+ * Shared state of a size class: released objects, and the span objects are carved from once there are
+ * none left.
+ */
+struct __slab_depot {
+	volatile int		 lock;
+	struct __slab_object	*released;
+	uint8_t			*cursor;
+	uint8_t			*limit;
+} __attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+struct __slab_magazine {
+	uint32_t	 count;
+	void		*objects[OBSCURA_SLAB_MAGAZINE_CAPACITY];
+};
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+static uint8_t *region = NULL;
+static volatile size_t region_cursor = 0;
+
+/*
+ * Size class of every span of the region, by span index.
+ */
+static uint8_t spans[OBSCURA_SLAB_REGION_SIZE / OBSCURA_SLAB_SPAN_SIZE];
+
+/*
+ * Smallest class holding n bytes, by (n + 15) / 16.
+ */
+static uint8_t classes[OBSCURA_SLAB_MAX_SIZE / 16 + 1];
+
+static struct __slab_depot depots[OBSCURA_SLAB_CLASSES_COUNT];
+
+static __thread struct __slab_magazine magazines[OBSCURA_SLAB_CLASSES_COUNT];
+static __thread bool registered = false;
+
+static ObscuraAllocationCallbacks *upstream = NULL;
+
+ObscuraAllocationCallbacks ObscuraSlabAllocationCallbacks = {
+	.allocation   = &ObscuraSlabAllocate,
+	.reallocation = &ObscuraSlabReallocate,
+	.free         = &ObscuraSlabFree,
+};
+
+static inline void
+lock(struct __slab_depot *depot)
+{
+	while (__sync_lock_test_and_set(&depot->lock, 1)) {
+		while (depot->lock) {
+			_mm_pause();
+		}
+	}
+}
+
+static inline void
+unlock(struct __slab_depot *depot)
+{
+	__sync_lock_release(&depot->lock);
+}
+
+static void
+drain(struct __slab_depot *depot, struct __slab_magazine *magazine, uint32_t count)
+{
+	lock(depot);
+	while (count-- > 0) {
+		struct __slab_object *object = magazine->objects[--magazine->count];
+		object->next = depot->released;
+		depot->released = object;
+	}
+	unlock(depot);
+}
+
+/*
+ * Gives the magazines of an exiting thread back to the depots.
+ */
+static void
+destructor(void *arg __attribute__((unused)))
+{
+	for (uint32_t c = 0; c < OBSCURA_SLAB_CLASSES_COUNT; c++) {
+		drain(&depots[c], &magazines[c], magazines[c].count);
+	}
+}
+
+/*
+ * Has the magazines of the calling thread drained when it exits.
+ */
+static inline void
+enroll(void)
+{
+	if (!registered) {
+		pthread_setspecific(key, magazines);
+		registered = true;
+	}
+}
+
+static void
+init(void)
+{
+	/*
+	 * Only reserved: pages are backed, zeroed, the first time a span is written to.
+	 */
+	uint8_t *ptr = mmap(NULL, OBSCURA_SLAB_REGION_SIZE + OBSCURA_SLAB_SPAN_SIZE, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (ptr == MAP_FAILED) {
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	/*
+	 * The region, and thus every span, starts at a multiple of the span size, so that an object is as
+	 * aligned as the largest power of two dividing its size, and spans are found by their offset in the
+	 * region.
+	 */
+	uintptr_t mask = OBSCURA_SLAB_SPAN_SIZE - 1;
+	region = (uint8_t *) (((uintptr_t) ptr + mask) & ~mask);
+	if (region > ptr) {
+		munmap(ptr, region - ptr);
+	}
+	munmap(region + OBSCURA_SLAB_REGION_SIZE, ptr + OBSCURA_SLAB_SPAN_SIZE - region);
+
+	uint32_t c = 0;
+	for (uint32_t i = 0; i < sizeof(classes); i++) {
+		while (sizes[c] < i * 16) {
+			c++;
+		}
+		classes[i] = c;
+	}
+
+	pthread_key_create(&key, &destructor);
+}
+
+static inline bool
+owned(void *ptr)
+{
+	return region != NULL && (uint8_t *) ptr >= region && (uint8_t *) ptr < region + OBSCURA_SLAB_REGION_SIZE;
+}
+
+/*
+ * Fills half the magazine, from released objects first and then from the span of the class.
+ */
+static void
+refill(uint32_t c, struct __slab_magazine *magazine)
+{
+	struct __slab_depot *depot = &depots[c];
+
+	lock(depot);
+	while (magazine->count < OBSCURA_SLAB_MAGAZINE_CAPACITY / 2) {
+		if (depot->released != NULL) {
+			magazine->objects[magazine->count++] = depot->released;
+			depot->released = depot->released->next;
+			continue;
+		}
+
+		if (depot->cursor + sizes[c] > depot->limit) {
+			size_t offset = __sync_fetch_and_add(&region_cursor, OBSCURA_SLAB_SPAN_SIZE);
+			if (offset + OBSCURA_SLAB_SPAN_SIZE > OBSCURA_SLAB_REGION_SIZE) {
+				fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, "slab region exhausted");
+				exit(EXIT_FAILURE);
+			}
+
+			spans[offset / OBSCURA_SLAB_SPAN_SIZE] = c;
+			depot->cursor = region + offset;
+			depot->limit  = region + offset + OBSCURA_SLAB_SPAN_SIZE;
+		}
+
+		magazine->objects[magazine->count++] = depot->cursor;
+		depot->cursor += sizes[c];
+	}
+	unlock(depot);
+}
+
+/*
+ * Size class serving size bytes aligned to alignment, or OBSCURA_SLAB_CLASSES_COUNT if none does.
+ */
+static inline uint32_t
+classify(size_t size, size_t alignment)
+{
+	if (size > OBSCURA_SLAB_MAX_SIZE) {
+		return OBSCURA_SLAB_CLASSES_COUNT;
+	}
+
+	uint32_t c = classes[(size + 15) / 16];
+	while (c < OBSCURA_SLAB_CLASSES_COUNT && (sizes[c] & (alignment - 1)) != 0) {
+		c++;
+	}
+
+	return c;
+}
+
+/*
+ * Routes the allocations no size class serves to allocator; must be called before the first allocation.
+ */
+void
+ObscuraUseSlabs(ObscuraAllocationCallbacks *allocator)
+{
+	upstream = allocator;
+}
+
+void *
+ObscuraSlabAllocate(size_t size, size_t alignment)
+{
+	assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+	assert(upstream != NULL);
+
+	pthread_once(&once, &init);
+
+	uint32_t c = classify(size, alignment);
+	if (c == OBSCURA_SLAB_CLASSES_COUNT) {
+		return upstream->allocation(size, alignment);
+	}
+
+	struct __slab_magazine *magazine = &magazines[c];
+	if (magazine->count == 0) {
+		enroll();
+		refill(c, magazine);
+	}
+
+	void *ptr = magazine->objects[--magazine->count];
+	memset(ptr, 0, sizes[c]);
+
+	return ptr;
+}
+
+/*
+ * Keeps the object when its size class still fits; the part past the original size is not zeroed then.
+ * Objects of the upstream allocator stay there unless they shrink enough for a size class, and the same
+ * alignment is expected from one call to the next.
+ */
+void *
+ObscuraSlabReallocate(void *original, size_t size, size_t alignment)
+{
+	if (original == NULL) {
+		return ObscuraSlabAllocate(size, alignment);
+	}
+
+	pthread_once(&once, &init);
+
+	size_t original_size = 0;
+	if (owned(original)) {
+		original_size = sizes[spans[((uint8_t *) original - region) / OBSCURA_SLAB_SPAN_SIZE]];
+		if (size <= original_size && ((uintptr_t) original & (alignment - 1)) == 0) {
+			return original;
+		}
+	} else {
+		if (classify(size, alignment) == OBSCURA_SLAB_CLASSES_COUNT) {
+			return upstream->reallocation(original, size, alignment);
+		}
+
+		/*
+		 * No size class served the original allocation with the same alignment, hence it was larger.
+		 */
+		original_size = size;
+	}
+
+	void *ptr = ObscuraSlabAllocate(size, alignment);
+	memcpy(ptr, original, size < original_size ? size : original_size);
+	ObscuraSlabFree(original);
+
+	return ptr;
+}
+
+void
+ObscuraSlabFree(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	if (!owned(ptr)) {
+		upstream->free(ptr);
+		return;
+	}
+
+	uint32_t c = spans[((uint8_t *) ptr - region) / OBSCURA_SLAB_SPAN_SIZE];
+
+	/*
+	 * Threads that only ever free objects fill their magazines too, and must give them back as well.
+	 */
+	enroll();
+
+	struct __slab_magazine *magazine = &magazines[c];
+	if (magazine->count == OBSCURA_SLAB_MAGAZINE_CAPACITY) {
+		drain(&depots[c], magazine, OBSCURA_SLAB_MAGAZINE_CAPACITY / 2);
+	}
+
+	magazine->objects[magazine->count++] = ptr;
+}
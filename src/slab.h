@@ -0,0 +1,44 @@
+#ifndef __OBSCURA_SLAB_H__
+#define __OBSCURA_SLAB_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Objects up to OBSCURA_SLAB_MAX_SIZE bytes are served from size classes; anything larger, or aligned
+ * beyond what its size class guarantees, is passed to the allocator given to ObscuraUseSlabs.
+ */
+#define OBSCURA_SLAB_MAX_SIZE		512
+#define OBSCURA_SLAB_CLASSES_COUNT	16
+
+#define OBSCURA_SLAB_SPAN_SIZE		(64 << 10)
+#define OBSCURA_SLAB_REGION_SIZE	((size_t) 1 << 30)
+
+#define OBSCURA_SLAB_MAGAZINE_CAPACITY	64
+
+/*
+ * Process wide slab allocator for small objects created and destroyed at high rates. Every thread keeps
+ * a magazine of free objects per size class, so that allocating and freeing only touch thread local
+ * state; magazines are refilled from, and drained into, a shared depot under a per-class lock when they
+ * run empty or full. Objects of a class are carved out of spans of that class, and spans out of one
+ * address range reserved up front, which tells slab objects apart from system allocations when freeing.
+ * Memory is handed out zeroed, and spans are never given back to the system.
+ */
+extern ObscuraAllocationCallbacks	ObscuraSlabAllocationCallbacks;
+
+extern void	ObscuraUseSlabs		(ObscuraAllocationCallbacks *);
+extern void *	ObscuraSlabAllocate	(size_t, size_t);
+extern void *	ObscuraSlabReallocate	(void *, size_t, size_t);
+extern void	ObscuraSlabFree		(void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
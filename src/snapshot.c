@@ -0,0 +1,296 @@
+#include <assert.h>
+#include <stdbool.h>
+
+#include "snapshot.h"
+
+struct __compile_info {
+	ObscuraSnapshot		 *snapshot;
+	ObscuraComponent	**materials;
+};
+
+static void
+count(ObscuraNode *node, void *arg)
+{
+	ObscuraSnapshot *snapshot = arg;
+
+	if (ObscuraHasComponent(node, OBSCURA_COMPONENT_FAMILY_GEOMETRY)) {
+		snapshot->geometries_count++;
+	}
+	if (ObscuraHasComponent(node, OBSCURA_COMPONENT_FAMILY_LIGHT)) {
+		snapshot->lights_count++;
+	}
+	if (node->children_count > 0) {
+		snapshot->groups_count++;
+	}
+}
+
+/*
+ * Numbers geometries the way gather does, children first, and records the range of every node with
+ * children ahead of the ranges of its descendants. Returns the number following the last geometry below
+ * node.
+ */
+static uint32_t
+group(ObscuraSnapshot *snapshot, ObscuraNode *node, uint32_t first)
+{
+	uint32_t slot = UINT32_MAX;
+	if (node->children_count > 0) {
+		slot = snapshot->groups_count++;
+	}
+
+	uint32_t end = first;
+	for (uint32_t i = 0; i < node->children_count; i++) {
+		end = group(snapshot, node->children[i], end);
+	}
+	if (ObscuraHasComponent(node, OBSCURA_COMPONENT_FAMILY_GEOMETRY)) {
+		end++;
+	}
+
+	if (slot != UINT32_MAX) {
+		snapshot->groups[slot].first = first;
+		snapshot->groups[slot].end   = end;
+		snapshot->group_nodes[slot]  = node;
+	}
+
+	return end;
+}
+
+static void
+gather(ObscuraNode *node, void *arg)
+{
+	struct __compile_info *info = arg;
+	ObscuraSnapshot *snapshot = info->snapshot;
+
+	if (ObscuraHasComponent(node, OBSCURA_COMPONENT_FAMILY_GEOMETRY)) {
+		ObscuraComponent *volume = ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME);
+		assert(volume);
+		ObscuraComponent *material = ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_MATERIAL);
+		assert(material);
+
+		/*
+		 * Geometries sharing a material component share its identifier.
+		 */
+		uint32_t m = 0;
+		while (m < snapshot->surfaces_count && info->materials[m] != material) {
+			m++;
+		}
+		if (m == snapshot->surfaces_count) {
+			info->materials[snapshot->surfaces_count++] = material;
+			snapshot->surfaces[m] = ObscuraSurfaceAttrs(material->component, VEC4_ZERO);
+		}
+
+		uint32_t i = snapshot->geometries_count++;
+		snapshot->geometry_nodes[i] = node;
+		snapshot->volumes[i]        = volume->component;
+		snapshot->materials[i]      = m;
+	}
+
+	ObscuraComponent *light = ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_LIGHT);
+	if (light != NULL) {
+		uint32_t i = snapshot->lights_count++;
+		snapshot->light_nodes[i]      = node;
+		snapshot->light_components[i] = light->component;
+	}
+}
+
+/*
+ * Maps v, a point (w = 1) or a direction (w = 0) given in the space of the parent of node, to world space.
+ */
+static vec4
+world(ObscuraNode *node, vec4 v, float w)
+{
+	if (node->parent == NULL) {
+		return v;
+	}
+
+	vec4 u = v;
+	u[3] = w;
+	u = mat4_transform(node->parent->transform, u);
+	u[3] = v[3];
+
+	return u;
+}
+
+ObscuraSnapshot *
+ObscuraCreateSnapshot(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraSnapshot *snapshot = allocator->allocation(sizeof(ObscuraSnapshot), LEVEL1_DCACHE_LINESIZE);
+
+	return snapshot;
+}
+
+void
+ObscuraDestroySnapshot(ObscuraSnapshot **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraSnapshot *snapshot = *ptr;
+
+	allocator->free(snapshot->positions);
+	allocator->free(snapshot->volumes);
+	allocator->free(snapshot->materials);
+	allocator->free(snapshot->geometry_nodes);
+	allocator->free(snapshot->surfaces);
+	allocator->free(snapshot->groups);
+	allocator->free(snapshot->group_nodes);
+	allocator->free(snapshot->lights);
+	allocator->free(snapshot->light_nodes);
+	allocator->free(snapshot->light_components);
+	allocator->free(snapshot);
+
+	*ptr = NULL;
+}
+
+void
+ObscuraCompileSnapshot(ObscuraSnapshot *snapshot, ObscuraScene *scene, ObscuraAllocationCallbacks *allocator)
+{
+	snapshot->geometries_count = 0;
+	snapshot->groups_count = 0;
+	snapshot->lights_count = 0;
+	ObscuraTraverseScene(scene, &count, snapshot);
+
+	if (snapshot->geometries_capacity < snapshot->geometries_count) {
+		allocator->free(snapshot->positions);
+		allocator->free(snapshot->volumes);
+		allocator->free(snapshot->materials);
+		allocator->free(snapshot->geometry_nodes);
+		allocator->free(snapshot->surfaces);
+
+		snapshot->geometries_capacity = snapshot->geometries_count;
+		snapshot->positions      = allocator->allocation(sizeof(vec4) * snapshot->geometries_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+		snapshot->volumes        = allocator->allocation(sizeof(ObscuraBoundingVolume *) * snapshot->geometries_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+		snapshot->materials      = allocator->allocation(sizeof(uint32_t) * snapshot->geometries_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+		snapshot->geometry_nodes = allocator->allocation(sizeof(ObscuraNode *) * snapshot->geometries_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+
+		/*
+		 * There are never more distinct materials than geometries.
+		 */
+		snapshot->surfaces_capacity = snapshot->geometries_capacity;
+		snapshot->surfaces = allocator->allocation(sizeof(ObscuraSurfaceAttributes) * snapshot->surfaces_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+	}
+
+	if (snapshot->groups_capacity < snapshot->groups_count) {
+		allocator->free(snapshot->groups);
+		allocator->free(snapshot->group_nodes);
+
+		snapshot->groups_capacity = snapshot->groups_count;
+		snapshot->groups      = allocator->allocation(sizeof(ObscuraSnapshotGroup) * snapshot->groups_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+		snapshot->group_nodes = allocator->allocation(sizeof(ObscuraNode *) * snapshot->groups_capacity, 8);
+	}
+
+	if (snapshot->lights_capacity < snapshot->lights_count) {
+		allocator->free(snapshot->lights);
+		allocator->free(snapshot->light_nodes);
+		allocator->free(snapshot->light_components);
+
+		snapshot->lights_capacity = snapshot->lights_count;
+		snapshot->lights           = allocator->allocation(sizeof(ObscuraSnapshotLight) * snapshot->lights_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+		snapshot->light_nodes      = allocator->allocation(sizeof(ObscuraNode *) * snapshot->lights_capacity, 8);
+		snapshot->light_components = allocator->allocation(sizeof(ObscuraLight *) * snapshot->lights_capacity, 8);
+	}
+
+	struct __compile_info info = {
+		.snapshot  = snapshot,
+		.materials = allocator->allocation(sizeof(ObscuraComponent *) * (snapshot->geometries_count + 1), 8),
+	};
+
+	snapshot->geometries_count = 0;
+	snapshot->surfaces_count = 0;
+	snapshot->lights_count = 0;
+	ObscuraTraverseScene(scene, &gather, &info);
+
+	allocator->free(info.materials);
+
+	snapshot->groups_count = 0;
+	uint32_t end = 0;
+	for (uint32_t i = 0; i < scene->nodes_count; i++) {
+		end = group(snapshot, scene->nodes[i], end);
+	}
+	assert(end == snapshot->geometries_count);
+
+	/*
+	 * Groups of a single geometry cost a test without saving any.
+	 */
+	uint32_t groups_count = 0;
+	for (uint32_t i = 0; i < snapshot->groups_count; i++) {
+		if (snapshot->groups[i].end - snapshot->groups[i].first >= 2) {
+			snapshot->groups[groups_count]      = snapshot->groups[i];
+			snapshot->group_nodes[groups_count] = snapshot->group_nodes[i];
+			groups_count++;
+		}
+	}
+	snapshot->groups_count = groups_count;
+
+	snapshot->view = scene->view;
+	assert(snapshot->view);
+	snapshot->camera = ObscuraFindComponent(snapshot->view, OBSCURA_COMPONENT_FAMILY_CAMERA,
+		OBSCURA_CAMERA_PROJECTION_TYPE_PERSPECTIVE)->component;
+
+	ObscuraUpdateSnapshot(snapshot);
+}
+
+/*
+ * Copies the state that may change from one frame to the next: where the nodes are, the parameters of the
+ * light sources and the camera.
+ */
+void
+ObscuraUpdateSnapshot(ObscuraSnapshot *snapshot)
+{
+	for (uint32_t i = 0; i < snapshot->geometries_count; i++) {
+		snapshot->positions[i] = ObscuraWorldPosition(snapshot->geometry_nodes[i]);
+	}
+
+	for (uint32_t i = 0; i < snapshot->groups_count; i++) {
+		snapshot->groups[i].lower = snapshot->group_nodes[i]->lower;
+		snapshot->groups[i].upper = snapshot->group_nodes[i]->upper;
+	}
+
+	for (uint32_t i = 0; i < snapshot->lights_count; i++) {
+		ObscuraSnapshotLight *light = &snapshot->lights[i];
+		ObscuraLight *component = snapshot->light_components[i];
+
+		light->position = ObscuraWorldPosition(snapshot->light_nodes[i]);
+		light->type = component->type;
+
+		switch (component->type) {
+		case OBSCURA_LIGHT_SOURCE_TYPE_AMBIENT:
+			light->source.ambient = component->source.ambient;
+			break;
+		case OBSCURA_LIGHT_SOURCE_TYPE_DIRECTIONAL:
+			light->source.directional = component->source.directional;
+			break;
+		case OBSCURA_LIGHT_SOURCE_TYPE_POINT:
+			light->source.point = component->source.point;
+			break;
+		case OBSCURA_LIGHT_SOURCE_TYPE_SPOT:
+			light->source.spot = component->source.spot;
+			break;
+		default:
+			assert(false);
+			break;
+		}
+	}
+
+	ObscuraNode *view = snapshot->view;
+	ObscuraCamera *camera = snapshot->camera;
+
+	snapshot->eye      = ObscuraWorldPosition(view);
+	snapshot->interest = world(view, view->interest, 1);
+
+	/*
+	 * The look-at matrix maps world space to camera space; rays are generated in camera space and need
+	 * the opposite mapping.
+	 */
+	mat4 lookat = {};
+	mat4_lookat(snapshot->eye, snapshot->interest, world(view, view->up, 0), lookat);
+	mat4_inverse(lookat, snapshot->transformation);
+
+	snapshot->projection    = camera->projection.perspective;
+	snapshot->filter        = camera->filter;
+	snapshot->anti_aliasing = camera->anti_aliasing;
+	snapshot->samples_count = camera->samples_count;
+}
@@ -0,0 +1,144 @@
+#ifndef __OBSCURA_SNAPSHOT_H__
+#define __OBSCURA_SNAPSHOT_H__ 1
+
+#include <stdint.h>
+
+#include "camera.h"
+#include "collision.h"
+#include "light.h"
+#include "material.h"
+#include "memory.h"
+#include "scene.h"
+#include "tensor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Light source copied out of its component, together with the position of the node carrying it.
+ */
+typedef struct ObscuraSnapshotLight {
+	vec4	position;
+
+	ObscuraLightSourceType	type;
+	union {
+		ObscuraLightAmbient	ambient;
+		ObscuraLightDirectional	directional;
+		ObscuraLightPoint	point;
+		ObscuraLightSpot	spot;
+	}	source;
+} ObscuraSnapshotLight;
+
+/*
+ * Geometries first to end - 1 all descend from one node with children, and lie within the box bounding its
+ * subtree.
+ */
+typedef struct ObscuraSnapshotGroup {
+	vec4		lower;
+	vec4		upper;
+	uint32_t	first;
+	uint32_t	end;
+} ObscuraSnapshotGroup;
+
+/*
+ * Flat copy of everything the renderer reads from a scene while drawing. Geometries, materials and lights
+ * are numbered by 32-bit identifiers and stored in contiguous arrays: geometry i sits at positions[i],
+ * is bounded by volumes[i] and shaded with surfaces[materials[i]]. Materials are resolved into surface
+ * attributes once, when the snapshot is compiled; positions, light sources and the camera are refreshed
+ * from their nodes every frame. A snapshot has to be compiled again whenever nodes or components are added
+ * to or removed from the scene.
+ *
+ * Geometries are numbered children first, so the geometries below a node are numbered consecutively. Every
+ * node with children spanning at least two geometries makes a group; groups are sorted by their first
+ * geometry, enclosing groups ahead of those they enclose, and their boxes are refreshed every frame.
+ */
+typedef struct ObscuraSnapshot {
+	uint32_t		  geometries_capacity;
+	uint32_t		  geometries_count;
+	vec4			 *positions;
+	ObscuraBoundingVolume	**volumes;
+	uint32_t		 *materials;
+	ObscuraNode		**geometry_nodes;
+
+	uint32_t			 surfaces_capacity;
+	uint32_t			 surfaces_count;
+	ObscuraSurfaceAttributes	*surfaces;
+
+	uint32_t		  groups_capacity;
+	uint32_t		  groups_count;
+	ObscuraSnapshotGroup	 *groups;
+	ObscuraNode		**group_nodes;
+
+	uint32_t		  lights_capacity;
+	uint32_t		  lights_count;
+	ObscuraSnapshotLight	 *lights;
+	ObscuraNode		**light_nodes;
+	ObscuraLight		**light_components;
+
+	/*
+	 * The camera of the view node; transformation maps camera space to world space.
+	 */
+	vec4	eye;
+	vec4	interest;
+	mat4	transformation;
+
+	ObscuraCameraPerspective		projection;
+	ObscuraCameraFilterType			filter;
+	ObscuraCameraAntiAliasingTechnique	anti_aliasing;
+	uint32_t				samples_count;
+
+	ObscuraNode	*view;
+	ObscuraCamera	*camera;
+} ObscuraSnapshot;
+
+extern ObscuraSnapshot *	ObscuraCreateSnapshot	(ObscuraAllocationCallbacks *);
+extern void			ObscuraDestroySnapshot	(ObscuraSnapshot **, ObscuraAllocationCallbacks *);
+
+extern void	ObscuraCompileSnapshot	(ObscuraSnapshot *, ObscuraScene *, ObscuraAllocationCallbacks *);
+extern void	ObscuraUpdateSnapshot	(ObscuraSnapshot *);
+
+/*
+ * Steps through the geometries a ray may hit, skipping the whole groups whose box it misses: returns the
+ * next run [*first, *end) of geometries to test, or false once there are none left. cursor and group start
+ * at zero; tmax may shrink between calls as hits are found.
+ */
+static inline bool
+ObscuraNextSnapshotRun(ObscuraSnapshot *snapshot, vec4 origin, vec4 inverse, float tmin, float tmax, uint32_t *cursor,
+	uint32_t *group, uint32_t *first, uint32_t *end)
+{
+	uint32_t i = *cursor;
+	uint32_t g = *group;
+
+	while (i < snapshot->geometries_count) {
+		while (g < snapshot->groups_count && snapshot->groups[g].first < i) {
+			g++;
+		}
+
+		if (g < snapshot->groups_count && snapshot->groups[g].first == i) {
+			ObscuraSnapshotGroup *entry = &snapshot->groups[g];
+			if (ObscuraSlabTest(entry->lower, entry->upper, origin, inverse, tmin, tmax) >= tmax) {
+				i = entry->end;
+			}
+			g++;
+			continue;
+		}
+
+		*first = i;
+		*end = (g < snapshot->groups_count) ? snapshot->groups[g].first : snapshot->geometries_count;
+
+		*cursor = *end;
+		*group = g;
+		return true;
+	}
+
+	*cursor = i;
+	*group = g;
+	return false;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
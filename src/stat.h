@@ -15,6 +15,21 @@ typedef enum ObscuraPerfCounterType {
 
 	OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT,
 
+	OBSCURA_COUNTER_TYPE_PACKET,
+	OBSCURA_COUNTER_TYPE_PACKET_NODE,
+	OBSCURA_COUNTER_TYPE_PACKET_LANE,
+	OBSCURA_COUNTER_TYPE_PACKET_FALLBACK,
+
+	/*
+	 * Nanoseconds spent in every stage of the wavefront pipeline, summed over its tasks.
+	 */
+	OBSCURA_COUNTER_TYPE_STAGE_GENERATE,
+	OBSCURA_COUNTER_TYPE_STAGE_INTERSECT,
+	OBSCURA_COUNTER_TYPE_STAGE_SORT,
+	OBSCURA_COUNTER_TYPE_STAGE_SHADE,
+	OBSCURA_COUNTER_TYPE_STAGE_OCCLUDE,
+	OBSCURA_COUNTER_TYPE_STAGE_COMPOSITE,
+
 	__COUNTER_TYPE_NUM_ELMS,
 } ObscuraPerfCounterType;
 
@@ -0,0 +1,291 @@
+#include <assert.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "steal.h"
+
+/*
+ * Worker of the calling thread, NULL outside of the worker threads and the thread owning the queue.
+ */
+static __thread struct __steal_worker *self = NULL;
+
+static bool
+push(struct __steal_deque *deque, struct __steal_task *task)
+{
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	if (b - t >= deque->tasks_capacity) {
+		return false;
+	}
+
+	deque->tasks[b & (deque->tasks_capacity - 1)] = *task;
+	__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static bool
+pop(struct __steal_deque *deque, struct __steal_task *task)
+{
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	__atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	if (t > b) {
+		__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	*task = deque->tasks[b & (deque->tasks_capacity - 1)];
+	if (t < b) {
+		return true;
+	}
+
+	/*
+	 * The last task left: stealers may be after it too, whoever moves the top first takes it.
+	 */
+	bool taken = __atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+
+	return taken;
+}
+
+static bool
+steal(struct __steal_deque *deque, struct __steal_task *task)
+{
+	int64_t t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	int64_t b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	if (t >= b) {
+		return false;
+	}
+
+	/*
+	 * The slot may be overwritten once another thread moved the top past it, in which case the copy is
+	 * thrown away.
+	 */
+	*task = deque->tasks[t & (deque->tasks_capacity - 1)];
+
+	return __atomic_compare_exchange_n(&deque->top, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t
+xorshift(uint32_t *seed)
+{
+	uint32_t x = *seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+
+	return x;
+}
+
+static void join(struct __steal_worker *, volatile uint32_t *);
+
+/*
+ * Waits for every task spawned from the task being run to finish before reporting it done, so that no task
+ * outlives the scope counter of its parent.
+ */
+static void
+run(struct __steal_worker *worker, struct __steal_task *task)
+{
+	volatile uint32_t scope = 0;
+
+	volatile uint32_t *parent = worker->scope;
+	worker->scope = &scope;
+
+	task->func(task->arg);
+	join(worker, &scope);
+
+	worker->scope = parent;
+
+	__atomic_fetch_sub(task->scope, 1, __ATOMIC_RELEASE);
+	ObscuraNotifyWaiters();
+}
+
+/*
+ * Runs a task from the deque of worker or, failing that, one stolen from the other deques starting at one
+ * picked at random. Returns false if none was found.
+ */
+static bool
+work(struct __steal_worker *worker)
+{
+	ObscuraWorkStealingQueue *wq = worker->wq;
+
+	struct __steal_task task = {};
+	if (pop(&worker->deque, &task)) {
+		run(worker, &task);
+		return true;
+	}
+
+	uint32_t count = wq->threads_capacity + 1;
+	uint32_t first = xorshift(&worker->seed) % count;
+	for (uint32_t i = 0; i < count; i++) {
+		struct __steal_worker *victim = &wq->workers[(first + i) % count];
+		if (victim != worker && steal(&victim->deque, &task)) {
+			run(worker, &task);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Runs tasks until the counter of scope drops to zero.
+ */
+static void
+join(struct __steal_worker *worker, volatile uint32_t *scope)
+{
+	while (__atomic_load_n(scope, __ATOMIC_ACQUIRE) > 0) {
+		if (!work(worker)) {
+			worker->wq->wait_strategy();
+		}
+	}
+}
+
+static void *
+start_routine(void *arg)
+{
+	struct __steal_worker *worker = arg;
+	ObscuraWorkStealingQueue *wq = worker->wq;
+
+	self = worker;
+
+	while (__atomic_load_n(&wq->running, __ATOMIC_ACQUIRE)) {
+		if (!work(worker)) {
+			wq->wait_strategy();
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Starts threads_capacity workers, each with a deque of tasks_capacity tasks (a power of two). A task
+ * spawned onto a full deque is run right away instead.
+ */
+ObscuraWorkStealingQueue *
+ObscuraCreateWorkStealingQueue(uint32_t threads_capacity, uint32_t tasks_capacity,
+	PFN_ObscuraWaitStrategy wait_strategy, ObscuraAllocationCallbacks *allocator)
+{
+	assert((tasks_capacity != 0) && ((tasks_capacity & (tasks_capacity - 1)) == 0));
+
+	ObscuraWorkStealingQueue *wq = allocator->allocation(sizeof(ObscuraWorkStealingQueue), LEVEL1_DCACHE_LINESIZE);
+
+	wq->threads_capacity = threads_capacity;
+	wq->workers = allocator->allocation(sizeof(struct __steal_worker) * (threads_capacity + 1),
+		LEVEL1_DCACHE_LINESIZE);
+
+	wq->wait_strategy = wait_strategy;
+	wq->running = true;
+
+	for (uint32_t i = 0; i <= threads_capacity; i++) {
+		struct __steal_worker *worker = &wq->workers[i];
+		worker->wq   = wq;
+		worker->seed = 2654435761u * (i + 1);
+
+		worker->deque.tasks_capacity = tasks_capacity;
+		worker->deque.tasks = allocator->allocation(sizeof(struct __steal_task) * tasks_capacity,
+			LEVEL1_DCACHE_LINESIZE);
+	}
+
+	/*
+	 * The last deque belongs to the calling thread.
+	 */
+	struct __steal_worker *owner = &wq->workers[threads_capacity];
+	owner->thread = pthread_self();
+	owner->scope  = &wq->pending;
+	self = owner;
+
+	for (uint32_t i = 0; i < threads_capacity; i++) {
+		struct __steal_worker *worker = &wq->workers[i];
+
+		if (pthread_create(&worker->thread, NULL, &start_routine, worker)) {
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		ObscuraPinThread(worker->thread, i);
+	}
+
+	return wq;
+}
+
+void
+ObscuraDestroyWorkStealingQueue(ObscuraWorkStealingQueue **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraWorkStealingQueue *wq = *ptr;
+
+	ObscuraSyncTasks(wq);
+	__atomic_store_n(&wq->running, false, __ATOMIC_RELEASE);
+	ObscuraNotifyWaiters();
+
+	for (uint32_t i = 0; i < wq->threads_capacity; i++) {
+		pthread_join(wq->workers[i].thread, NULL);
+	}
+
+	if (self == &wq->workers[wq->threads_capacity]) {
+		self = NULL;
+	}
+
+	for (uint32_t i = 0; i <= wq->threads_capacity; i++) {
+		allocator->free(wq->workers[i].deque.tasks);
+	}
+	allocator->free(wq->workers);
+	allocator->free(wq);
+
+	*ptr = NULL;
+}
+
+/*
+ * Pushes the task onto the deque of the calling thread. Threads that are neither workers of wq nor the one
+ * that created it own no deque, and run the task right away.
+ */
+void
+ObscuraSpawnTask(ObscuraWorkStealingQueue *wq, PFN_ObscuraTaskFunction fn, void *arg)
+{
+	struct __steal_worker *worker = self;
+	if (worker == NULL || worker->wq != wq) {
+		fn(arg);
+		return;
+	}
+
+	struct __steal_task task = {
+		.func  = fn,
+		.arg   = arg,
+		.scope = worker->scope,
+	};
+
+	__atomic_fetch_add(task.scope, 1, __ATOMIC_RELAXED);
+
+	if (!push(&worker->deque, &task)) {
+		run(worker, &task);
+		return;
+	}
+
+	ObscuraNotifyWaiters();
+}
+
+/*
+ * Waits for the tasks spawned by the calling thread, from within the task it runs if it is a worker, and
+ * runs pending tasks meanwhile.
+ */
+void
+ObscuraSyncTasks(ObscuraWorkStealingQueue *wq)
+{
+	struct __steal_worker *worker = self;
+	if (worker == NULL || worker->wq != wq) {
+		return;
+	}
+
+	join(worker, worker->scope);
+}
@@ -0,0 +1,80 @@
+#ifndef __OBSCURA_STEAL_H__
+#define __OBSCURA_STEAL_H__ 1
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+#include "thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A spawned task remembers the counter of the scope it was spawned in, decremented once it ran.
+ */
+struct __steal_task {
+	PFN_ObscuraTaskFunction	 func;
+	void			*arg;
+	volatile uint32_t	*scope;
+};
+
+/*
+ * Chase-Lev deque: its owner pushes and pops tasks at the bottom, any other thread steals them from the
+ * top. Only stealers contend for the top, and the owner only when a single task is left.
+ */
+struct __steal_deque {
+	volatile int64_t	top	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+	volatile int64_t	bottom	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+	uint32_t		 tasks_capacity;
+	struct __steal_task	*tasks;
+};
+
+struct __steal_worker {
+	struct __steal_deque	deque;
+
+	struct ObscuraWorkStealingQueue	*wq;
+	pthread_t			 thread;
+
+	/*
+	 * Counter of the tasks spawned by the task the worker runs, and not finished yet.
+	 */
+	volatile uint32_t	*scope;
+	uint32_t		 seed;
+} __attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+/*
+ * Every worker thread owns a deque; the thread creating the queue owns one more, where the tasks it spawns
+ * land. Idle workers steal from deques picked at random, and a thread waiting for its tasks runs other
+ * tasks meanwhile, so tasks may spawn and wait for tasks of their own.
+ */
+typedef struct ObscuraWorkStealingQueue {
+	uint32_t		 threads_capacity;
+	struct __steal_worker	*workers;
+
+	PFN_ObscuraWaitStrategy	wait_strategy;
+
+	/*
+	 * Counter of the tasks spawned by the thread owning the queue, and not finished yet.
+	 */
+	volatile uint32_t	pending	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+	volatile bool	running;
+} ObscuraWorkStealingQueue;
+
+extern ObscuraWorkStealingQueue *	ObscuraCreateWorkStealingQueue	(uint32_t, uint32_t, PFN_ObscuraWaitStrategy,
+									 ObscuraAllocationCallbacks *);
+extern void				ObscuraDestroyWorkStealingQueue	(ObscuraWorkStealingQueue **,
+									 ObscuraAllocationCallbacks *);
+
+extern void	ObscuraSpawnTask	(ObscuraWorkStealingQueue *, PFN_ObscuraTaskFunction, void *);
+extern void	ObscuraSyncTasks	(ObscuraWorkStealingQueue *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -426,14 +426,14 @@ quad_solver(float a, float b, float c, float *x0, float *x1)
 	if (d < 0) {
 		return false;
 	} else if (d == 0) {
-		*x0 = *x1 = -0.5 * b / a;
+		*x0 = *x1 = -0.5f * b / a;
 	} else {
-		float q = (b > 0) ? -0.5 * (b + sqrt(d)) : -0.5 * (b - sqrt(d));
+		float q = (b > 0) ? -0.5f * (b + sqrtf(d)) : -0.5f * (b - sqrtf(d));
 		*x0 = q / a;
 		*x1 = c / q;
 	}
 
-	if (x0 > x1) {
+	if (*x0 > *x1) {
 		float tmp = *x0;
 		*x0 = *x1;
 		*x1 = tmp;
@@ -2,13 +2,37 @@
 #include <emmintrin.h>
 #include <errno.h>
 #include <limits.h>
+#include <linux/futex.h>
 #include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <x86intrin.h>
 
 #include "thread.h"
 
+static void finish(ObscuraTaskGroup *);
+
+/*
+ * Parked threads sleep on epoch, which notifiers move on whenever some thread announced itself in sleepers.
+ */
+static volatile uint32_t epoch		__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+static volatile uint32_t sleepers	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
+static __thread uint64_t idle_since = 0;
+static __thread uint64_t last_wait = 0;
+static __thread bool announced = false;
+static __thread uint32_t announced_epoch = 0;
+
+/*
+ * CPUs the process may run on, as found when the first worker was pinned; taskset and cpusets may leave gaps.
+ */
+static pthread_once_t affinity_once = PTHREAD_ONCE_INIT;
+static cpu_set_t affinity;
+static uint32_t affinity_count = 0;
+
 static void *
 start_routine(void *arg)
 {
@@ -22,10 +46,48 @@ start_routine(void *arg)
 		}
 	}
 
-	while (wq->running) {
+	while (__atomic_load_n(&wq->running, __ATOMIC_ACQUIRE)) {
 		thr->cursor = __sync_fetch_and_add(&wq->tasks_consumer_cursor, 1);
+
+		/*
+		 * Taking the next ticket is what tells ObscuraWaitAll and the producer the previous task is over.
+		 */
+		if (wq->mode == OBSCURA_WORK_QUEUE_MODE_SINGLE_PRODUCER) {
+			ObscuraNotifyWaiters();
+		}
+
+		if (wq->mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+			uint64_t mask = wq->tasks_capacity - 1;
+			struct __work_queue_task *task = &wq->tasks[thr->cursor & mask];
+
+			/*
+			 * The head only tells which tickets were claimed; the slot tells when its task is written.
+			 */
+			while (__atomic_load_n(&task->sequence, __ATOMIC_ACQUIRE) != thr->cursor + 1) {
+				if (!__atomic_load_n(&wq->running, __ATOMIC_ACQUIRE)) {
+					return NULL;
+				}
+
+				wq->wait_strategy();
+			}
+
+			PFN_ObscuraTaskFunction func = task->func;
+			void *arg = task->arg;
+			ObscuraTaskGroup *group = task->group;
+			__atomic_store_n(&task->sequence, thr->cursor + wq->tasks_capacity, __ATOMIC_RELEASE);
+
+			func(arg);
+			if (group != NULL) {
+				finish(group);
+			}
+
+			__atomic_fetch_add(&wq->tasks_done_cursor, 1, __ATOMIC_RELEASE);
+			ObscuraNotifyWaiters();
+			continue;
+		}
+
 		while (thr->cursor >= wq->tasks_head_cursor) {
-			if (!wq->running) {
+			if (!__atomic_load_n(&wq->running, __ATOMIC_ACQUIRE)) {
 				return NULL;
 			}
 
@@ -40,6 +102,42 @@ start_routine(void *arg)
 	return NULL;
 }
 
+static void
+read_affinity(void)
+{
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &affinity)) {
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	affinity_count = CPU_COUNT(&affinity);
+}
+
+/*
+ * Pins a thread to the index-th CPU the process may run on, wrapping around when there are fewer.
+ */
+void
+ObscuraPinThread(pthread_t thread, uint32_t index)
+{
+	pthread_once(&affinity_once, &read_affinity);
+
+	uint32_t n = index % affinity_count;
+
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	for (uint32_t cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		if (CPU_ISSET(cpu, &affinity) && n-- == 0) {
+			CPU_SET(cpu, &cpuset);
+			break;
+		}
+	}
+
+	if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset)) {
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
 void
 ObscuraBusySpinWait()
 {
@@ -52,9 +150,62 @@ ObscuraYieldWait()
 	sched_yield();
 }
 
+/*
+ * The strategy cannot tell what its caller waits for, so a thread announces itself and returns once more
+ * before sleeping: if whatever it waits for happened after it last looked, the notifier saw the
+ * announcement and moved the epoch on, and the futex does not sleep.
+ */
+void
+ObscuraParkWait()
+{
+	uint64_t now = __rdtsc();
+	if (now - last_wait > OBSCURA_PARK_GAP_CYCLES) {
+		idle_since = now;
+
+		if (announced) {
+			__atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+			announced = false;
+		}
+	}
+	last_wait = now;
+
+	if (!announced && now - idle_since < OBSCURA_PARK_SPIN_CYCLES) {
+		_mm_pause();
+		return;
+	}
+
+	if (!announced) {
+		__atomic_fetch_add(&sleepers, 1, __ATOMIC_SEQ_CST);
+		announced_epoch = __atomic_load_n(&epoch, __ATOMIC_SEQ_CST);
+		announced = true;
+		return;
+	}
+
+	syscall(SYS_futex, &epoch, FUTEX_WAIT_PRIVATE, announced_epoch, NULL, NULL, 0);
+
+	__atomic_fetch_sub(&sleepers, 1, __ATOMIC_SEQ_CST);
+	announced = false;
+
+	idle_since = last_wait = __rdtsc();
+}
+
+/*
+ * Wakes the threads parked in ObscuraParkWait; costs a fence and a load while none is.
+ */
+void
+ObscuraNotifyWaiters()
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&sleepers, __ATOMIC_RELAXED) > 0) {
+		__atomic_fetch_add(&epoch, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
 ObscuraWorkQueue *
 ObscuraCreateWorkQueue(uint32_t threads_capacity, uint32_t tasks_capacity, PFN_ObscuraWaitStrategy wait_strategy,
-	ObscuraAllocationCallbacks *allocator)
+	ObscuraWorkQueueMode mode, ObscuraAllocationCallbacks *allocator)
 {
 	assert((tasks_capacity != 0) && ((tasks_capacity & (tasks_capacity - 1)) == 0));
 
@@ -65,6 +216,11 @@ ObscuraCreateWorkQueue(uint32_t threads_capacity, uint32_t tasks_capacity, PFN_O
 
 	wq->tasks_capacity = tasks_capacity;
 	wq->tasks = allocator->allocation(sizeof(struct __work_queue_task) * tasks_capacity, PAGESIZE);
+	for (uint32_t i = 0; i < tasks_capacity; i++) {
+		wq->tasks[i].sequence = i;
+	}
+
+	wq->mode = mode;
 
 	wq->wait_strategy = wait_strategy;
 
@@ -75,18 +231,7 @@ ObscuraCreateWorkQueue(uint32_t threads_capacity, uint32_t tasks_capacity, PFN_O
 			exit(EXIT_FAILURE);
 		}
 
-		if (pthread_detach(wq->threads[i].thread)) {
-			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
-			exit(EXIT_FAILURE);
-		}
-
-		cpu_set_t cpuset;
-		CPU_ZERO(&cpuset);
-		CPU_SET(i, &cpuset);
-		if (pthread_setaffinity_np(wq->threads[i].thread, sizeof(cpu_set_t), &cpuset)) {
-			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, strerror(errno));
-			exit(EXIT_FAILURE);
-		}
+		ObscuraPinThread(wq->threads[i].thread, i);
 	}
 
 	return wq;
@@ -97,8 +242,16 @@ ObscuraDestroyWorkQueue(ObscuraWorkQueue **ptr, ObscuraAllocationCallbacks *allo
 {
 	ObscuraWorkQueue *wq = *ptr;
 
-	wq->running = false;
+	/*
+	 * Workers only look at running while they wait for a task, hence the tasks left have to finish first.
+	 */
 	ObscuraWaitAll(wq);
+	__atomic_store_n(&wq->running, false, __ATOMIC_RELEASE);
+	ObscuraNotifyWaiters();
+
+	for (uint32_t i = 0; i < wq->threads_capacity; i++) {
+		pthread_join(wq->threads[i].thread, NULL);
+	}
 
 	allocator->free((*ptr)->tasks);
 	allocator->free((*ptr)->threads);
@@ -107,12 +260,55 @@ ObscuraDestroyWorkQueue(ObscuraWorkQueue **ptr, ObscuraAllocationCallbacks *allo
 	*ptr = NULL;
 }
 
+/*
+ * Producers claim a ticket by moving the head past it, provided its slot was handed over to their round,
+ * then write the task and publish it through the sequence of the slot.
+ */
+static void
+enqueue_shared(ObscuraWorkQueue *wq, ObscuraTaskGroup *group, PFN_ObscuraTaskFunction fn, void *arg)
+{
+	uint64_t mask = wq->tasks_capacity - 1;
+
+	for (;;) {
+		uint64_t i = __atomic_load_n(&wq->tasks_head_cursor, __ATOMIC_RELAXED);
+		struct __work_queue_task *task = &wq->tasks[i & mask];
+
+		uint64_t sequence = __atomic_load_n(&task->sequence, __ATOMIC_ACQUIRE);
+		if (sequence == i) {
+			if (__atomic_compare_exchange_n(&wq->tasks_head_cursor, &i, i + 1, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED)) {
+				task->func = fn;
+				task->arg = arg;
+				task->group = group;
+				__atomic_store_n(&task->sequence, i + 1, __ATOMIC_RELEASE);
+
+				ObscuraNotifyWaiters();
+				return;
+			}
+		} else if (sequence < i) {
+			/*
+			 * The slot still holds the task of the previous round: the ring is full.
+			 */
+			fn(arg);
+			if (group != NULL) {
+				finish(group);
+			}
+			return;
+		}
+	}
+}
+
 void
 ObscuraEnqueueTask(ObscuraWorkQueue *wq, PFN_ObscuraTaskFunction fn, void *arg)
 {
+	if (wq->mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+		enqueue_shared(wq, NULL, fn, arg);
+		return;
+	}
+
 	uint64_t i = wq->tasks_head_cursor;
 	while (__builtin_expect(i >= wq->tasks_tail_cursor + wq->tasks_capacity, 0)) {
-		if (!wq->running) {
+		if (!__atomic_load_n(&wq->running, __ATOMIC_ACQUIRE)) {
 			return;
 		}
 
@@ -141,14 +337,115 @@ ObscuraEnqueueTask(ObscuraWorkQueue *wq, PFN_ObscuraTaskFunction fn, void *arg)
 	task->arg = arg;
 
 	wq->tasks_head_cursor++;
+
+	ObscuraNotifyWaiters();
 }
 
+/*
+ * In multi-producer mode, waits until as many tasks finished as were claimed. Tasks enqueue their subtasks
+ * before they finish, so reading the finished count first never misses one.
+ */
 void
 ObscuraWaitAll(ObscuraWorkQueue *wq)
 {
+	if (wq->mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER) {
+		while (__atomic_load_n(&wq->tasks_done_cursor, __ATOMIC_ACQUIRE) <
+				__atomic_load_n(&wq->tasks_head_cursor, __ATOMIC_ACQUIRE)) {
+			wq->wait_strategy();
+		}
+		return;
+	}
+
 	for (uint32_t i = 0; i < wq->threads_capacity; i++) {
 		while (wq->threads[i].cursor < wq->tasks_head_cursor) {
 			wq->wait_strategy();
 		}
 	}
 }
+
+/*
+ * Starts the successors whose last predecessor this was, then lets waiters know; the group may be
+ * reinitialized as soon as completed is set, hence nothing touches it afterwards.
+ */
+static void
+complete(ObscuraTaskGroup *group)
+{
+	for (uint32_t i = 0; i < group->successors_count; i++) {
+		ObscuraSubmitTaskGroup(group->successors[i]);
+	}
+
+	__atomic_store_n(&group->completed, true, __ATOMIC_RELEASE);
+	ObscuraNotifyWaiters();
+}
+
+static void
+finish(ObscuraTaskGroup *group)
+{
+	if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+		complete(group);
+	}
+}
+
+/*
+ * func, which may be NULL, runs as a task of the group once it starts.
+ */
+void
+ObscuraInitTaskGroup(ObscuraTaskGroup *group, ObscuraWorkQueue *wq, PFN_ObscuraTaskFunction func, void *arg)
+{
+	assert(wq->mode == OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER);
+
+	group->wq               = wq;
+	group->func             = func;
+	group->arg              = arg;
+	group->successors_count = 0;
+	group->blockers         = 1;
+	group->pending          = 1;
+	group->completed        = false;
+}
+
+/*
+ * Keeps successor from starting before predecessor completed. Both must be initialized and neither
+ * submitted yet.
+ */
+void
+ObscuraAddTaskGroupDependency(ObscuraTaskGroup *successor, ObscuraTaskGroup *predecessor)
+{
+	assert(predecessor->successors_count < OBSCURA_TASK_GROUP_SUCCESSORS);
+
+	__atomic_fetch_add(&successor->blockers, 1, __ATOMIC_RELAXED);
+	predecessor->successors[predecessor->successors_count++] = successor;
+}
+
+void
+ObscuraEnqueueGroupTask(ObscuraTaskGroup *group, PFN_ObscuraTaskFunction fn, void *arg)
+{
+	__atomic_fetch_add(&group->pending, 1, __ATOMIC_RELAXED);
+
+	enqueue_shared(group->wq, group, fn, arg);
+}
+
+/*
+ * Releases the hold of the caller on the group; the last of the caller and the predecessors of the group
+ * to let go starts it.
+ */
+void
+ObscuraSubmitTaskGroup(ObscuraTaskGroup *group)
+{
+	if (__atomic_sub_fetch(&group->blockers, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	if (group->func != NULL) {
+		ObscuraEnqueueGroupTask(group, group->func, group->arg);
+	}
+
+	finish(group);
+}
+
+void
+ObscuraWaitTaskGroup(ObscuraTaskGroup *group)
+{
+	while (!__atomic_load_n(&group->completed, __ATOMIC_ACQUIRE)) {
+		group->wq->wait_strategy();
+	}
+}
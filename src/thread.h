@@ -25,9 +25,17 @@ typedef struct ObscuraExecutionCallbacks {
 	PFN_ObscuraProcessorCountFunction	nprocs;
 } ObscuraExecutionCallbacks;
 
+/*
+ * In multi-producer mode, the sequence of a slot tells whose turn it is: the producer of ticket i may fill
+ * it once it reads i, its consumer may read it once it reads i + 1, and the consumer hands it over to the
+ * next round by setting it to i + tasks_capacity.
+ */
 struct __work_queue_task {
 	PFN_ObscuraTaskFunction	 func;
 	void			*arg;
+	struct ObscuraTaskGroup	*group;
+
+	volatile uint64_t	sequence;
 };
 
 struct __work_queue_thread {
@@ -37,10 +45,34 @@ struct __work_queue_thread {
 
 typedef void	(*PFN_ObscuraWaitStrategy)	(void);
 
+/*
+ * ObscuraParkWait spins for about OBSCURA_PARK_SPIN_CYCLES timestamp counter cycles after the caller went
+ * idle, then puts the thread to sleep until ObscuraNotifyWaiters is called. Calls further apart than
+ * OBSCURA_PARK_GAP_CYCLES mean the caller found something to do in between, and start a new spin.
+ */
+#define OBSCURA_PARK_SPIN_CYCLES	200000
+#define OBSCURA_PARK_GAP_CYCLES		20000
+
 extern void	ObscuraBusySpinWait	(void);
 extern void	ObscuraYieldWait	(void);
+extern void	ObscuraParkWait		(void);
+extern void	ObscuraNotifyWaiters	(void);
+
+extern void	ObscuraPinThread	(pthread_t, uint32_t);
+
+/*
+ * A single-producer queue only takes tasks from one thread at a time, which waits whenever the ring is
+ * full. A multi-producer queue takes them from any thread, tasks included; a task enqueued onto a full ring
+ * is run by the producer right away instead, since the workers it would wait for may be producers too.
+ */
+typedef enum ObscuraWorkQueueMode {
+	OBSCURA_WORK_QUEUE_MODE_SINGLE_PRODUCER,
+	OBSCURA_WORK_QUEUE_MODE_MULTI_PRODUCER,
+} ObscuraWorkQueueMode;
 
 typedef struct ObscuraWorkQueue {
+	ObscuraWorkQueueMode	mode;
+
 	uint32_t			 threads_capacity;
 	struct __work_queue_thread	*threads;
 
@@ -53,15 +85,62 @@ typedef struct ObscuraWorkQueue {
 	volatile uint64_t	tasks_tail_cursor	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
 	volatile uint64_t	tasks_consumer_cursor	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
 
+	/*
+	 * Tasks finished, counted in multi-producer mode only.
+	 */
+	volatile uint64_t	tasks_done_cursor	__attribute__((aligned(LEVEL1_DCACHE_LINESIZE)));
+
 	bool	running;
 } ObscuraWorkQueue;
 
-extern ObscuraWorkQueue *	ObscuraCreateWorkQueue	(uint32_t, uint32_t, PFN_ObscuraWaitStrategy, ObscuraAllocationCallbacks *);
+#define OBSCURA_TASK_GROUP_SUCCESSORS	8
+
+/*
+ * Tasks whose completion can be waited for on its own, without waiting for the rest of the queue. A group
+ * may depend on other groups: its function, if any, runs as a task of the group once the group was
+ * submitted and all of its predecessors completed, and may enqueue more tasks into the group. The group
+ * completes once every task enqueued into it finished and its function ran, which in turn starts the groups
+ * depending on it; a small graph of tasks is thus submitted ahead and runs without the caller in between.
+ *
+ * Tasks enqueued into a group straight away do not wait for its predecessors. Groups need a queue in
+ * multi-producer mode, since the last task of a group starts its successors from a worker, and belong to
+ * the caller, which reinitializes them to use them again once they completed.
+ */
+typedef struct ObscuraTaskGroup {
+	struct ObscuraWorkQueue	*wq;
+
+	PFN_ObscuraTaskFunction	 func;
+	void			*arg;
+
+	uint32_t		 successors_count;
+	struct ObscuraTaskGroup	*successors[OBSCURA_TASK_GROUP_SUCCESSORS];
+
+	/*
+	 * Predecessors not completed yet, plus one until the group is submitted.
+	 */
+	volatile uint32_t	blockers;
+
+	/*
+	 * Tasks of the group not finished yet, plus one until the group starts.
+	 */
+	volatile uint32_t	pending;
+
+	volatile bool	completed;
+} ObscuraTaskGroup;
+
+extern ObscuraWorkQueue *	ObscuraCreateWorkQueue	(uint32_t, uint32_t, PFN_ObscuraWaitStrategy, ObscuraWorkQueueMode,
+							 ObscuraAllocationCallbacks *);
 extern void			ObscuraDestroyWorkQueue	(ObscuraWorkQueue **, ObscuraAllocationCallbacks *);
 
 extern void	ObscuraEnqueueTask	(ObscuraWorkQueue *, PFN_ObscuraTaskFunction, void *);
 extern void	ObscuraWaitAll		(ObscuraWorkQueue *);
 
+extern void	ObscuraInitTaskGroup		(ObscuraTaskGroup *, ObscuraWorkQueue *, PFN_ObscuraTaskFunction, void *);
+extern void	ObscuraAddTaskGroupDependency	(ObscuraTaskGroup *, ObscuraTaskGroup *);
+extern void	ObscuraEnqueueGroupTask		(ObscuraTaskGroup *, PFN_ObscuraTaskFunction, void *);
+extern void	ObscuraSubmitTaskGroup		(ObscuraTaskGroup *);
+extern void	ObscuraWaitTaskGroup		(ObscuraTaskGroup *);
+
 #ifdef __cplusplus
 }
 #endif
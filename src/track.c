@@ -0,0 +1,208 @@
+#include <assert.h>
+#include <execinfo.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "track.h"
+
+/*
+ * Every allocation is preceded by a header recording its size and tag; allocations aligned beyond the
+ * header size are padded up to their alignment, so the header always ends where the allocation starts.
+ */
+#define TRACK_HEADER_SIZE	16
+
+struct __track_header {
+	uint64_t	size;
+	uint32_t	tag;
+	uint32_t	offset;
+};
+
+#define TRACK_HEADER(ptr)	((struct __track_header *) ((uint8_t *) (ptr) - TRACK_HEADER_SIZE))
+
+static const char *tags[__ALLOCATION_TAG_NUM_ELMS] = {
+	"scene",
+	"world",
+	"renderer",
+	"work queue",
+};
+
+static ObscuraAllocationCallbacks *upstream = NULL;
+static bool forbidden = false;
+static volatile bool hot = false;
+
+static ObscuraAllocationStats stats[__ALLOCATION_TAG_NUM_ELMS];
+
+static void
+report(ObscuraAllocationTag tag, size_t size)
+{
+	void *buffer[64] = {};
+
+	fprintf(stderr, "%s:%d: allocation of %zu bytes charged to %s inside ObscuraDraw\n", __FILE__, __LINE__, size,
+		tags[tag]);
+
+	int calls = 0;
+	calls = backtrace(buffer, sizeof(buffer) / sizeof(void *));
+	backtrace_symbols_fd(buffer, calls, STDERR_FILENO);
+}
+
+static void *
+allocate(ObscuraAllocationTag tag, size_t size, size_t alignment)
+{
+	assert(upstream);
+
+	size_t offset = alignment > TRACK_HEADER_SIZE ? alignment : TRACK_HEADER_SIZE;
+
+	uint8_t *base = upstream->allocation(offset + size, offset);
+	uint8_t *ptr = base + offset;
+
+	struct __track_header *header = TRACK_HEADER(ptr);
+	header->size   = size;
+	header->tag    = tag;
+	header->offset = offset;
+
+	ObscuraAllocationStats *s = &stats[tag];
+	__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->bytes, size, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->live_count, 1, __ATOMIC_RELAXED);
+
+	uint64_t live = __atomic_add_fetch(&s->live_bytes, size, __ATOMIC_RELAXED);
+	uint64_t peak = __atomic_load_n(&s->peak_bytes, __ATOMIC_RELAXED);
+	while (peak < live && !__atomic_compare_exchange_n(&s->peak_bytes, &peak, live, true, __ATOMIC_RELAXED,
+			__ATOMIC_RELAXED)) {
+	}
+
+	if (hot) {
+		__atomic_fetch_add(&s->hot_count, 1, __ATOMIC_RELAXED);
+		if (forbidden) {
+			report(tag, size);
+		}
+	}
+
+	return ptr;
+}
+
+static void
+release(void *ptr)
+{
+	if (ptr == NULL) {
+		return;
+	}
+
+	struct __track_header *header = TRACK_HEADER(ptr);
+
+	ObscuraAllocationStats *s = &stats[header->tag];
+	__atomic_fetch_sub(&s->live_count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&s->live_bytes, header->size, __ATOMIC_RELAXED);
+
+	upstream->free((uint8_t *) ptr - header->offset);
+}
+
+/*
+ * Reallocations are charged as a fresh allocation followed by the release of the original.
+ */
+static void *
+reallocate(ObscuraAllocationTag tag, void *original, size_t size, size_t alignment)
+{
+	void *ptr = allocate(tag, size, alignment);
+
+	if (original != NULL) {
+		size_t original_size = TRACK_HEADER(original)->size;
+		memcpy(ptr, original, original_size < size ? original_size : size);
+		release(original);
+	}
+
+	return ptr;
+}
+
+#define TRACKED_CALLBACKS(name, tag)								\
+	static void *										\
+	name##_allocation(size_t size, size_t alignment)					\
+	{											\
+		return allocate(tag, size, alignment);						\
+	}											\
+												\
+	static void *										\
+	name##_reallocation(void *original, size_t size, size_t alignment)			\
+	{											\
+		return reallocate(tag, original, size, alignment);				\
+	}
+
+TRACKED_CALLBACKS(scene,      OBSCURA_ALLOCATION_TAG_SCENE)
+TRACKED_CALLBACKS(world,      OBSCURA_ALLOCATION_TAG_WORLD)
+TRACKED_CALLBACKS(renderer,   OBSCURA_ALLOCATION_TAG_RENDERER)
+TRACKED_CALLBACKS(work_queue, OBSCURA_ALLOCATION_TAG_WORK_QUEUE)
+
+ObscuraAllocationCallbacks ObscuraTrackedAllocationCallbacks[__ALLOCATION_TAG_NUM_ELMS] = {
+	[OBSCURA_ALLOCATION_TAG_SCENE] = {
+		.allocation   = &scene_allocation,
+		.reallocation = &scene_reallocation,
+		.free         = &release,
+	},
+	[OBSCURA_ALLOCATION_TAG_WORLD] = {
+		.allocation   = &world_allocation,
+		.reallocation = &world_reallocation,
+		.free         = &release,
+	},
+	[OBSCURA_ALLOCATION_TAG_RENDERER] = {
+		.allocation   = &renderer_allocation,
+		.reallocation = &renderer_reallocation,
+		.free         = &release,
+	},
+	[OBSCURA_ALLOCATION_TAG_WORK_QUEUE] = {
+		.allocation   = &work_queue_allocation,
+		.reallocation = &work_queue_reallocation,
+		.free         = &release,
+	},
+};
+
+/*
+ * Routes the tracked callbacks to allocator. With forbid_hot_path set, every allocation made between
+ * ObscuraEnterHotPath and ObscuraLeaveHotPath is reported on stderr together with a backtrace of its caller.
+ */
+void
+ObscuraTrackAllocations(ObscuraAllocationCallbacks *allocator, bool forbid_hot_path)
+{
+	upstream = allocator;
+	forbidden = forbid_hot_path;
+}
+
+void
+ObscuraEnterHotPath(void)
+{
+	__atomic_store_n(&hot, true, __ATOMIC_RELEASE);
+}
+
+void
+ObscuraLeaveHotPath(void)
+{
+	__atomic_store_n(&hot, false, __ATOMIC_RELEASE);
+}
+
+void
+ObscuraGetAllocationStats(ObscuraAllocationTag tag, ObscuraAllocationStats *s)
+{
+	assert(tag < __ALLOCATION_TAG_NUM_ELMS);
+
+	s->count      = __atomic_load_n(&stats[tag].count, __ATOMIC_RELAXED);
+	s->bytes      = __atomic_load_n(&stats[tag].bytes, __ATOMIC_RELAXED);
+	s->live_count = __atomic_load_n(&stats[tag].live_count, __ATOMIC_RELAXED);
+	s->live_bytes = __atomic_load_n(&stats[tag].live_bytes, __ATOMIC_RELAXED);
+	s->peak_bytes = __atomic_load_n(&stats[tag].peak_bytes, __ATOMIC_RELAXED);
+	s->hot_count  = __atomic_load_n(&stats[tag].hot_count, __ATOMIC_RELAXED);
+}
+
+void
+ObscuraDumpAllocationStats(FILE *stream)
+{
+	fprintf(stream, "%-12s %12s %16s %12s %16s %16s %12s\n", "tag", "count", "bytes", "live", "live bytes",
+		"peak bytes", "in draw");
+
+	for (uint32_t tag = 0; tag < __ALLOCATION_TAG_NUM_ELMS; tag++) {
+		ObscuraAllocationStats s = {};
+		ObscuraGetAllocationStats(tag, &s);
+
+		fprintf(stream, "%-12s %12lu %16lu %12lu %16lu %16lu %12lu\n", tags[tag], s.count, s.bytes, s.live_count,
+			s.live_bytes, s.peak_bytes, s.hot_count);
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef __OBSCURA_TRACK_H__
+#define __OBSCURA_TRACK_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Subsystem an allocation is charged to. Allocation callbacks carry no context, hence every tag has its own
+ * callbacks in ObscuraTrackedAllocationCallbacks; the tag of an allocation is remembered next to it, so it may
+ * be freed or reallocated through the callbacks of any tag.
+ */
+typedef enum ObscuraAllocationTag {
+	OBSCURA_ALLOCATION_TAG_SCENE,
+	OBSCURA_ALLOCATION_TAG_WORLD,
+	OBSCURA_ALLOCATION_TAG_RENDERER,
+	OBSCURA_ALLOCATION_TAG_WORK_QUEUE,
+	__ALLOCATION_TAG_NUM_ELMS,
+} ObscuraAllocationTag;
+
+typedef struct ObscuraAllocationStats {
+	uint64_t	count;
+	uint64_t	bytes;
+
+	uint64_t	live_count;
+	uint64_t	live_bytes;
+	uint64_t	peak_bytes;
+
+	/*
+	 * Allocations made while the renderer was inside ObscuraDraw.
+	 */
+	uint64_t	hot_count;
+} ObscuraAllocationStats;
+
+extern ObscuraAllocationCallbacks	ObscuraTrackedAllocationCallbacks[__ALLOCATION_TAG_NUM_ELMS];
+
+extern void	ObscuraTrackAllocations		(ObscuraAllocationCallbacks *, bool);
+extern void	ObscuraEnterHotPath		(void);
+extern void	ObscuraLeaveHotPath		(void);
+
+extern void	ObscuraGetAllocationStats	(ObscuraAllocationTag, ObscuraAllocationStats *);
+extern void	ObscuraDumpAllocationStats	(FILE *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
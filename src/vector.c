@@ -0,0 +1,33 @@
+#include <string.h>
+
+#include "vector.h"
+
+/*
+ * Returns the elements after doubling capacity, copying them out of storage on the first growth.
+ */
+void *
+ObscuraGrowSmallVector(void *elements, const void *storage, uint32_t *capacity, size_t element_size,
+		ObscuraAllocationCallbacks *allocator)
+{
+	uint32_t grown = *capacity * 2;
+
+	if (elements == storage) {
+		void *heap = allocator->allocation(element_size * grown, 8);
+		memcpy(heap, storage, element_size * *capacity);
+		elements = heap;
+	} else {
+		elements = allocator->reallocation(elements, element_size * grown, 8);
+	}
+
+	*capacity = grown;
+
+	return elements;
+}
+
+void
+ObscuraFreeSmallVector(void *elements, const void *storage, ObscuraAllocationCallbacks *allocator)
+{
+	if (elements != storage) {
+		allocator->free(elements);
+	}
+}
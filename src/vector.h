@@ -0,0 +1,26 @@
+#ifndef __OBSCURA_VECTOR_H__
+#define __OBSCURA_VECTOR_H__ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small vector keeps its first elements in storage embedded in whatever owns it, and only moves them to
+ * the heap once they outgrow it, doubling its capacity from then on. The owner declares the usual capacity,
+ * count and elements fields next to the storage; elements points either at the storage or at the heap.
+ * Owners of a small vector must not be copied or moved while the elements are inline.
+ */
+extern void *	ObscuraGrowSmallVector	(void *, const void *, uint32_t *, size_t, ObscuraAllocationCallbacks *);
+extern void	ObscuraFreeSmallVector	(void *, const void *, ObscuraAllocationCallbacks *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
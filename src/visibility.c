@@ -1,50 +1,115 @@
 #include <assert.h>
 
+#include "acceleration.h"
+#include "snapshot.h"
 #include "stat.h"
 #include "visibility.h"
 
-struct trace_ray_info {
-	ObscuraVisible		*visible;
-	ObscuraBoundingVolume	*ray;
-	vec4			 position;
-};
-
-static void
-trace(ObscuraNode *node, void *arg)
+/*
+ * Closest hit query: the interval of the ray ends at the returned hit, if any.
+ */
+ObscuraVisible
+ObscuraTraceRay(ObscuraScene *scene, vec4 position, ObscuraBoundingVolume *ray)
 {
-	if (ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_GEOMETRY) != NULL) {
-		struct trace_ray_info *info = arg;
+	assert(ray->type == OBSCURA_BOUNDING_VOLUME_TYPE_RAY);
+
+	ObscuraVisible visible = {};
+
+	if (scene->acceleration != NULL) {
+		ObscuraTraverseAccelerationStructure(scene->acceleration, position, ray, &visible);
+	} else {
+		ObscuraSnapshot *snapshot = scene->snapshot;
+		ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+		vec4 inverse = VEC4_ONE / r->direction;
+
+		uint32_t cursor = 0, group = 0, first = 0, end = 0;
+		uint64_t tests = 0;
 
-		ObscuraComponent *component = ObscuraFindAnyComponent(node, OBSCURA_COMPONENT_FAMILY_BOUNDING_VOLUME);
-		assert(component);
-		ObscuraBoundingVolume *volume = component->component;
+		while (ObscuraNextSnapshotRun(snapshot, position, inverse, r->tmin, r->tmax, &cursor, &group, &first, &end)) {
+			tests += end - first;
 
-		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], 1);
+			for (uint32_t i = first; i < end; i++) {
+				ObscuraCollision collision = {};
+				ObscuraCollidesWith(ray, position, snapshot->volumes[i], snapshot->positions[i], &collision);
+				if (collision.hit) {
+					r->tmax = collision.distance;
 
-		ObscuraCollision collision = {};
-		ObscuraCollidesWith(info->ray, info->position, volume, node->position, &collision);
-		if (collision.hit) {
-			if (!info->visible->geometry || collision.hit_point[2] > info->visible->collision.hit_point[2]) {
-				info->visible->geometry = node;
-				info->visible->collision = collision;
+					visible.geometry  = i;
+					visible.collision = collision;
+				}
 			}
 		}
+
+		__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
 	}
+
+	return visible;
 }
 
-ObscuraVisible
-ObscuraTraceRay(ObscuraScene *scene, vec4 position, ObscuraBoundingVolume *ray)
+/*
+ * Closest hit query for every active lane of a packet; visible holds one entry per lane.
+ */
+void
+ObscuraTracePacket(ObscuraScene *scene, ObscuraRayPacket *packet, ObscuraVisible *visible)
 {
-	assert(ray->type == OBSCURA_BOUNDING_VOLUME_TYPE_RAY);
+	if (scene->acceleration != NULL) {
+		ObscuraTraversePacketAccelerationStructure(scene->acceleration, packet, visible);
+		return;
+	}
 
-	ObscuraVisible visible = {};
+	for (uint32_t mask = packet->active; mask != 0; mask &= mask - 1) {
+		uint32_t lane = __builtin_ctz(mask);
+
+		ObscuraBoundingVolume ray = {
+			.type = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+		};
+		ObscuraBoundingVolumeRay *bounds = &ray.volume.ray;
+		ObscuraLoadRay(packet, lane, bounds);
+
+		visible[lane] = ObscuraTraceRay(scene, packet->position, &ray);
+		ObscuraStoreRay(packet, lane, bounds);
+	}
+}
 
-	struct trace_ray_info info = {
-		.visible  = &visible,
-		.ray      = ray,
-		.position = position,
+/*
+ * Any hit query: reports whether some geometry lies along the ray between tmin and tmax, without looking
+ * for the nearest one.
+ */
+bool
+ObscuraOccluded(ObscuraScene *scene, vec4 origin, vec4 direction, float tmin, float tmax)
+{
+	ObscuraBoundingVolume ray = {
+		.type       = OBSCURA_BOUNDING_VOLUME_TYPE_RAY,
+		.volume.ray = {
+			.direction = direction,
+			.tmin      = tmin,
+			.tmax      = tmax,
+		},
 	};
-	ObscuraTraverseScene(scene, &trace, &info);
 
-	return visible;
+	if (scene->acceleration != NULL) {
+		return ObscuraOccludedAccelerationStructure(scene->acceleration, origin, &ray);
+	}
+
+	ObscuraSnapshot *snapshot = scene->snapshot;
+	vec4 inverse = VEC4_ONE / direction;
+
+	uint32_t cursor = 0, group = 0, first = 0, end = 0;
+	uint64_t tests = 0;
+	bool occluded = false;
+
+	while (!occluded && ObscuraNextSnapshotRun(snapshot, origin, inverse, tmin, tmax, &cursor, &group, &first, &end)) {
+		uint32_t i = first;
+		while (!occluded && i < end) {
+			ObscuraCollision collision = {};
+			ObscuraCollidesWith(&ray, origin, snapshot->volumes[i], snapshot->positions[i], &collision);
+			occluded = collision.hit;
+			i++;
+		}
+		tests += i - first;
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+
+	return occluded;
 }
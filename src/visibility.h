@@ -1,6 +1,8 @@
 #ifndef __OBSCURA_VISIBILITY_H__
 #define __OBSCURA_VISIBILITY_H__ 1
 
+#include <stdbool.h>
+
 #include "collision.h"
 #include "scene.h"
 #include "tensor.h"
@@ -9,12 +11,32 @@
 extern "C" {
 #endif
 
+/*
+ * Closest hit of a ray; geometry identifies the geometry hit in the scene snapshot and is only meaningful
+ * when the collision is a hit.
+ */
 typedef struct ObscuraVisible {
-	ObscuraNode		*geometry;
-	ObscuraCollision	 collision;
+	uint32_t		geometry;
+	ObscuraCollision	collision;
 } ObscuraVisible;
 
-extern ObscuraVisible	ObscuraTraceRay	(ObscuraScene *, vec4, ObscuraBoundingVolume *);
+extern ObscuraVisible	ObscuraTraceRay		(ObscuraScene *, vec4, ObscuraBoundingVolume *);
+extern void		ObscuraTracePacket	(ObscuraScene *, ObscuraRayPacket *, ObscuraVisible *);
+extern bool		ObscuraOccluded		(ObscuraScene *, vec4, vec4, float, float);
+
+/*
+ * Caches a geometry of the scene snapshot together with its position, bounding volume and the world space
+ * box enclosing it, so that acceleration structures never have to reach back into the snapshot while
+ * tracing.
+ */
+typedef struct ObscuraPrimitive {
+	vec4	lower;
+	vec4	upper;
+	vec4	position;
+
+	ObscuraBoundingVolume	*volume;
+	uint32_t		 geometry;
+} ObscuraPrimitive;
 
 #ifdef __cplusplus
 }
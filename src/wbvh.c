@@ -0,0 +1,457 @@
+#include <assert.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "bvh.h"
+#include "stat.h"
+#include "wbvh.h"
+
+#define WIDE_QUANTIZATION_LEVELS	255
+
+/*
+ * Binary subtrees holding this many primitives or fewer become a single leaf child, which keeps the node
+ * count, and so the footprint per primitive, low.
+ */
+#define WIDE_LEAF_CAPACITY		4
+
+struct __wide_entry {
+	uint32_t	index;
+	float		distance;
+};
+
+struct __wide_build {
+	ObscuraWideBoundingVolumeHierarchy	*wbvh;
+	ObscuraBoundingVolumeHierarchy		*binary;
+
+	uint32_t	*firsts;
+	uint32_t	*counts;
+
+	ObscuraPrimitive	*primitives;
+	ObscuraPrimitive	*ordered;
+	uint32_t		 cursor;
+};
+
+/*
+ * Ray constants shared by every node test: the node boxes are decoded as origin + q * scale, so each
+ * plane distance reduces to q * (scale * inverse) + (origin - position) * inverse. The plane distances
+ * are the first operand of the min and max reductions so that the NaN produced by an axis parallel ray
+ * leaves the running interval untouched.
+ */
+struct __wide_ray {
+	float	position[3];
+	float	inverse[3];
+	bool	negative[3];
+	float	tmin;
+};
+
+static inline float
+area(vec4 lower, vec4 upper)
+{
+	vec4 e = _mm_max_ps(upper - lower, VEC4_ZERO);
+
+	return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+}
+
+static inline float
+power(int8_t exponent)
+{
+	union {
+		uint32_t	u;
+		float		f;
+	} v = { .u = (uint32_t) (exponent + 127) << 23 };
+
+	return v.f;
+}
+
+static void
+quantize(struct __wide_node *node, vec4 lower, vec4 upper)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		int exponent = 0;
+		frexpf((upper[axis] - lower[axis]) / WIDE_QUANTIZATION_LEVELS, &exponent);
+
+		node->origin[axis]   = lower[axis];
+		node->exponent[axis] = (exponent < -126) ? -126 : ((exponent > 127) ? 127 : exponent);
+	}
+}
+
+static void
+encode(struct __wide_node *node, int slot, vec4 lower, vec4 upper)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		float inverse = 1.0f / power(node->exponent[axis]);
+
+		float lo = floorf((lower[axis] - node->origin[axis]) * inverse);
+		float hi = ceilf((upper[axis] - node->origin[axis]) * inverse);
+
+		node->lower[axis][slot] = (uint8_t) fmaxf(fminf(lo, WIDE_QUANTIZATION_LEVELS), 0);
+		node->upper[axis][slot] = (uint8_t) fmaxf(fminf(hi, WIDE_QUANTIZATION_LEVELS), 0);
+	}
+}
+
+static inline bool
+leaf(struct __wide_build *build, uint32_t index)
+{
+	return build->binary->nodes[index].count > 0 || build->counts[index] <= WIDE_LEAF_CAPACITY;
+}
+
+/*
+ * Turns the binary subtree rooted at source into the wide node target. The subtree is opened greedily,
+ * always expanding the interior node of largest surface area, until eight children are collected or only
+ * leaves remain. Binary subtrees keep their primitives contiguous, so a small one is taken as a whole
+ * leaf. Leaf primitives are copied out in wide node order so that the runs of a node stay within
+ * reach of its 8-bit offsets.
+ */
+static void
+collapse(struct __wide_build *build, uint32_t source, uint32_t target, uint32_t depth)
+{
+	ObscuraWideBoundingVolumeHierarchy *wbvh = build->wbvh;
+	struct __hierarchy_node *nodes = build->binary->nodes;
+
+	if (wbvh->depth < depth) {
+		wbvh->depth = depth;
+	}
+
+	uint32_t children[OBSCURA_WIDE_NODE_WIDTH] = { source };
+	uint32_t children_count = 1;
+
+	while (children_count < OBSCURA_WIDE_NODE_WIDTH) {
+		int best = -1;
+		float best_area = -1;
+		for (uint32_t i = 0; i < children_count; i++) {
+			struct __hierarchy_node *child = &nodes[children[i]];
+			if (!leaf(build, children[i]) && area(child->lower, child->upper) > best_area) {
+				best = i;
+				best_area = area(child->lower, child->upper);
+			}
+		}
+
+		if (best < 0) {
+			break;
+		}
+
+		struct __hierarchy_node *child = &nodes[children[best]];
+		children[best] = child->offset;
+		children[children_count++] = child->right;
+	}
+
+	struct __wide_node *node = &wbvh->nodes[target];
+	quantize(node, nodes[source].lower, nodes[source].upper);
+
+	node->internal  = 0;
+	node->child     = wbvh->nodes_count;
+	node->primitive = build->cursor;
+
+	uint32_t internal_count = 0;
+	for (uint32_t i = 0; i < OBSCURA_WIDE_NODE_WIDTH; i++) {
+		node->count[i]  = 0;
+		node->offset[i] = 0;
+
+		if (i >= children_count) {
+			for (int axis = 0; axis < 3; axis++) {
+				node->lower[axis][i] = WIDE_QUANTIZATION_LEVELS;
+				node->upper[axis][i] = 0;
+			}
+			continue;
+		}
+
+		struct __hierarchy_node *child = &nodes[children[i]];
+		encode(node, i, child->lower, child->upper);
+
+		uint32_t count = build->counts[children[i]];
+		if (leaf(build, children[i])) {
+			node->count[i]  = count;
+			node->offset[i] = build->cursor - node->primitive;
+
+			memcpy(&build->ordered[build->cursor], &build->primitives[build->firsts[children[i]]], sizeof(ObscuraPrimitive) * count);
+			build->cursor += count;
+		} else {
+			node->internal |= 1 << i;
+			node->offset[i] = internal_count++;
+		}
+	}
+	wbvh->nodes_count += internal_count;
+
+	uint32_t first = node->child;
+	for (uint32_t i = 0; i < children_count; i++) {
+		if (!leaf(build, children[i])) {
+			collapse(build, children[i], first++, depth + 1);
+		}
+	}
+}
+
+static inline uint32_t
+intersect(struct __wide_node *node, struct __wide_ray *ray, float closest, float *distances)
+{
+	vec4 tnear[2] = { _mm_set1_ps(ray->tmin), _mm_set1_ps(ray->tmin) };
+	vec4 tfar[2]  = { _mm_set1_ps(closest), _mm_set1_ps(closest) };
+
+	for (int axis = 0; axis < 3; axis++) {
+		vec4 a = _mm_set1_ps(power(node->exponent[axis]) * ray->inverse[axis]);
+		vec4 b = _mm_set1_ps((node->origin[axis] - ray->position[axis]) * ray->inverse[axis]);
+
+		uint8_t *near = ray->negative[axis] ? node->upper[axis] : node->lower[axis];
+		uint8_t *far  = ray->negative[axis] ? node->lower[axis] : node->upper[axis];
+
+		for (int half = 0; half < 2; half++) {
+			vec4 qn = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_loadu_si32(&near[4 * half])));
+			vec4 qf = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_loadu_si32(&far[4 * half])));
+
+			tnear[half] = _mm_max_ps(qn * a + b, tnear[half]);
+			tfar[half]  = _mm_min_ps(qf * a + b, tfar[half]);
+		}
+	}
+
+	_mm_storeu_ps(&distances[0], tnear[0]);
+	_mm_storeu_ps(&distances[4], tnear[1]);
+
+	return _mm_movemask_ps(_mm_cmple_ps(tnear[0], tfar[0])) | (_mm_movemask_ps(_mm_cmple_ps(tnear[1], tfar[1])) << 4);
+}
+
+__attribute__((target("avx2,fma")))
+static uint32_t
+intersect8(struct __wide_node *node, struct __wide_ray *ray, float closest, float *distances)
+{
+	__m256 tnear = _mm256_set1_ps(ray->tmin);
+	__m256 tfar  = _mm256_set1_ps(closest);
+
+	for (int axis = 0; axis < 3; axis++) {
+		__m256 a = _mm256_set1_ps(power(node->exponent[axis]) * ray->inverse[axis]);
+		__m256 b = _mm256_set1_ps((node->origin[axis] - ray->position[axis]) * ray->inverse[axis]);
+
+		uint8_t *near = ray->negative[axis] ? node->upper[axis] : node->lower[axis];
+		uint8_t *far  = ray->negative[axis] ? node->lower[axis] : node->upper[axis];
+
+		__m256 qn = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) near)));
+		__m256 qf = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *) far)));
+
+		tnear = _mm256_max_ps(_mm256_fmadd_ps(qn, a, b), tnear);
+		tfar  = _mm256_min_ps(_mm256_fmadd_ps(qf, a, b), tfar);
+	}
+
+	_mm256_storeu_ps(distances, tnear);
+
+	return _mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ));
+}
+
+ObscuraWideBoundingVolumeHierarchy *
+ObscuraCreateWideBoundingVolumeHierarchy(ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraWideBoundingVolumeHierarchy *wbvh = allocator->allocation(sizeof(ObscuraWideBoundingVolumeHierarchy), 8);
+	wbvh->avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+	return wbvh;
+}
+
+void
+ObscuraDestroyWideBoundingVolumeHierarchy(ObscuraWideBoundingVolumeHierarchy **ptr, ObscuraAllocationCallbacks *allocator)
+{
+	allocator->free((*ptr)->nodes);
+	allocator->free(*ptr);
+
+	*ptr = NULL;
+}
+
+void
+ObscuraBuildWideBoundingVolumeHierarchy(ObscuraWideBoundingVolumeHierarchy *wbvh, ObscuraPrimitive *primitives,
+	uint32_t count, ObscuraAllocationCallbacks *allocator)
+{
+	wbvh->nodes_count = 0;
+	wbvh->depth = 0;
+	if (count == 0) {
+		return;
+	}
+
+	ObscuraBoundingVolumeHierarchy *binary = ObscuraCreateBoundingVolumeHierarchy(allocator);
+	ObscuraBuildBoundingVolumeHierarchy(binary, primitives, count, allocator);
+
+	/*
+	 * Every wide node but the root consumes at least one binary interior node.
+	 */
+	uint32_t capacity = binary->nodes_count / 2 + 1;
+	if (wbvh->nodes_capacity < capacity) {
+		allocator->free(wbvh->nodes);
+
+		wbvh->nodes_capacity = capacity;
+		wbvh->nodes = allocator->allocation(sizeof(struct __wide_node) * wbvh->nodes_capacity, LEVEL1_DCACHE_LINESIZE);
+	}
+
+	struct __wide_build build = {
+		.wbvh       = wbvh,
+		.binary     = binary,
+		.firsts     = allocator->allocation(sizeof(uint32_t) * binary->nodes_count, LEVEL1_DCACHE_LINESIZE),
+		.counts     = allocator->allocation(sizeof(uint32_t) * binary->nodes_count, LEVEL1_DCACHE_LINESIZE),
+		.primitives = primitives,
+		.ordered    = allocator->allocation(sizeof(ObscuraPrimitive) * count, LEVEL1_DCACHE_LINESIZE),
+		.cursor     = 0,
+	};
+
+	/*
+	 * Children are laid out after their parent, so a reverse sweep sees both before it.
+	 */
+	for (uint32_t i = binary->nodes_count; i > 0; i--) {
+		struct __hierarchy_node *node = &binary->nodes[i - 1];
+		if (node->count > 0) {
+			build.firsts[i - 1] = node->offset;
+			build.counts[i - 1] = node->count;
+		} else {
+			build.firsts[i - 1] = build.firsts[node->offset];
+			build.counts[i - 1] = build.counts[node->offset] + build.counts[node->right];
+		}
+	}
+
+	wbvh->nodes_count = 1;
+	collapse(&build, 0, 0, 0);
+	assert(build.cursor == count);
+
+	memcpy(primitives, build.ordered, sizeof(ObscuraPrimitive) * count);
+
+	allocator->free(build.firsts);
+	allocator->free(build.counts);
+	allocator->free(build.ordered);
+	ObscuraDestroyBoundingVolumeHierarchy(&binary, allocator);
+}
+
+void
+ObscuraTraverseWideBoundingVolumeHierarchy(ObscuraWideBoundingVolumeHierarchy *wbvh, ObscuraPrimitive *primitives,
+	ObscuraSphereSet *spheres, vec4 position, ObscuraBoundingVolume *ray, ObscuraVisible *visible)
+{
+	if (wbvh->nodes_count == 0) {
+		return;
+	}
+
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+	vec4 inverse = VEC4_ONE / r->direction;
+
+	struct __wide_ray wr;
+	for (int axis = 0; axis < 3; axis++) {
+		wr.position[axis] = position[axis];
+		wr.inverse[axis]  = inverse[axis];
+		wr.negative[axis] = inverse[axis] < 0;
+	}
+	wr.tmin = r->tmin;
+
+	uint64_t tests = 0;
+
+	/*
+	 * Every level leaves at most seven pending siblings on the stack besides the node being expanded.
+	 */
+	struct __wide_entry stack[(wbvh->depth + 1) * OBSCURA_WIDE_NODE_WIDTH];
+	uint32_t depth = 0;
+
+	stack[depth].index    = 0;
+	stack[depth].distance = r->tmin;
+	depth++;
+
+	while (depth > 0) {
+		depth--;
+		if (stack[depth].distance >= r->tmax) {
+			continue;
+		}
+
+		struct __wide_node *node = &wbvh->nodes[stack[depth].index];
+
+		float distances[OBSCURA_WIDE_NODE_WIDTH];
+		uint32_t hits = wbvh->avx2 ? intersect8(node, &wr, r->tmax, distances) : intersect(node, &wr, r->tmax, distances);
+
+		/*
+		 * Insertion sort of the children hit, nearest first.
+		 */
+		uint32_t order[OBSCURA_WIDE_NODE_WIDTH];
+		uint32_t order_count = 0;
+		while (hits != 0) {
+			uint32_t i = __builtin_ctz(hits);
+			hits &= hits - 1;
+
+			uint32_t j = order_count++;
+			while (j > 0 && distances[order[j - 1]] > distances[i]) {
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+
+		for (uint32_t k = 0; k < order_count; k++) {
+			uint32_t i = order[k];
+			if (node->count[i] == 0 || distances[i] >= r->tmax) {
+				continue;
+			}
+
+			tests += node->count[i];
+
+			uint32_t j = ObscuraCollidesWithSphereSet(ray, position, spheres, node->primitive + node->offset[i], node->count[i]);
+			if (j != OBSCURA_SPHERE_SET_MISS) {
+				visible->geometry = primitives[j].geometry;
+				ObscuraResolveCollision(ray, position, primitives[j].position, r->tmax, &visible->collision);
+			}
+		}
+
+		for (uint32_t k = order_count; k > 0; k--) {
+			uint32_t i = order[k - 1];
+			if ((node->internal & (1 << i)) == 0 || distances[i] >= r->tmax) {
+				continue;
+			}
+
+			stack[depth].index    = node->child + node->offset[i];
+			stack[depth].distance = distances[i];
+			depth++;
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+}
+
+bool
+ObscuraOccludedWideBoundingVolumeHierarchy(ObscuraWideBoundingVolumeHierarchy *wbvh, ObscuraSphereSet *spheres,
+	vec4 position, ObscuraBoundingVolume *ray)
+{
+	if (wbvh->nodes_count == 0) {
+		return false;
+	}
+
+	ObscuraBoundingVolumeRay *r = &ray->volume.ray;
+	vec4 inverse = VEC4_ONE / r->direction;
+
+	struct __wide_ray wr;
+	for (int axis = 0; axis < 3; axis++) {
+		wr.position[axis] = position[axis];
+		wr.inverse[axis]  = inverse[axis];
+		wr.negative[axis] = inverse[axis] < 0;
+	}
+	wr.tmin = r->tmin;
+
+	bool occluded = false;
+	uint64_t tests = 0;
+
+	uint32_t stack[(wbvh->depth + 1) * OBSCURA_WIDE_NODE_WIDTH];
+	uint32_t depth = 0;
+
+	stack[depth++] = 0;
+
+	while (depth > 0 && !occluded) {
+		struct __wide_node *node = &wbvh->nodes[stack[--depth]];
+
+		float distances[OBSCURA_WIDE_NODE_WIDTH];
+		uint32_t hits = wbvh->avx2 ? intersect8(node, &wr, r->tmax, distances) : intersect(node, &wr, r->tmax, distances);
+
+		while (hits != 0 && !occluded) {
+			uint32_t i = __builtin_ctz(hits);
+			hits &= hits - 1;
+
+			if (node->internal & (1 << i)) {
+				stack[depth++] = node->child + node->offset[i];
+			} else if (node->count[i] > 0) {
+				tests += node->count[i];
+
+				occluded = ObscuraCollidesWithSphereSet(ray, position, spheres, node->primitive + node->offset[i],
+					node->count[i]) != OBSCURA_SPHERE_SET_MISS;
+			}
+		}
+	}
+
+	__sync_fetch_and_add(&ObscuraCounters[OBSCURA_COUNTER_TYPE_RAY_GEOM_INTERSECT], tests);
+
+	return occluded;
+}
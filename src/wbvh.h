@@ -0,0 +1,67 @@
+#ifndef __OBSCURA_WBVH_H__
+#define __OBSCURA_WBVH_H__ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "collision.h"
+#include "memory.h"
+#include "tensor.h"
+#include "visibility.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OBSCURA_WIDE_NODE_WIDTH	8
+
+/*
+ * Eight children per node, their boxes quantized to 8 bits per plane on a power of two grid anchored at
+ * the lower corner of the node. Interior children are stored contiguously from child and leaf children
+ * reference a run of count primitives, both located by offset. Empty slots have neither a count nor
+ * their internal bit set.
+ */
+struct __wide_node {
+	float	origin[3];
+	int8_t	exponent[3];
+	uint8_t	internal;
+
+	uint32_t	child;
+	uint32_t	primitive;
+
+	uint8_t	count[OBSCURA_WIDE_NODE_WIDTH];
+	uint8_t	offset[OBSCURA_WIDE_NODE_WIDTH];
+
+	uint8_t	lower[3][OBSCURA_WIDE_NODE_WIDTH];
+	uint8_t	upper[3][OBSCURA_WIDE_NODE_WIDTH];
+};
+
+/*
+ * Compressed wide bounding volume hierarchy collapsed from the binary SAH hierarchy. All eight children
+ * of a node are tested at once, with AVX2 when the processor supports it.
+ */
+typedef struct ObscuraWideBoundingVolumeHierarchy {
+	uint32_t		 nodes_capacity;
+	uint32_t		 nodes_count;
+	struct __wide_node	*nodes;
+
+	uint32_t	depth;
+	bool		avx2;
+} ObscuraWideBoundingVolumeHierarchy;
+
+extern ObscuraWideBoundingVolumeHierarchy *	ObscuraCreateWideBoundingVolumeHierarchy	(ObscuraAllocationCallbacks *);
+extern void					ObscuraDestroyWideBoundingVolumeHierarchy	(ObscuraWideBoundingVolumeHierarchy **,
+	ObscuraAllocationCallbacks *);
+
+extern void	ObscuraBuildWideBoundingVolumeHierarchy		(ObscuraWideBoundingVolumeHierarchy *, ObscuraPrimitive *,
+	uint32_t, ObscuraAllocationCallbacks *);
+extern void	ObscuraTraverseWideBoundingVolumeHierarchy	(ObscuraWideBoundingVolumeHierarchy *, ObscuraPrimitive *,
+	ObscuraSphereSet *, vec4, ObscuraBoundingVolume *, ObscuraVisible *);
+extern bool	ObscuraOccludedWideBoundingVolumeHierarchy	(ObscuraWideBoundingVolumeHierarchy *, ObscuraSphereSet *, vec4,
+	ObscuraBoundingVolume *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
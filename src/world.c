@@ -7,6 +7,8 @@
 #include <string.h>
 #include <yaml.h>
 
+#include "acceleration.h"
+#include "arena.h"
 #include "camera.h"
 #include "collision.h"
 #include "geometry.h"
@@ -14,12 +16,14 @@
 #include "material.h"
 #include "memory.h"
 #include "scene.h"
+#include "snapshot.h"
 #include "thread.h"
 #include "world.h"
 
 #define PARSER_STATE_CAPACITY	256
 static struct parser_state {
 	enum {
+		PARSER_STATE_TYPE_ACCELERATION,
 		PARSER_STATE_TYPE_CAMERA,
 		PARSER_STATE_TYPE_CAMERA_ANTI_ALIASING,
 		PARSER_STATE_TYPE_CAMERA_PERSPECTIVE,
@@ -28,6 +32,7 @@ static struct parser_state {
 		PARSER_STATE_TYPE_BOUNDING_VOLUME_AABB,
 		PARSER_STATE_TYPE_BOUNDING_VOLUME_SPHERE,
 		PARSER_STATE_TYPE_BOUNDING_VOLUMES,
+		PARSER_STATE_TYPE_CHILDREN,
 		PARSER_STATE_TYPE_COLOR,
 		PARSER_STATE_TYPE_COLOR_OR_TEXTURE,
 		PARSER_STATE_TYPE_COMPONENTS,
@@ -64,6 +69,11 @@ static struct parser_anchor {
 }		anchors[PARSER_ANCHOR_CAPACITY] = {};
 static int8_t	anchoridx = -1;
 
+/*
+ * Cleared when the world asks for no acceleration structure, rather than leaving the default one.
+ */
+static bool	indexed = true;
+
 static void
 camera_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator)
 {
@@ -121,13 +131,13 @@ camera_perspective_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks
 	evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
 
 	if (!strcmp((char *) event->data.scalar.value, "aspect_ratio")) {
-		evstack[evpointer].ptr = &((ObscuraCameraPerspective *) camera->projection)->aspect_ratio;
+		evstack[evpointer].ptr = &camera->projection.perspective.aspect_ratio;
 	} else if (!strcmp((char *) event->data.scalar.value, "yfov")) {
-		evstack[evpointer].ptr = &((ObscuraCameraPerspective *) camera->projection)->yfov;
+		evstack[evpointer].ptr = &camera->projection.perspective.yfov;
 	} else if (!strcmp((char *) event->data.scalar.value, "znear")) {
-		evstack[evpointer].ptr = &((ObscuraCameraPerspective *) camera->projection)->znear;
+		evstack[evpointer].ptr = &camera->projection.perspective.znear;
 	} else if (!strcmp((char *) event->data.scalar.value, "zfar")) {
-		evstack[evpointer].ptr = &((ObscuraCameraPerspective *) camera->projection)->zfar;
+		evstack[evpointer].ptr = &camera->projection.perspective.zfar;
 	} else {
 		assert(false);
 	}
@@ -202,7 +212,7 @@ bounds_sphere_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allo
 	evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
 
 	if (!strcmp((char *) event->data.scalar.value, "radius")) {
-		evstack[evpointer].ptr = &((ObscuraBoundingVolumeSphere *) volume->volume)->radius;
+		evstack[evpointer].ptr = &volume->volume.sphere.radius;
 	} else {
 		assert(false);
 	}
@@ -223,7 +233,7 @@ bounds_aabb_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *alloca
 	evstack[evpointer].type = PARSER_STATE_TYPE_VECTOR4;
 
 	if (!strcmp((char *) event->data.scalar.value, "half_extents")) {
-		evstack[evpointer].ptr = &((ObscuraBoundingVolumeAABB *) volume->volume)->half_extents;
+		evstack[evpointer].ptr = &volume->volume.aabb.half_extents;
 	} else {
 		assert(false);
 	}
@@ -264,14 +274,14 @@ bounding_volumes_end_event(yaml_event_t *event __attribute__((unused)), ObscuraA
 
 
 static void
-components_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
+components_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator)
 {
 	ObscuraNode *node = evstack[evpointer].ptr;
 
 	for (int i = 0; i < anchoridx + 1; i++) {
 		if (!strcmp(anchors[i].name, (char *) event->data.alias.anchor)) {
 			ObscuraComponent *component = anchors[i].ptr;
-			ObscuraAttachComponent(node, component);
+			ObscuraAttachComponent(node, component, allocator);
 		}
 	}
 }
@@ -313,7 +323,7 @@ geometry_sphere_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *al
 	evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
 
 	if (!strcmp((char *) event->data.scalar.value, "radius")) {
-		evstack[evpointer].ptr = &((ObscuraGeometrySphere *) geometry->geometry)->radius;
+		evstack[evpointer].ptr = &geometry->geometry.sphere.radius;
 	} else {
 		assert(false);
 	}
@@ -397,7 +407,7 @@ light_ambient_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allo
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "color")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR;
-		evstack[evpointer].ptr = &((ObscuraLightAmbient *) light->source)->color;
+		evstack[evpointer].ptr = &light->source.ambient.color;
 	} else {
 		assert(false);
 	}
@@ -417,10 +427,10 @@ light_directional_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "color")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR;
-		evstack[evpointer].ptr = &((ObscuraLightDirectional *) light->source)->color;
+		evstack[evpointer].ptr = &light->source.directional.color;
 	} else if (!strcmp((char *) event->data.scalar.value, "direction")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_VECTOR4;
-		evstack[evpointer].ptr = &((ObscuraLightDirectional *) light->source)->direction;
+		evstack[evpointer].ptr = &light->source.directional.direction;
 	} else {
 		assert(false);
 	}
@@ -430,7 +440,7 @@ static void
 light_directional_end_event(yaml_event_t *event __attribute__((unused)), ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	ObscuraLight *light = evstack[evpointer].ptr;
-	ObscuraLightDirectional *source = (ObscuraLightDirectional *) light->source;
+	ObscuraLightDirectional *source = &light->source.directional;
 	source->direction = vec4_normalize(source->direction);
 
 	evpointer--;
@@ -444,16 +454,16 @@ light_point_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *alloca
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "color")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR;
-		evstack[evpointer].ptr = &((ObscuraLightPoint *) light->source)->color;
+		evstack[evpointer].ptr = &light->source.point.color;
 	} else if (!strcmp((char *) event->data.scalar.value, "constant_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightPoint *) light->source)->constant_attenuation;
+		evstack[evpointer].ptr = &light->source.point.constant_attenuation;
 	} else if (!strcmp((char *) event->data.scalar.value, "linear_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightPoint *) light->source)->linear_attenuation;
+		evstack[evpointer].ptr = &light->source.point.linear_attenuation;
 	} else if (!strcmp((char *) event->data.scalar.value, "quadratic_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightPoint *) light->source)->quadratic_attenuation;
+		evstack[evpointer].ptr = &light->source.point.quadratic_attenuation;
 	} else {
 		assert(false);
 	}
@@ -473,25 +483,25 @@ light_spot_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocat
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "color")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->color;
+		evstack[evpointer].ptr = &light->source.spot.color;
 	} else if (!strcmp((char *) event->data.scalar.value, "direction")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_VECTOR4;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->direction;
+		evstack[evpointer].ptr = &light->source.spot.direction;
 	} else if (!strcmp((char *) event->data.scalar.value, "constant_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->constant_attenuation;
+		evstack[evpointer].ptr = &light->source.spot.constant_attenuation;
 	} else if (!strcmp((char *) event->data.scalar.value, "linear_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->linear_attenuation;
+		evstack[evpointer].ptr = &light->source.spot.linear_attenuation;
 	} else if (!strcmp((char *) event->data.scalar.value, "quadratic_attenuation")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->quadratic_attenuation;
+		evstack[evpointer].ptr = &light->source.spot.quadratic_attenuation;
 	} else if (!strcmp((char *) event->data.scalar.value, "falloff_angle")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->falloff_angle;
+		evstack[evpointer].ptr = &light->source.spot.falloff_angle;
 	} else if (!strcmp((char *) event->data.scalar.value, "falloff_exponent")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraLightSpot *) light->source)->falloff_exponent;
+		evstack[evpointer].ptr = &light->source.spot.falloff_exponent;
 	} else {
 		assert(false);
 	}
@@ -501,7 +511,7 @@ static void
 light_spot_end_event(yaml_event_t *event __attribute__((unused)), ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
 	ObscuraLight *light = evstack[evpointer].ptr;
-	ObscuraLightSpot *source = (ObscuraLightSpot *) light->source;
+	ObscuraLightSpot *source = &light->source.spot;
 	source->direction = vec4_normalize(source->direction);
 
 	evpointer--;
@@ -569,22 +579,22 @@ material_constant_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "emission")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->emission;
+		evstack[evpointer].ptr = &material->effect.constant.emission;
 	} else if (!strcmp((char *) event->data.scalar.value, "reflective")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->reflective;
+		evstack[evpointer].ptr = &material->effect.constant.reflective;
 	} else if (!strcmp((char *) event->data.scalar.value, "reflectivity")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->reflectivity;
+		evstack[evpointer].ptr = &material->effect.constant.reflectivity;
 	} else if (!strcmp((char *) event->data.scalar.value, "transparent")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->transparent;
+		evstack[evpointer].ptr = &material->effect.constant.transparent;
 	} else if (!strcmp((char *) event->data.scalar.value, "transparency")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->transparency;
+		evstack[evpointer].ptr = &material->effect.constant.transparency;
 	} else if (!strcmp((char *) event->data.scalar.value, "index_of_refraction")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialConstant *) material->effect)->index_of_refraction;
+		evstack[evpointer].ptr = &material->effect.constant.index_of_refraction;
 	} else {
 		assert(false);
 	}
@@ -604,34 +614,34 @@ material_phong_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *all
 	evpointer++;
 	if (!strcmp((char *) event->data.scalar.value, "emission")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->emission;
+		evstack[evpointer].ptr = &material->effect.phong.emission;
 	} else if (!strcmp((char *) event->data.scalar.value, "ambient")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->ambient;
+		evstack[evpointer].ptr = &material->effect.phong.ambient;
 	} else if (!strcmp((char *) event->data.scalar.value, "diffuse")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->diffuse;
+		evstack[evpointer].ptr = &material->effect.phong.diffuse;
 	} else if (!strcmp((char *) event->data.scalar.value, "specular")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->specular;
+		evstack[evpointer].ptr = &material->effect.phong.specular;
 	} else if (!strcmp((char *) event->data.scalar.value, "shininess")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->shininess;
+		evstack[evpointer].ptr = &material->effect.phong.shininess;
 	} else if (!strcmp((char *) event->data.scalar.value, "reflective")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->reflective;
+		evstack[evpointer].ptr = &material->effect.phong.reflective;
 	} else if (!strcmp((char *) event->data.scalar.value, "reflectivity")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->reflectivity;
+		evstack[evpointer].ptr = &material->effect.phong.reflectivity;
 	} else if (!strcmp((char *) event->data.scalar.value, "transparent")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COLOR_OR_TEXTURE;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->transparent;
+		evstack[evpointer].ptr = &material->effect.phong.transparent;
 	} else if (!strcmp((char *) event->data.scalar.value, "transparency")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->transparency;
+		evstack[evpointer].ptr = &material->effect.phong.transparency;
 	} else if (!strcmp((char *) event->data.scalar.value, "index_of_refraction")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_FLOAT;
-		evstack[evpointer].ptr = &((ObscuraMaterialPhong *) material->effect)->index_of_refraction;
+		evstack[evpointer].ptr = &material->effect.phong.index_of_refraction;
 	} else {
 		assert(false);
 	}
@@ -679,6 +689,9 @@ node_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator __a
 	if (!strcmp((char *) event->data.scalar.value, "components")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_COMPONENTS;
 		evstack[evpointer].ptr  = node;
+	} else if (!strcmp((char *) event->data.scalar.value, "children")) {
+		evstack[evpointer].type = PARSER_STATE_TYPE_CHILDREN;
+		evstack[evpointer].ptr  = node;
 	} else if (!strcmp((char *) event->data.scalar.value, "position")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_VECTOR4;
 		evstack[evpointer].ptr  = &node->position;
@@ -699,6 +712,35 @@ node_end_event(yaml_event_t *event __attribute__((unused)), ObscuraAllocationCal
 	evpointer--;
 }
 
+/*
+ * Children are nodes of their own, placed relative to their parent; they belong to the scene through it.
+ */
+static void
+children_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraNode *parent = evstack[evpointer].ptr;
+
+	evpointer++;
+	ObscuraNode *node = ObscuraCreateNode(allocator);
+	assert(node);
+	ObscuraAttachChild(parent, node, allocator);
+
+	evstack[evpointer].type = PARSER_STATE_TYPE_NODE;
+	evstack[evpointer].ptr  = node;
+
+	if (event->data.scalar.anchor != NULL) {
+		anchoridx++;
+		strcpy(anchors[anchoridx].name, (char *) event->data.scalar.anchor);
+		anchors[anchoridx].ptr = node;
+	}
+}
+
+static void
+children_end_event(yaml_event_t *event __attribute__((unused)), ObscuraAllocationCallbacks *allocator __attribute__((unused)))
+{
+	evpointer--;
+}
+
 static void
 nodes_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator)
 {
@@ -724,6 +766,38 @@ nodes_end_event(yaml_event_t *event __attribute__((unused)), ObscuraAllocationCa
 	evpointer--;
 }
 
+static void
+acceleration_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator)
+{
+	ObscuraScene *scene = evstack[evpointer].ptr;
+	assert(scene->acceleration == NULL);
+
+	if (!strcmp((char *) event->data.scalar.value, "none")) {
+		indexed = false;
+		evpointer--;
+		return;
+	}
+
+	scene->acceleration = ObscuraCreateAccelerationStructure(allocator);
+	assert(scene->acceleration);
+
+	if (!strcmp((char *) event->data.scalar.value, "list")) {
+		ObscuraBindAccelerationStructure(scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_LIST, allocator);
+	} else if (!strcmp((char *) event->data.scalar.value, "bvh")) {
+		ObscuraBindAccelerationStructure(scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH, allocator);
+	} else if (!strcmp((char *) event->data.scalar.value, "lbvh")) {
+		ObscuraBindAccelerationStructure(scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_LBVH, allocator);
+	} else if (!strcmp((char *) event->data.scalar.value, "grid")) {
+		ObscuraBindAccelerationStructure(scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_GRID, allocator);
+	} else if (!strcmp((char *) event->data.scalar.value, "wbvh")) {
+		ObscuraBindAccelerationStructure(scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_WBVH, allocator);
+	} else {
+		assert(false);
+	}
+
+	evpointer--;
+}
+
 static void
 scene_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator __attribute__((unused)))
 {
@@ -751,6 +825,9 @@ scene_scalar_event(yaml_event_t *event, ObscuraAllocationCallbacks *allocator __
 	} else if (!strcmp((char *) event->data.scalar.value, "view")) {
 		evstack[evpointer].type = PARSER_STATE_TYPE_REF;
 		evstack[evpointer].ptr  = &scene->view;
+	} else if (!strcmp((char *) event->data.scalar.value, "acceleration")) {
+		evstack[evpointer].type = PARSER_STATE_TYPE_ACCELERATION;
+		evstack[evpointer].ptr  = scene;
 	} else {
 		assert(false);
 	}
@@ -766,6 +843,7 @@ ObscuraWorld *
 ObscuraCreateWorld(ObscuraAllocationCallbacks *allocator)
 {
 	ObscuraWorld *world = allocator->allocation(sizeof(ObscuraWorld), 8);
+	world->arena = ObscuraCreateArena(OBSCURA_ARENA_BLOCK_SIZE, allocator);
 
 	return world;
 }
@@ -773,6 +851,7 @@ ObscuraCreateWorld(ObscuraAllocationCallbacks *allocator)
 void
 ObscuraDestroyWorld(ObscuraWorld **ptr, ObscuraAllocationCallbacks *allocator)
 {
+	ObscuraDestroyArena(&(*ptr)->arena, allocator);
 	allocator->free(*ptr);
 
 	*ptr = NULL;
@@ -793,7 +872,13 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 	}
 	yaml_parser_set_input_file(&parser, file);
 
-	world->scene = ObscuraCreateScene(allocator);
+	/*
+	 * The scene graph is allocated from the arena of the world, only the acceleration structure and the
+	 * snapshot, which are rebuilt and resized after loading, come from the allocator.
+	 */
+	ObscuraAllocationCallbacks *arena = ObscuraBindArena(world->arena);
+
+	world->scene = ObscuraCreateScene(arena);
 	assert(world->scene);
 
 	evpointer = 0;
@@ -807,13 +892,22 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		}
 
 		switch (evstack[evpointer].type) {
+		case PARSER_STATE_TYPE_ACCELERATION:
+			switch (event.type) {
+			case YAML_SCALAR_EVENT:
+				acceleration_scalar_event(&event, allocator);
+				break;
+			default:
+				break;
+			}
+			break;
 		case PARSER_STATE_TYPE_CAMERA:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				camera_scalar_event(&event, allocator);
+				camera_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				camera_end_event(&event, allocator);
+				camera_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -822,10 +916,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_CAMERA_ANTI_ALIASING:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				camera_anti_aliasing_scalar_event(&event, allocator);
+				camera_anti_aliasing_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				camera_anti_aliasing_end_event(&event, allocator);
+				camera_anti_aliasing_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -834,10 +928,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_CAMERA_PERSPECTIVE:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				camera_perspective_scalar_event(&event, allocator);
+				camera_perspective_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				camera_perspective_end_event(&event, allocator);
+				camera_perspective_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -846,10 +940,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_CAMERAS:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				cameras_scalar_event(&event, allocator);
+				cameras_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				cameras_end_event(&event, allocator);
+				cameras_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -858,10 +952,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_BOUNDING_VOLUME:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				bounds_scalar_event(&event, allocator);
+				bounds_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				bounds_end_event(&event, allocator);
+				bounds_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -870,10 +964,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_BOUNDING_VOLUME_AABB:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				bounds_aabb_scalar_event(&event, allocator);
+				bounds_aabb_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				bounds_aabb_end_event(&event, allocator);
+				bounds_aabb_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -882,10 +976,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_BOUNDING_VOLUME_SPHERE:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				bounds_sphere_scalar_event(&event, allocator);
+				bounds_sphere_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				bounds_sphere_end_event(&event, allocator);
+				bounds_sphere_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -894,10 +988,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_BOUNDING_VOLUMES:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				bounding_volumes_scalar_event(&event, allocator);
+				bounding_volumes_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				bounding_volumes_end_event(&event, allocator);
+				bounding_volumes_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -953,10 +1047,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_COMPONENTS:
 			switch (event.type) {
 			case YAML_ALIAS_EVENT:
-				components_scalar_event(&event, allocator);
+				components_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				components_end_event(&event, allocator);
+				components_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -985,10 +1079,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_GEOMETRY:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				geometry_scalar_event(&event, allocator);
+				geometry_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				geometry_end_event(&event, allocator);
+				geometry_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -997,10 +1091,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_GEOMETRY_SPHERE:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				geometry_sphere_scalar_event(&event, allocator);
+				geometry_sphere_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				geometry_sphere_end_event(&event, allocator);
+				geometry_sphere_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1009,10 +1103,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_GEOMETRIES:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				geometries_scalar_event(&event, allocator);
+				geometries_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				geometries_end_event(&event, allocator);
+				geometries_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1021,10 +1115,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHT:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				light_scalar_event(&event, allocator);
+				light_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				light_end_event(&event, allocator);
+				light_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1033,10 +1127,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHT_AMBIENT:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				light_ambient_scalar_event(&event, allocator);
+				light_ambient_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				light_ambient_end_event(&event, allocator);
+				light_ambient_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1045,10 +1139,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHT_DIRECTIONAL:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				light_directional_scalar_event(&event, allocator);
+				light_directional_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				light_directional_end_event(&event, allocator);
+				light_directional_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1057,10 +1151,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHT_POINT:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				light_point_scalar_event(&event, allocator);
+				light_point_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				light_point_end_event(&event, allocator);
+				light_point_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1069,10 +1163,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHT_SPOT:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				light_spot_scalar_event(&event, allocator);
+				light_spot_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				light_spot_end_event(&event, allocator);
+				light_spot_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1081,10 +1175,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_LIGHTS:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				lights_scalar_event(&event, allocator);
+				lights_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				lights_end_event(&event, allocator);
+				lights_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1093,10 +1187,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_MATERIAL:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				material_scalar_event(&event, allocator);
+				material_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				material_end_event(&event, allocator);
+				material_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1105,10 +1199,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_MATERIAL_CONSTANT:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				material_constant_scalar_event(&event, allocator);
+				material_constant_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				material_constant_end_event(&event, allocator);
+				material_constant_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1117,10 +1211,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_MATERIAL_PHONG:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				material_phong_scalar_event(&event, allocator);
+				material_phong_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				material_phong_end_event(&event, allocator);
+				material_phong_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1129,10 +1223,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_MATERIALS:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				materials_scalar_event(&event, allocator);
+				materials_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				materials_end_event(&event, allocator);
+				materials_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1157,10 +1251,22 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_NODE:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				node_scalar_event(&event, allocator);
+				node_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				node_end_event(&event, allocator);
+				node_end_event(&event, arena);
+				break;
+			default:
+				break;
+			}
+			break;
+		case PARSER_STATE_TYPE_CHILDREN:
+			switch (event.type) {
+			case YAML_MAPPING_START_EVENT:
+				children_scalar_event(&event, arena);
+				break;
+			case YAML_SEQUENCE_END_EVENT:
+				children_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1169,10 +1275,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_NODES:
 			switch (event.type) {
 			case YAML_MAPPING_START_EVENT:
-				nodes_scalar_event(&event, allocator);
+				nodes_scalar_event(&event, arena);
 				break;
 			case YAML_SEQUENCE_END_EVENT:
-				nodes_end_event(&event, allocator);
+				nodes_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1207,10 +1313,10 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 		case PARSER_STATE_TYPE_SCENE:
 			switch (event.type) {
 			case YAML_SCALAR_EVENT:
-				scene_scalar_event(&event, allocator);
+				scene_scalar_event(&event, arena);
 				break;
 			case YAML_MAPPING_END_EVENT:
-				scene_end_event(&event, allocator);
+				scene_end_event(&event, arena);
 				break;
 			default:
 				break;
@@ -1228,16 +1334,50 @@ ObscuraLoadWorld(ObscuraWorld *world, const char *filename, ObscuraAllocationCal
 
 	yaml_event_delete(&event);
 	yaml_parser_delete(&parser);
+
+	ObscuraFlattenScene(world->scene, arena);
+	ObscuraUpdateTransforms(world->scene);
+
+	world->scene->snapshot = ObscuraCreateSnapshot(allocator);
+	ObscuraCompileSnapshot(world->scene->snapshot, world->scene, allocator);
+
+	/*
+	 * Without an acceleration structure, rays are traced through the snapshot, skipping the subtrees they
+	 * miss.
+	 */
+	if (world->scene->acceleration == NULL && indexed) {
+		world->scene->acceleration = ObscuraCreateAccelerationStructure(allocator);
+		ObscuraBindAccelerationStructure(world->scene->acceleration, OBSCURA_ACCELERATION_STRUCTURE_TYPE_BVH, allocator);
+	}
+	if (world->scene->acceleration != NULL) {
+		ObscuraBuildAccelerationStructure(world->scene->acceleration, world->scene->snapshot, allocator);
+	}
 }
 
 void
 ObscuraUnloadWorld(ObscuraWorld *world, ObscuraAllocationCallbacks *allocator)
 {
-	ObscuraDestroyScene(&world->scene, allocator);
+	ObscuraScene *scene = world->scene;
+
+	if (scene->acceleration != NULL) {
+		ObscuraDestroyAccelerationStructure(&scene->acceleration, allocator);
+	}
+
+	if (scene->snapshot != NULL) {
+		ObscuraDestroySnapshot(&scene->snapshot, allocator);
+	}
+
+	/*
+	 * Everything else in the scene lives in the arena and goes at once.
+	 */
+	ObscuraResetArena(world->arena);
+	world->scene = NULL;
 
 	explicit_bzero(evstack, sizeof(struct parser_state));
 	evpointer = -1;
 
 	explicit_bzero(anchors, sizeof(struct parser_anchor));
 	anchoridx = -1;
+
+	indexed = true;
 }
@@ -1,6 +1,7 @@
 #ifndef __OBSCURA_WORLD_H__
 #define __OBSCURA_WORLD_H__ 1
 
+#include "arena.h"
 #include "memory.h"
 #include "scene.h"
 
@@ -8,8 +9,14 @@
 extern "C" {
 #endif
 
+/*
+ * The scene graph of a loaded world lives in the arena of the world and is released in one go when the
+ * world is unloaded.
+ */
 typedef struct ObscuraWorld {
 	ObscuraScene		*scene;
+
+	ObscuraArena		*arena;
 } ObscuraWorld;
 
 extern ObscuraWorld *	ObscuraCreateWorld	(ObscuraAllocationCallbacks *);